@@ -0,0 +1,1357 @@
+// Microbenchmarks of the library's hot paths, each measured against the code
+// it replaced where that can still be run side by side.
+//
+//   bscm-bench [section...]   (every section if none is given)
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "BluetoothDevice.h"
+#include "BluetoothManager.h"
+#include "Common.h"
+#include "DBusCall.h"
+#include "GattDatabase.h"
+#include "ManagedObjects.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations made by the whole process, GLib's included (main() sends
+// GSlice to malloc). Counted by wrapping glibc's malloc entry points; with
+// any other C library every count reads 0.
+std::atomic<uint64_t> allocations{0};
+}  // namespace
+
+#if defined(__GLIBC__)
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) noexcept
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) noexcept
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+namespace
+{
+// Time and heap allocations of one run
+struct Cost
+{
+  double ns;
+  double allocations;
+};
+
+// Keeps the compiler from discarding a result nobody reads
+template <typename T>
+void keep(const T& value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Runs `body` `runs` times (after one warm-up run) and returns the average
+// cost of a run
+template <typename Body>
+Cost measure(size_t runs, Body&& body)
+{
+  body();
+  uint64_t first = allocations.load();
+  auto     begin = Clock::now();
+  for (size_t i = 0; i < runs; ++i)
+  {
+    body();
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - begin;
+  return {elapsed.count() / runs,
+          static_cast<double>(allocations.load() - first) / runs};
+}
+
+void print_header(const char* title)
+{
+  std::printf("\n%s\n  %-30s %11s %11s %8s  %s\n",
+              title,
+              "case",
+              "before ns",
+              "after ns",
+              "speedup",
+              "allocations");
+}
+
+void print_row(const std::string& name, Cost before, Cost after)
+{
+  std::printf("  %-30s %11.1f %11.1f %7.1fx  %.1f -> %.1f\n",
+              name.c_str(),
+              before.ns,
+              after.ns,
+              before.ns / after.ns,
+              before.allocations,
+              after.allocations);
+}
+
+// ---------------------------------------------------------------------------
+// hex: Utils hex kernels against the stringstream conversions they replaced
+
+namespace legacy
+{
+std::string bytes_to_hex_string(const std::vector<uint8_t>& data)
+{
+  std::stringstream ss;
+  ss << std::hex << std::setfill('0');
+  for (const auto& byte : data)
+  {
+    ss << std::setw(2) << static_cast<int>(byte);
+    if (&byte != &data.back())
+    {
+      ss << " ";
+    }
+  }
+  return ss.str();
+}
+
+std::vector<uint8_t> hex_string_to_bytes(const std::string& hex_str)
+{
+  std::vector<uint8_t> bytes;
+  std::string          clean_hex = hex_str;
+
+  clean_hex.erase(std::remove(clean_hex.begin(), clean_hex.end(), ' '),
+                  clean_hex.end());
+  std::transform(
+    clean_hex.begin(), clean_hex.end(), clean_hex.begin(), ::toupper);
+
+  for (size_t i = 0; i < clean_hex.length(); i += 2)
+  {
+    if (i + 1 < clean_hex.length())
+    {
+      std::string byte_str = clean_hex.substr(i, 2);
+      uint8_t byte = static_cast<uint8_t>(std::stoul(byte_str, nullptr, 16));
+      bytes.push_back(byte);
+    }
+  }
+
+  return bytes;
+}
+}  // namespace legacy
+
+void bench_hex()
+{
+  print_header("hex: stringstream conversion vs. Utils kernels");
+
+  for (size_t size : {20, 512})
+  {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+      data[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+    std::string spaced = Utils::bytes_to_hex_string(data);
+    std::string suffix = " " + std::to_string(size) + " B";
+    size_t      runs   = size < 100 ? 200000 : 20000;
+
+    Cost before =
+      measure(runs, [&] { keep(legacy::bytes_to_hex_string(data)); });
+    Cost after =
+      measure(runs, [&] { keep(Utils::bytes_to_hex_string(data)); });
+    print_row("bytes_to_hex_string" + suffix, before, after);
+
+    // What a caller with its own buffer pays, spaced and contiguous
+    std::vector<char> out(size * 3);
+    for (char separator : {' ', '\0'})
+    {
+      after = measure(runs,
+                      [&]
+                      {
+                        keep(Utils::hex_encode(data.data(),
+                                               size,
+                                               out.data(),
+                                               out.size(),
+                                               separator));
+                      });
+      print_row(std::string("hex_encode ") +
+                  (separator ? "spaced" : "contiguous") + suffix,
+                before,
+                after);
+    }
+
+    before = measure(runs, [&] { keep(legacy::hex_string_to_bytes(spaced)); });
+    after  = measure(runs, [&] { keep(Utils::hex_string_to_bytes(spaced)); });
+    print_row("hex_string_to_bytes" + suffix, before, after);
+
+    std::vector<uint8_t> decoded(size);
+    after = measure(runs,
+                    [&]
+                    {
+                      size_t length;
+                      keep(Utils::hex_decode(spaced.data(),
+                                             spaced.size(),
+                                             decoded.data(),
+                                             decoded.size(),
+                                             length));
+                    });
+    print_row("hex_decode" + suffix, before, after);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic BlueZ object trees, shaped like what bluetoothd reports
+
+struct TreeShape
+{
+  size_t devices;
+  size_t services;         // per device
+  size_t characteristics;  // per service
+  size_t descriptors;      // per characteristic
+};
+
+std::string device_path(size_t device)
+{
+  char path[64];
+  std::snprintf(path,
+                sizeof(path),
+                "/org/bluez/hci0/dev_00_00_00_00_%02X_%02X",
+                static_cast<unsigned>(device >> 8 & 0xff),
+                static_cast<unsigned>(device & 0xff));
+  return path;
+}
+
+std::string device_address(size_t device)
+{
+  char address[18];
+  std::snprintf(address,
+                sizeof(address),
+                "00:00:00:00:%02X:%02X",
+                static_cast<unsigned>(device >> 8 & 0xff),
+                static_cast<unsigned>(device & 0xff));
+  return address;
+}
+
+std::string hex_handle(unsigned handle)
+{
+  char text[5];
+  std::snprintf(text, sizeof(text), "%04x", handle & 0xffff);
+  return text;
+}
+
+std::string uuid16(unsigned short_uuid)
+{
+  char uuid[37];
+  std::snprintf(uuid,
+                sizeof(uuid),
+                "0000%04x-0000-1000-8000-00805f9b34fb",
+                short_uuid & 0xffff);
+  return uuid;
+}
+
+// Adds one object with `interface` and the two every BlueZ object has
+void add_object(GVariantBuilder*   objects,
+                const std::string& path,
+                const char*        interface,
+                GVariant*          properties)
+{
+  GVariantBuilder interfaces;
+  g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+  g_variant_builder_add(&interfaces,
+                        "{s@a{sv}}",
+                        "org.freedesktop.DBus.Introspectable",
+                        g_variant_new("a{sv}", nullptr));
+  g_variant_builder_add(&interfaces, "{s@a{sv}}", interface, properties);
+  g_variant_builder_add(&interfaces,
+                        "{s@a{sv}}",
+                        BlueZ::PROPERTIES_INTERFACE,
+                        g_variant_new("a{sv}", nullptr));
+  g_variant_builder_add(
+    objects, "{o@a{sa{sv}}}", path.c_str(), g_variant_builder_end(&interfaces));
+}
+
+// Adds the Device1 object of `device` and its GATT tree
+void add_device(GVariantBuilder* objects, const TreeShape& shape, size_t device)
+{
+  std::string     path    = device_path(device);
+  std::string     address = device_address(device);
+  GVariantBuilder properties;
+  g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(
+    &properties, "{sv}", "Address", g_variant_new_string(address.c_str()));
+  g_variant_builder_add(
+    &properties, "{sv}", "Name", g_variant_new_string("bscm-bench"));
+  g_variant_builder_add(&properties,
+                        "{sv}",
+                        "Adapter",
+                        g_variant_new_object_path("/org/bluez/hci0"));
+  g_variant_builder_add(
+    &properties, "{sv}", "Connected", g_variant_new_boolean(FALSE));
+  g_variant_builder_add(
+    &properties, "{sv}", "ServicesResolved", g_variant_new_boolean(FALSE));
+  g_variant_builder_add(&properties, "{sv}", "RSSI", g_variant_new_int16(-60));
+  add_object(objects,
+             path,
+             BlueZ::DEVICE_INTERFACE,
+             g_variant_builder_end(&properties));
+
+  // Handles as bluetoothd numbers them: one per attribute, in tree order
+  unsigned handle = 1;
+  for (size_t s = 0; s < shape.services; ++s)
+  {
+    std::string service = path + "/service" + hex_handle(handle++);
+    g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&properties,
+                          "{sv}",
+                          "UUID",
+                          g_variant_new_string(uuid16(0x1800 + s).c_str()));
+    g_variant_builder_add(
+      &properties, "{sv}", "Device", g_variant_new_object_path(path.c_str()));
+    g_variant_builder_add(
+      &properties, "{sv}", "Primary", g_variant_new_boolean(TRUE));
+    add_object(objects,
+               service,
+               BlueZ::GATT_SERVICE_INTERFACE,
+               g_variant_builder_end(&properties));
+
+    for (size_t c = 0; c < shape.characteristics; ++c)
+    {
+      std::string characteristic = service + "/char" + hex_handle(handle);
+      handle += 2;  // declaration and value
+      const char* flags[] = {"read", "write", "notify", nullptr};
+      g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add(
+        &properties,
+        "{sv}",
+        "UUID",
+        g_variant_new_string(uuid16(0x2a00 + s * 16 + c).c_str()));
+      g_variant_builder_add(&properties,
+                            "{sv}",
+                            "Service",
+                            g_variant_new_object_path(service.c_str()));
+      g_variant_builder_add(
+        &properties, "{sv}", "Flags", g_variant_new_strv(flags, -1));
+      g_variant_builder_add(
+        &properties, "{sv}", "MTU", g_variant_new_uint16(247));
+      add_object(objects,
+                 characteristic,
+                 BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+                 g_variant_builder_end(&properties));
+
+      for (size_t d = 0; d < shape.descriptors; ++d)
+      {
+        std::string descriptor =
+          characteristic + "/desc" + hex_handle(handle++);
+        g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add(&properties,
+                              "{sv}",
+                              "UUID",
+                              g_variant_new_string(uuid16(0x2902 + d).c_str()));
+        g_variant_builder_add(
+          &properties,
+          "{sv}",
+          "Characteristic",
+          g_variant_new_object_path(characteristic.c_str()));
+        add_object(objects,
+                   descriptor,
+                   BlueZ::GATT_DESCRIPTOR_INTERFACE,
+                   g_variant_builder_end(&properties));
+      }
+    }
+  }
+}
+
+// A GetManagedObjects reply, (a{oa{sa{sv}}}), for hci0 and `shape.devices`
+// devices. Owned by the caller.
+GVariant* managed_objects(const TreeShape& shape)
+{
+  GVariantBuilder objects;
+  g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+
+  GVariantBuilder adapter;
+  g_variant_builder_init(&adapter, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(
+    &adapter, "{sv}", "Address", g_variant_new_string("00:00:00:00:00:00"));
+  g_variant_builder_add(
+    &adapter, "{sv}", "Powered", g_variant_new_boolean(TRUE));
+  g_variant_builder_add(
+    &adapter, "{sv}", "Discovering", g_variant_new_boolean(FALSE));
+  add_object(&objects,
+             "/org/bluez/hci0",
+             BlueZ::ADAPTER_INTERFACE,
+             g_variant_builder_end(&adapter));
+
+  for (size_t device = 0; device < shape.devices; ++device)
+  {
+    add_device(&objects, shape, device);
+  }
+
+  GVariant* objects_value = g_variant_builder_end(&objects);
+  return g_variant_ref_sink(g_variant_new_tuple(&objects_value, 1));
+}
+
+// ---------------------------------------------------------------------------
+// managed-objects: selective GetManagedObjects walk against unpacking every
+// object with g_variant_iter_loop
+
+void bench_managed_objects()
+{
+  print_header("managed-objects: one device's objects out of a full reply");
+
+  const TreeShape shapes[] = {{100, 3, 2, 0}, {1000, 3, 2, 0}};
+  for (const TreeShape& shape : shapes)
+  {
+    GVariant*   reply  = managed_objects(shape);
+    std::string prefix = device_path(shape.devices / 2) + "/";
+    size_t      runs   = shape.devices < 500 ? 2000 : 200;
+
+    size_t objects  = 0;
+    size_t matching = 0;
+    ManagedObjects::for_each_object(
+      reply, "/", [&](const char*, GVariant*) { ++objects; });
+    ManagedObjects::for_each_object(
+      reply, prefix.c_str(), [&](const char*, GVariant*) { ++matching; });
+
+    // As discovery used to find a device's objects
+    Cost before = measure(runs,
+                          [&]
+                          {
+                            GVariantIter* objects_iter;
+                            g_variant_get(
+                              reply, "(a{oa{sa{sv}}})", &objects_iter);
+
+                            const gchar* object_path;
+                            GVariant*    interfaces;
+                            size_t       found = 0;
+                            while (g_variant_iter_loop(objects_iter,
+                                                       "{&o@a{sa{sv}}}",
+                                                       &object_path,
+                                                       &interfaces))
+                            {
+                              if (g_str_has_prefix(object_path, prefix.c_str()))
+                              {
+                                ++found;
+                              }
+                            }
+                            g_variant_iter_free(objects_iter);
+                            keep(found);
+                          });
+    Cost after  = measure(runs,
+                         [&]
+                         {
+                           size_t found = 0;
+                           ManagedObjects::for_each_object(
+                             reply,
+                             prefix.c_str(),
+                             [&](const char*, GVariant*) { ++found; });
+                           keep(found);
+                         });
+    print_row(std::to_string(objects) + " objects, " +
+                std::to_string(matching) + " matching",
+              before,
+              after);
+    g_variant_unref(reply);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// rediscovery: rebuilding a device's GattDatabase in place against the
+// shared_ptr per characteristic that discovery used to allocate afresh
+
+namespace legacy
+{
+struct Characteristic
+{
+  std::string              object_path;
+  std::string              service_path;
+  std::string              uuid;
+  std::vector<std::string> flags;
+  uint16_t                 mtu = 0;
+};
+
+using CharacteristicMap =
+  std::map<std::string, std::shared_ptr<Characteristic>>;
+
+void add_characteristic(CharacteristicMap& characteristics,
+                        const char*        object_path,
+                        GVariant*          interfaces)
+{
+  GVariant* properties = g_variant_lookup_value(
+    interfaces, BlueZ::GATT_CHARACTERISTIC_INTERFACE, G_VARIANT_TYPE_VARDICT);
+  if (!properties)
+    return;
+
+  auto         characteristic = std::make_shared<Characteristic>();
+  const gchar* value;
+  characteristic->object_path = object_path;
+  if (g_variant_lookup(properties, "UUID", "&s", &value))
+  {
+    characteristic->uuid = value;
+  }
+  if (g_variant_lookup(properties, "Service", "&o", &value))
+  {
+    characteristic->service_path = value;
+  }
+  g_variant_lookup(properties, "MTU", "q", &characteristic->mtu);
+
+  GVariantIter* flags;
+  if (g_variant_lookup(properties, "Flags", "as", &flags))
+  {
+    while (g_variant_iter_next(flags, "&s", &value))
+    {
+      characteristic->flags.push_back(value);
+    }
+    g_variant_iter_free(flags);
+  }
+  characteristics[object_path] = std::move(characteristic);
+  g_variant_unref(properties);
+}
+}  // namespace legacy
+
+void bench_rediscovery()
+{
+  print_header("rediscovery: one device's GATT tree, rebuilt per refresh");
+
+  const TreeShape shape  = {1, 6, 5, 1};
+  GVariant*       reply  = managed_objects(shape);
+  std::string     prefix = device_path(0) + "/";
+  size_t          runs   = 20000;
+
+  // As discovery used to: a fresh map of characteristics per refresh
+  legacy::CharacteristicMap characteristics;
+  auto                      discover = [&]
+  {
+    characteristics.clear();
+    ManagedObjects::for_each_object(
+      reply,
+      prefix.c_str(),
+      [&](const char* object_path, GVariant* interfaces) {
+        legacy::add_characteristic(characteristics, object_path, interfaces);
+      });
+  };
+  Cost before = measure(runs, discover);
+
+  GattDatabase database;
+  Cost         after = measure(runs,
+                       [&]
+                       {
+                         database.begin_update();
+                         ManagedObjects::for_each_object(
+                           reply,
+                           prefix.c_str(),
+                           [&](const char* object_path, GVariant* interfaces)
+                           { database.add_object(object_path, interfaces); });
+                         database.end_update();
+                       });
+  print_row(std::to_string(database.characteristics().size()) +
+              " characteristics, unchanged",
+            before,
+            after);
+
+  // The first discovery, which interns every string and unpacks every object
+  after = measure(runs,
+                  [&]
+                  {
+                    GattDatabase first;
+                    first.begin_update();
+                    ManagedObjects::for_each_object(
+                      reply,
+                      prefix.c_str(),
+                      [&](const char* object_path, GVariant* interfaces)
+                      { first.add_object(object_path, interfaces); });
+                    first.end_update();
+                  });
+  print_row(std::to_string(database.characteristics().size()) +
+              " characteristics, first",
+            before,
+            after);
+
+  // Lookups of the last characteristic, as get_characteristic() and
+  // get_characteristic_by_path() make them
+  discover();
+  const auto& last = database.characteristics().back();
+  std::string uuid(database.string(last.uuid));
+  std::string path(database.string(last.path));
+
+  runs   = 1000000;
+  before = measure(runs,
+                   [&]
+                   {
+                     for (const auto& pair : characteristics)
+                     {
+                       if (g_ascii_strcasecmp(pair.second->uuid.c_str(),
+                                              uuid.c_str()) == 0)
+                       {
+                         keep(pair.second);
+                         break;
+                       }
+                     }
+                   });
+  after  = measure(runs,
+                  [&] { keep(database.find_characteristic("", uuid)); });
+  print_row("lookup by UUID", before, after);
+
+  before = measure(runs, [&] { keep(characteristics.find(path)); });
+  after  = measure(runs, [&] { keep(database.find_characteristic(path)); });
+  print_row("lookup by path", before, after);
+
+  g_variant_unref(reply);
+}
+
+// ---------------------------------------------------------------------------
+// Mock bluetoothd: a child process owning org.bluez on a private bus, so the
+// library runs unmodified and only its own allocations are counted
+
+constexpr TreeShape   MOCK_SHAPE     = {16, 1, 2, 0};
+constexpr const char* MOCK_INTERFACE = "org.bscm.BenchMock";
+constexpr const char* MOCK_ARGUMENT  = "--mock-bluez";
+
+// Just what the library calls, plus the control interface the sections use
+// to make the mock emit signals
+constexpr const char* MOCK_INTROSPECTION =
+  "<node>"
+  "<interface name='org.freedesktop.DBus.ObjectManager'>"
+  "<method name='GetManagedObjects'>"
+  "<arg type='a{oa{sa{sv}}}' direction='out'/>"
+  "</method>"
+  "</interface>"
+  "<interface name='org.bluez.Adapter1'>"
+  "<method name='StartDiscovery'/>"
+  "<method name='StopDiscovery'/>"
+  "<method name='SetDiscoveryFilter'>"
+  "<arg type='a{sv}' direction='in'/>"
+  "</method>"
+  "</interface>"
+  "<interface name='org.bluez.GattCharacteristic1'>"
+  "<method name='ReadValue'>"
+  "<arg type='a{sv}' direction='in'/>"
+  "<arg type='ay' direction='out'/>"
+  "</method>"
+  "<method name='WriteValue'>"
+  "<arg type='ay' direction='in'/>"
+  "<arg type='a{sv}' direction='in'/>"
+  "</method>"
+  "<method name='StartNotify'/>"
+  "<method name='StopNotify'/>"
+  "</interface>"
+  "<interface name='org.bscm.BenchMock'>"
+  "<method name='EmitAdvertisements'>"
+  "<arg type='u' direction='in'/>"
+  "</method>"
+  "<method name='EmitNotifications'>"
+  "<arg type='u' direction='in'/>"
+  "<arg type='u' direction='in'/>"
+  "</method>"
+  "</interface>"
+  "</node>";
+
+struct MockState
+{
+  GDBusConnection*         connection;
+  GVariant*                objects;  // the GetManagedObjects reply
+  std::vector<std::string> devices;
+  std::vector<std::string> characteristics;
+};
+
+void emit_properties_changed(MockState&         mock,
+                             const std::string& path,
+                             const char*        interface,
+                             GVariant*          changed)
+{
+  g_dbus_connection_emit_signal(
+    mock.connection,
+    nullptr,
+    path.c_str(),
+    BlueZ::PROPERTIES_INTERFACE,
+    "PropertiesChanged",
+    g_variant_new("(s@a{sv}as)", interface, changed, nullptr),
+    nullptr);
+}
+
+// Device1 updates as discovery with DuplicateData reports them, round robin
+// over the devices
+void emit_advertisements(MockState& mock, guint32 count)
+{
+  for (guint32 i = 0; i < count; ++i)
+  {
+    uint8_t payload[8] = {static_cast<uint8_t>(i),
+                          static_cast<uint8_t>(i >> 8),
+                          static_cast<uint8_t>(i >> 16),
+                          0x01,
+                          0x02,
+                          0x03,
+                          0x04,
+                          0x05};
+
+    GVariantBuilder manufacturer;
+    g_variant_builder_init(&manufacturer, G_VARIANT_TYPE("a{qv}"));
+    g_variant_builder_add(
+      &manufacturer,
+      "{qv}",
+      0x0059,
+      g_variant_new_fixed_array(
+        G_VARIANT_TYPE_BYTE, payload, sizeof(payload), sizeof(uint8_t)));
+
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+    gint16 rssi = static_cast<gint16>(-40 - i % 40);
+    g_variant_builder_add(
+      &changed, "{sv}", "RSSI", g_variant_new_int16(rssi));
+    g_variant_builder_add(&changed,
+                          "{sv}",
+                          "ManufacturerData",
+                          g_variant_builder_end(&manufacturer));
+    emit_properties_changed(mock,
+                            mock.devices[i % mock.devices.size()],
+                            BlueZ::DEVICE_INTERFACE,
+                            g_variant_builder_end(&changed));
+  }
+}
+
+// `rounds` Value updates of `size` bytes on every characteristic
+void emit_notifications(MockState& mock, guint32 rounds, guint32 size)
+{
+  std::vector<uint8_t> value(size);
+  for (guint32 round = 0; round < rounds; ++round)
+  {
+    value[0] = static_cast<uint8_t>(round);
+    for (const auto& path : mock.characteristics)
+    {
+      GVariantBuilder changed;
+      g_variant_builder_init(&changed, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add(&changed,
+                            "{sv}",
+                            "Value",
+                            g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                                      value.data(),
+                                                      value.size(),
+                                                      sizeof(uint8_t)));
+      emit_properties_changed(mock,
+                              path,
+                              BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+                              g_variant_builder_end(&changed));
+    }
+  }
+}
+
+void on_mock_method_call(GDBusConnection*       connection,
+                         const gchar*           sender,
+                         const gchar*           object_path,
+                         const gchar*           interface_name,
+                         const gchar*           method_name,
+                         GVariant*              parameters,
+                         GDBusMethodInvocation* invocation,
+                         gpointer               user_data)
+{
+  (void)connection;
+  (void)sender;
+  (void)object_path;
+  (void)interface_name;
+
+  MockState& mock = *static_cast<MockState*>(user_data);
+  if (std::strcmp(method_name, "GetManagedObjects") == 0)
+  {
+    g_dbus_method_invocation_return_value(invocation, mock.objects);
+  }
+  else if (std::strcmp(method_name, "ReadValue") == 0)
+  {
+    static const uint8_t value[20] = {};
+    g_dbus_method_invocation_return_value(
+      invocation,
+      g_variant_new("(@ay)",
+                    g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                              value,
+                                              sizeof(value),
+                                              sizeof(uint8_t))));
+  }
+  else if (std::strcmp(method_name, "EmitAdvertisements") == 0)
+  {
+    guint32 count;
+    g_variant_get(parameters, "(u)", &count);
+    emit_advertisements(mock, count);
+    g_dbus_method_invocation_return_value(invocation, nullptr);
+  }
+  else if (std::strcmp(method_name, "EmitNotifications") == 0)
+  {
+    guint32 rounds;
+    guint32 size;
+    g_variant_get(parameters, "(uu)", &rounds, &size);
+    emit_notifications(mock, rounds, std::max<guint32>(size, 1));
+    g_dbus_method_invocation_return_value(invocation, nullptr);
+  }
+  else
+  {
+    // Discovery, writes and notification control just succeed
+    g_dbus_method_invocation_return_value(invocation, nullptr);
+  }
+}
+
+bool register_mock_object(MockState&          mock,
+                          GDBusNodeInfo*      node,
+                          const std::string&  path,
+                          const char*         interface)
+{
+  static const GDBusInterfaceVTable vtable = {
+    on_mock_method_call, nullptr, nullptr, {}};
+
+  GError* error = nullptr;
+  if (!g_dbus_connection_register_object(
+        mock.connection,
+        path.c_str(),
+        g_dbus_node_info_lookup_interface(node, interface),
+        &vtable,
+        &mock,
+        nullptr,
+        &error))
+  {
+    std::fprintf(stderr, "mock: %s\n", error->message);
+    g_error_free(error);
+    return false;
+  }
+  return true;
+}
+
+// Entry point of the child: serves MOCK_SHAPE until killed, after writing
+// one line to stdout once org.bluez is owned
+int run_mock_bluez()
+{
+  GError*   error = nullptr;
+  MockState mock;
+  mock.connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &error);
+  if (!mock.connection)
+  {
+    std::fprintf(stderr, "mock: %s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  mock.objects = managed_objects(MOCK_SHAPE);
+  ManagedObjects::for_each_object(
+    mock.objects,
+    "/",
+    [&](const char* object_path, GVariant* interfaces)
+    {
+      GVariant* properties =
+        g_variant_lookup_value(interfaces,
+                               BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+                               G_VARIANT_TYPE_VARDICT);
+      if (properties)
+      {
+        mock.characteristics.push_back(object_path);
+        g_variant_unref(properties);
+      }
+    });
+  for (size_t device = 0; device < MOCK_SHAPE.devices; ++device)
+  {
+    mock.devices.push_back(device_path(device));
+  }
+
+  GDBusNodeInfo* node =
+    g_dbus_node_info_new_for_xml(MOCK_INTROSPECTION, nullptr);
+  bool registered =
+    register_mock_object(mock, node, "/", BlueZ::OBJECT_MANAGER_INTERFACE) &&
+    register_mock_object(mock, node, "/", MOCK_INTERFACE) &&
+    register_mock_object(
+      mock, node, "/org/bluez/hci0", BlueZ::ADAPTER_INTERFACE);
+  for (const auto& path : mock.characteristics)
+  {
+    registered =
+      registered && register_mock_object(
+                      mock, node, path, BlueZ::GATT_CHARACTERISTIC_INTERFACE);
+  }
+
+  // DBUS_NAME_FLAG_DO_NOT_QUEUE; 1 is DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER
+  guint32   owner  = 0;
+  GVariant* result = nullptr;
+  if (registered)
+  {
+    result = g_dbus_connection_call_sync(
+      mock.connection,
+      "org.freedesktop.DBus",
+      "/org/freedesktop/DBus",
+      "org.freedesktop.DBus",
+      "RequestName",
+      g_variant_new("(su)", BlueZ::SERVICE_NAME, 4u),
+      G_VARIANT_TYPE("(u)"),
+      G_DBUS_CALL_FLAGS_NONE,
+      -1,
+      nullptr,
+      &error);
+  }
+  if (result)
+  {
+    g_variant_get(result, "(u)", &owner);
+    g_variant_unref(result);
+  }
+  else if (error)
+  {
+    std::fprintf(stderr, "mock: %s\n", error->message);
+    g_error_free(error);
+  }
+  if (owner != 1)
+    return 1;
+
+  std::printf("ready\n");
+  std::fflush(stdout);
+
+  GMainLoop* loop = g_main_loop_new(nullptr, FALSE);
+  g_main_loop_run(loop);
+  return 0;
+}
+
+// The parent's side: a private bus (GTestDBus, which needs dbus-daemon on
+// PATH) and the mock serving on it
+class MockBluez
+{
+public:
+  // Started on first use and kept for the whole run; nullptr if the bus or
+  // the mock failed to start
+  static MockBluez* instance()
+  {
+    static std::unique_ptr<MockBluez> mock = start();
+    return mock.get();
+  }
+
+  ~MockBluez()
+  {
+    if (pid_ > 0)
+    {
+      kill(pid_, SIGTERM);
+      waitpid(pid_, nullptr, 0);
+    }
+    if (control_)
+    {
+      g_object_unref(control_);
+    }
+    g_test_dbus_down(bus_);
+    g_object_unref(bus_);
+  }
+
+  // Calls one of the mock's control methods and waits for it to return
+  bool call(const char* method_name, GVariant* parameters)
+  {
+    GError*   error  = nullptr;
+    GVariant* result = g_dbus_connection_call_sync(control_,
+                                                   BlueZ::SERVICE_NAME,
+                                                   "/",
+                                                   MOCK_INTERFACE,
+                                                   method_name,
+                                                   parameters,
+                                                   nullptr,
+                                                   G_DBUS_CALL_FLAGS_NONE,
+                                                   120000,
+                                                   nullptr,
+                                                   &error);
+    if (!result)
+    {
+      std::fprintf(stderr, "%s: %s\n", method_name, error->message);
+      g_error_free(error);
+      return false;
+    }
+    g_variant_unref(result);
+    return true;
+  }
+
+private:
+  GTestDBus*       bus_     = nullptr;
+  GDBusConnection* control_ = nullptr;
+  pid_t            pid_     = 0;
+
+  static std::unique_ptr<MockBluez> start()
+  {
+    gchar* daemon = g_find_program_in_path("dbus-daemon");
+    if (!daemon)
+    {
+      std::fprintf(stderr, "dbus-daemon not found, skipping mock bus\n");
+      return nullptr;
+    }
+    g_free(daemon);
+
+    std::unique_ptr<MockBluez> mock(new MockBluez());
+    mock->bus_ = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(mock->bus_);
+
+    // Both the library and the mock find the bus through the environment
+    const gchar* address = g_test_dbus_get_bus_address(mock->bus_);
+    setenv("DBUS_SYSTEM_BUS_ADDRESS", address, 1);
+
+    GError* error  = nullptr;
+    mock->control_ = g_dbus_connection_new_for_address_sync(
+      address,
+      static_cast<GDBusConnectionFlags>(
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+      nullptr,
+      nullptr,
+      &error);
+    if (!mock->control_)
+    {
+      std::fprintf(stderr, "mock bus: %s\n", error->message);
+      g_error_free(error);
+      return nullptr;
+    }
+
+    int ready[2];
+    if (pipe(ready) != 0)
+      return nullptr;
+    mock->pid_ = fork();
+    if (mock->pid_ == 0)
+    {
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      dup2(ready[1], STDOUT_FILENO);
+      close(ready[0]);
+      close(ready[1]);
+      execl("/proc/self/exe", "bscm-bench", MOCK_ARGUMENT, nullptr);
+      _exit(127);
+    }
+    close(ready[1]);
+    char line[8];
+    ssize_t length = mock->pid_ > 0 ? read(ready[0], line, sizeof(line)) : 0;
+    close(ready[0]);
+    if (length <= 0)
+    {
+      std::fprintf(stderr, "mock bluetoothd failed to start\n");
+      return nullptr;
+    }
+    return mock;
+  }
+};
+
+// A manager initialized against the mock
+std::unique_ptr<BluetoothManager> start_manager(size_t device_connections)
+{
+  auto manager = std::make_unique<BluetoothManager>();
+  manager->set_device_connection_count(device_connections);
+  if (!manager->initialize())
+  {
+    std::fprintf(stderr, "BluetoothManager failed to initialize\n");
+    return nullptr;
+  }
+  return manager;
+}
+
+void print_rate_header(const char* title)
+{
+  std::printf("\n%s\n  %-30s %11s %11s  %s\n",
+              title,
+              "case",
+              "per second",
+              "ns each",
+              "allocations each");
+}
+
+void print_rate(const std::string& name, Cost each)
+{
+  std::printf("  %-30s %11.0f %11.1f  %.1f\n",
+              name.c_str(),
+              1e9 / each.ns,
+              each.ns,
+              each.allocations);
+}
+
+// Cost per item of the stream `emit` starts, timed until `received` has
+// grown by `count`
+template <typename Emit>
+Cost measure_stream(const std::atomic<uint64_t>& received,
+                    uint64_t                     count,
+                    Emit&&                       emit)
+{
+  uint64_t target   = received.load() + count;
+  uint64_t first    = allocations.load();
+  auto     begin    = Clock::now();
+  auto     deadline = begin + std::chrono::seconds(60);
+  emit();
+  while (received.load() < target && Clock::now() < deadline)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - begin;
+  if (received.load() < target)
+  {
+    std::fprintf(stderr,
+                 "timed out with %llu of %llu received\n",
+                 static_cast<unsigned long long>(count + received.load() -
+                                                 target),
+                 static_cast<unsigned long long>(count));
+  }
+  return {elapsed.count() / count,
+          static_cast<double>(allocations.load() - first) / count};
+}
+
+// ---------------------------------------------------------------------------
+// writes: WriteValue round trips to the mock, zero-copy against the copied
+// payload and per-call options dict they replaced
+
+namespace legacy
+{
+bool write_value(GDBusConnection*    connection,
+                 const std::string&  object_path,
+                 const std::vector<uint8_t>& data)
+{
+  GError* error = nullptr;
+
+  GVariant* data_variant = g_variant_new_fixed_array(
+    G_VARIANT_TYPE_BYTE, data.data(), data.size(), sizeof(uint8_t));
+
+  GVariantBuilder builder;
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+  GVariant* options = g_variant_builder_end(&builder);
+
+  static const DBusCall::Method write_value_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "WriteValue"};
+  GVariant* result =
+    DBusCall::call_sync(connection,
+                        object_path.c_str(),
+                        write_value_call,
+                        g_variant_new("(@ay@a{sv})", data_variant, options),
+                        nullptr,
+                        10000,
+                        &error);
+  if (!result)
+  {
+    g_error_free(error);
+    return false;
+  }
+  g_variant_unref(result);
+  return true;
+}
+}  // namespace legacy
+
+void bench_writes()
+{
+  MockBluez* mock = MockBluez::instance();
+  if (!mock)
+    return;
+
+  auto manager = start_manager(0);
+  auto device  = manager ? manager->get_device(device_address(0)) : nullptr;
+  auto characteristics =
+    device ? device->get_characteristics()
+           : std::vector<std::shared_ptr<GattCharacteristic>>();
+  if (characteristics.empty())
+  {
+    std::fprintf(stderr, "writes: no characteristic on the mock\n");
+    return;
+  }
+  GattCharacteristic& characteristic = *characteristics.front();
+  const std::string&  path           = characteristic.get_object_path();
+
+  print_header("writes: WriteValue round trips through the mock bus");
+
+  const size_t runs = 2000;
+  for (size_t size : {20, 512})
+  {
+    std::vector<uint8_t> data(size, 0x5a);
+    GBytes*              bytes  = g_bytes_new(data.data(), data.size());
+    std::string          suffix = " " + std::to_string(size) + " B";
+
+    Cost before = measure(
+      runs,
+      [&]
+      { keep(legacy::write_value(manager->get_connection(), path, data)); });
+    Cost after =
+      measure(runs, [&] { keep(characteristic.write_value(data)); });
+    print_row("write_value(vector)" + suffix, before, after);
+
+    after = measure(runs,
+                    [&]
+                    { keep(characteristic.write_value(data.data(), size)); });
+    print_row("write_value(pointer)" + suffix, before, after);
+
+    after = measure(runs, [&] { keep(characteristic.write_value(bytes)); });
+    print_row("write_value(GBytes)" + suffix, before, after);
+    g_bytes_unref(bytes);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// advertisements: Device1 updates from the mock through the advertisement
+// stream, with discovery running with DuplicateData
+
+void bench_advertisements()
+{
+  MockBluez* mock = MockBluez::instance();
+  if (!mock)
+    return;
+
+  auto manager = start_manager(0);
+  if (!manager)
+    return;
+
+  std::atomic<uint64_t> received{0};
+  manager->set_advertisement_callback(
+    [&](const AdvertisementData& data)
+    {
+      keep(data);
+      received.fetch_add(1, std::memory_order_relaxed);
+    });
+  manager->start_discovery();
+
+  print_rate_header("advertisements: sustained stream from the mock bus");
+
+  // The first update of each device creates its stream entry
+  measure_stream(received,
+                 MOCK_SHAPE.devices,
+                 [&]
+                 {
+                   mock->call("EmitAdvertisements",
+                              g_variant_new("(u)", MOCK_SHAPE.devices));
+                 });
+
+  const uint32_t count = 20000;
+  Cost           each  = measure_stream(
+    received,
+    count,
+    [&] { mock->call("EmitAdvertisements", g_variant_new("(u)", count)); });
+  print_rate(std::to_string(MOCK_SHAPE.devices) + " devices, RSSI + manuf.",
+             each);
+
+  manager->stop_discovery();
+}
+
+// ---------------------------------------------------------------------------
+// notifications: Value updates on every characteristic of the mock, with the
+// devices on the manager's connection or spread over dedicated ones
+
+void bench_notifications()
+{
+  MockBluez* mock = MockBluez::instance();
+  if (!mock)
+    return;
+
+  print_rate_header("notifications: throughput by device connections");
+
+  const uint32_t rounds = 500;
+  for (size_t connections : {0, 1, 2, 4})
+  {
+    auto manager = start_manager(connections);
+    if (!manager)
+      return;
+
+    std::atomic<uint64_t> received{0};
+    size_t                subscribed = 0;
+    for (const auto& device : manager->get_discovered_devices())
+    {
+      for (const auto& characteristic : device->get_characteristics())
+      {
+        if (characteristic->start_notifications(
+              [&](const std::string&, const std::vector<uint8_t>& data)
+              {
+                keep(data);
+                received.fetch_add(1, std::memory_order_relaxed);
+              }))
+        {
+          ++subscribed;
+        }
+      }
+    }
+    if (subscribed == 0)
+    {
+      std::fprintf(stderr, "notifications: nothing to subscribe to\n");
+      return;
+    }
+
+    measure_stream(received,
+                   subscribed,
+                   [&]
+                   {
+                     mock->call("EmitNotifications",
+                                g_variant_new("(uu)", 1u, 20u));
+                   });
+    Cost each = measure_stream(received,
+                               rounds * subscribed,
+                               [&]
+                               {
+                                 mock->call("EmitNotifications",
+                                            g_variant_new("(uu)", rounds, 20u));
+                               });
+    print_rate(connections ? std::to_string(connections) + " dedicated"
+                           : std::string("shared connection"),
+               each);
+  }
+}
+
+struct Section
+{
+  const char* name;
+  void (*run)();
+};
+
+constexpr Section SECTIONS[] = {
+  {"hex", bench_hex},
+  {"managed-objects", bench_managed_objects},
+  {"rediscovery", bench_rediscovery},
+  {"writes", bench_writes},
+  {"advertisements", bench_advertisements},
+  {"notifications", bench_notifications},
+};
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc == 2 && std::strcmp(argv[1], MOCK_ARGUMENT) == 0)
+    return run_mock_bluez();
+
+  // GSlice keeps its own magazines unless told otherwise, which would hide
+  // GVariant allocations from the counter. GLib reads the setting as it is
+  // loaded, so that takes a fresh start.
+  if (!getenv("G_SLICE"))
+  {
+    setenv("G_SLICE", "always-malloc", 1);
+    execv("/proc/self/exe", argv);
+  }
+
+  std::vector<const Section*> selected;
+  for (int i = 1; i < argc; ++i)
+  {
+    auto it = std::find_if(std::begin(SECTIONS),
+                           std::end(SECTIONS),
+                           [&](const Section& section)
+                           { return std::strcmp(section.name, argv[i]) == 0; });
+    if (it == std::end(SECTIONS))
+    {
+      std::fprintf(stderr, "Usage: %s [section...]\nSections:", argv[0]);
+      for (const auto& section : SECTIONS)
+      {
+        std::fprintf(stderr, " %s", section.name);
+      }
+      std::fprintf(stderr, "\n");
+      return 1;
+    }
+    selected.push_back(&*it);
+  }
+  if (selected.empty())
+  {
+    for (const auto& section : SECTIONS)
+    {
+      selected.push_back(&section);
+    }
+  }
+
+  for (const Section* section : selected)
+  {
+    section->run();
+  }
+  return 0;
+}
\ No newline at end of file
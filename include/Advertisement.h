@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Common.h"
+
+// Latest advertising state reported by BlueZ for one device. All storage is
+// inline so updates can be parsed and delivered without heap allocation;
+// payloads longer than MAX_DATA_LENGTH are truncated and flagged.
+struct AdvertisementData
+{
+  static constexpr size_t MAX_MANUFACTURER_ENTRIES = 4;
+  static constexpr size_t MAX_SERVICE_ENTRIES      = 4;
+  static constexpr size_t MAX_DATA_LENGTH          = 64;
+  static constexpr size_t UUID_LENGTH              = 36;
+  static constexpr size_t ADDRESS_LENGTH           = 17;
+
+  // Bits set in `changed` for the fields carried by the latest update
+  static constexpr uint8_t CHANGED_RSSI              = 1 << 0;
+  static constexpr uint8_t CHANGED_TX_POWER          = 1 << 1;
+  static constexpr uint8_t CHANGED_MANUFACTURER_DATA = 1 << 2;
+  static constexpr uint8_t CHANGED_SERVICE_DATA      = 1 << 3;
+
+  struct ManufacturerEntry
+  {
+    uint16_t company_id;
+    uint8_t  length;
+    uint8_t  data[MAX_DATA_LENGTH];
+  };
+
+  struct ServiceEntry
+  {
+    char    uuid[UUID_LENGTH + 1];
+    uint8_t length;
+    uint8_t data[MAX_DATA_LENGTH];
+  };
+
+  char                                  address[ADDRESS_LENGTH + 1] = {};
+  int16_t                               rssi                        = 0;
+  int16_t                               tx_power                    = 0;
+  bool                                  has_rssi                    = false;
+  bool                                  has_tx_power                = false;
+  bool                                  truncated                   = false;
+  uint8_t                               changed                     = 0;
+  uint8_t                               manufacturer_count          = 0;
+  uint8_t                               service_count               = 0;
+  ManufacturerEntry                     manufacturer[MAX_MANUFACTURER_ENTRIES];
+  ServiceEntry                          service[MAX_SERVICE_ENTRIES];
+  std::chrono::steady_clock::time_point timestamp;
+
+  const ManufacturerEntry* find_manufacturer(uint16_t company_id) const;
+  const ServiceEntry*      find_service(const char* uuid) const;
+};
+
+using AdvertisementCallback = std::function<void(const AdvertisementData&)>;
+
+namespace Advertisement
+{
+// Derive "AA:BB:CC:DD:EE:FF" from a /org/bluez/hciX/dev_AA_BB_CC_DD_EE_FF path
+bool address_from_object_path(const char* object_path,
+                              char (&address)[AdvertisementData::ADDRESS_LENGTH +
+                                              1]);
+
+// Merge RSSI, TxPower, ManufacturerData and ServiceData from a Device1
+// property dict (a{sv}) into `data`. Returns true if any of them was present.
+bool parse_properties(GVariant* properties, AdvertisementData& data);
+}  // namespace Advertisement
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <set>
+#include "Common.h"
+#include "Metrics.h"
+
+// One AD structure to match: `content` must appear at `start_position` in
+// the data of an AD structure of type `ad_type` (e.g. 0xFF for manufacturer
+// specific data)
+struct MonitorPattern
+{
+  uint8_t              start_position = 0;
+  uint8_t              ad_type        = 0;
+  std::vector<uint8_t> content;
+};
+
+// An "or_patterns" monitor: a device is found when any pattern matches and
+// its RSSI stays above the high threshold for the high timeout, and lost
+// once it stays below the low threshold for the low timeout. Fields left at
+// their unset values are not sent, so BlueZ applies its defaults.
+struct MonitorConfig
+{
+  static constexpr int16_t  RSSI_UNSET            = 127;
+  static constexpr uint16_t SAMPLING_PERIOD_UNSET = 0x100;
+
+  // Thresholds in dBm, timeouts in seconds, sampling period in 100 ms units
+  // (0: report every advertisement, 0xFF: only the first)
+  std::vector<MonitorPattern> patterns;
+  int16_t                     rssi_high_threshold  = RSSI_UNSET;
+  uint16_t                    rssi_high_timeout    = 0;
+  int16_t                     rssi_low_threshold   = RSSI_UNSET;
+  uint16_t                    rssi_low_timeout     = 0;
+  uint16_t                    rssi_sampling_period = SAMPLING_PERIOD_UNSET;
+};
+
+using MonitorCallback = std::function<void(const std::string& address,
+                                           const std::string& device_path)>;
+
+// Client side of org.bluez.AdvertisementMonitorManager1. Monitors are
+// exported as AdvertisementMonitor1 objects under an ObjectManager root and
+// registered with adapters; matching is then done by the controller where
+// supported, without host-side discovery.
+class AdvertisementMonitor
+{
+private:
+  struct Monitor
+  {
+    uint32_t        id;
+    std::string     path;
+    MonitorConfig   config;
+    MonitorCallback on_found;
+    MonitorCallback on_lost;
+    guint           registration;
+  };
+
+  GDBusConnection*                                connection_;
+  GMainContext*                                   context_;
+  std::string                                     root_path_;
+  guint                                           root_registration_;
+  std::mutex                                      mutex_;
+  std::map<std::string, std::shared_ptr<Monitor>> monitors_;  // by path
+  std::set<std::string>                           adapters_;  // registered
+  uint32_t                                        next_id_;
+  Metrics::Counter*                               devices_found_;
+  Metrics::Counter*                               devices_lost_;
+  // Expires on the context's thread when the monitor is destroyed; replies
+  // check it before touching the object
+  std::shared_ptr<void>                           lifetime_;
+
+  // Exported object handlers
+  static const GDBusInterfaceVTable vtable_;
+  static void      on_method_call(GDBusConnection*       connection,
+                                  const gchar*           sender,
+                                  const gchar*           object_path,
+                                  const gchar*           interface_name,
+                                  const gchar*           method_name,
+                                  GVariant*              parameters,
+                                  GDBusMethodInvocation* invocation,
+                                  gpointer               user_data);
+  static GVariant* on_get_property(GDBusConnection* connection,
+                                   const gchar*     sender,
+                                   const gchar*     object_path,
+                                   const gchar*     interface_name,
+                                   const gchar*     property_name,
+                                   GError**         error,
+                                   gpointer         user_data);
+
+  void      handle_device_event(const std::string& object_path,
+                                bool               found,
+                                GVariant*          parameters);
+  GVariant* get_managed_objects();
+  GVariant* monitor_properties(const MonitorConfig& config);
+  bool      export_root();
+  void      emit_object_manager_signal(const char* signal_name,
+                                       GVariant*   parameters);
+
+public:
+  // Objects are served on `context`, or on the thread-default context of the
+  // constructing thread when it is null. add_monitor() and
+  // register_with_adapter() export objects, so they must run on a thread
+  // that can acquire that context.
+  AdvertisementMonitor(GDBusConnection*   connection,
+                       const std::string& root_path,
+                       GMainContext*      context = nullptr);
+  // Unexports the objects on the context's thread and waits for it, so it
+  // must not run holding a lock that thread may need
+  ~AdvertisementMonitor();
+
+  // Export a monitor; adapters this application is registered with pick it
+  // up through InterfacesAdded. Returns its id, or 0 on failure.
+  uint32_t add_monitor(const MonitorConfig& config,
+                       MonitorCallback      on_found,
+                       MonitorCallback      on_lost);
+  bool     remove_monitor(uint32_t id);
+  size_t   get_monitor_count();
+
+  // Asynchronous, since bluetoothd reads the monitors back from us before it
+  // replies to RegisterMonitor; failures are logged, and the adapter can
+  // then be registered with again
+  void register_with_adapter(const std::string& adapter_path);
+  void unregister_from_adapter(const std::string& adapter_path);
+};
\ No newline at end of file
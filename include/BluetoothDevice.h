@@ -2,18 +2,59 @@
 
 #include "Common.h"
 #include "GattCharacteristic.h"
+#include "GattDatabase.h"
+#include "OperationScheduler.h"
+
+using ConnectCallback = std::function<void(bool connected)>;
+
+// One characteristic's result in a read_all() snapshot
+struct CharacteristicReading
+{
+  std::string               uuid;
+  std::string               path;
+  bool                      success = false;
+  std::vector<uint8_t>      value;
+  std::string               error;
+  std::chrono::microseconds latency{0};  // issue to reply, queueing included
+};
+
+// Every readable characteristic of a device, read in one pipelined pass
+struct DeviceSnapshot
+{
+  std::vector<CharacteristicReading> readings;  // in object path order
+  std::chrono::microseconds          wall_time{0};
+  size_t                             succeeded = 0;
+};
+
+using SnapshotCallback = std::function<void(const DeviceSnapshot& snapshot)>;
 
 class BluetoothDevice
 {
 private:
-  GDBusConnection*                                           connection_;
-  std::string                                                object_path_;
-  std::string                                                address_;
-  std::string                                                name_;
-  bool                                                       connected_;
-  bool                                                       services_resolved_;
-  std::vector<std::string>                                   service_uuids_;
-  std::map<std::string, std::shared_ptr<GattCharacteristic>> characteristics_;
+  // A characteristic handed out for a database record, kept across
+  // rediscoveries for as long as the record exists
+  struct Handle
+  {
+    GattDatabase::StringId              path;
+    std::shared_ptr<GattCharacteristic> characteristic;
+  };
+
+  GDBusConnection*         connection_;
+  GMainContext*            context_;
+  std::string              object_path_;
+  std::string              address_;
+  std::string              name_;
+  bool                     connected_;
+  bool                     services_resolved_;
+  std::vector<std::string> service_uuids_;
+  std::mutex               gatt_mutex_;  // guards gatt_ and handles_
+  GattDatabase             gatt_;
+  std::vector<Handle>      handles_;  // by path id, created on first use
+  std::map<std::string, std::chrono::milliseconds> read_cache_ttls_;  // by UUID
+  std::shared_ptr<OperationScheduler>              scheduler_;
+  // Shared with the characteristics; cancelled on disconnect and destruction
+  std::shared_ptr<DBusCall::CancelGroup> cancel_group_;
+  RetryPolicy                            retry_policy_;
 
   // D-Bus callback for async operations
   static void on_device_connect_ready(GObject*      source_object,
@@ -25,15 +66,36 @@ private:
 
   // Helper methods
   void      update_properties();
+  void      load_properties(GVariant* properties);
   void      discover_services_and_characteristics();
   GVariant* get_property(const std::string& interface,
                          const std::string& property);
+  GVariant* get_all_properties(const std::string& interface);
   bool      set_property(const std::string& interface,
                          const std::string& property,
                          GVariant*          value);
+  std::shared_ptr<GattCharacteristic> characteristic_locked(
+    GattDatabase::Index index);
+  // After gatt_ changed: drops handles whose record is gone or now describes
+  // another characteristic, patches the rest
+  void update_handles_locked();
 
 public:
-  BluetoothDevice(GDBusConnection* connection, const std::string& object_path);
+  static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{10000};
+  static constexpr std::chrono::milliseconds CONNECT_TIMEOUT{30000};
+
+  // Signals and async replies for this device and its characteristics are
+  // dispatched on `context` (the constructing thread's default if null)
+  BluetoothDevice(GDBusConnection*   connection,
+                  const std::string& object_path,
+                  GMainContext*      context = nullptr);
+  // Builds from an already known a{sv} of Device1 properties
+  // (GetManagedObjects, InterfacesAdded, or only those a PropertiesChanged
+  // carried) without any D-Bus round trip
+  BluetoothDevice(GDBusConnection*   connection,
+                  const std::string& object_path,
+                  GVariant*          properties,
+                  GMainContext*      context = nullptr);
   ~BluetoothDevice();
 
   // Basic properties
@@ -47,33 +109,86 @@ public:
     return service_uuids_;
   }
 
-  // Connection management
-  bool connect();
-  bool disconnect();
-  bool pair();
+  // Connection management. Calls give up after `timeout`; everything still
+  // in flight is cancelled when the device disconnects or is destroyed.
+  // connect() retries transient failures as the retry policy says; `error`
+  // receives the outcome if given.
+  bool connect(std::chrono::milliseconds timeout = CONNECT_TIMEOUT,
+               BluezError*               error   = nullptr);
+  // Issues Device1.Connect without waiting, retrying as the retry policy
+  // says; the callback runs on the device's context once the last attempt
+  // is answered. The device must outlive the call.
+  void connect_async(ConnectCallback           callback,
+                     std::chrono::milliseconds timeout = CONNECT_TIMEOUT);
+  bool disconnect(std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+  bool pair(std::chrono::milliseconds timeout = CONNECT_TIMEOUT);
   bool unpair();
 
-  // Service and characteristic discovery
+  // Service and characteristic discovery. Rediscovery rebuilds the GATT
+  // database in place; characteristics handed out before keep working, and
+  // are updated, as long as the device still has them.
   bool                                             refresh_services();
   std::vector<std::shared_ptr<GattCharacteristic>> get_characteristics();
-  std::shared_ptr<GattCharacteristic>              get_characteristic(
-                 const std::string& service_uuid,
-                 const std::string& char_uuid);
+  // Characteristic `char_uuid` of service `service_uuid`, or of any service
+  // if that one has none
+  std::shared_ptr<GattCharacteristic> get_characteristic(
+    const std::string& service_uuid,
+    const std::string& char_uuid);
   std::shared_ptr<GattCharacteristic> get_characteristic_by_path(
     const std::string& char_path);
+  // Adds characteristics from known GattCharacteristic1 properties, given
+  // as (object path, a{sv}) pairs
+  void add_characteristics(
+    const std::vector<std::pair<std::string, GVariant*>>& characteristics);
 
-  // GATT operations
-  bool read_characteristic(const std::string&    service_uuid,
-                           const std::string&    char_uuid,
-                           std::vector<uint8_t>& data);
-  bool write_characteristic(const std::string&          service_uuid,
-                            const std::string&          char_uuid,
-                            const std::vector<uint8_t>& data);
-  bool subscribe_to_notifications(const std::string&   service_uuid,
-                                  const std::string&   char_uuid,
-                                  NotificationCallback callback);
+  // GATT operations, queued by priority behind the device's scheduler. On
+  // the device's context thread (e.g. from a notification callback) they
+  // never wait for a slot: with every slot busy they fail with InProgress.
+  bool read_characteristic(
+    const std::string&        service_uuid,
+    const std::string&        char_uuid,
+    std::vector<uint8_t>&     data,
+    OperationPriority         priority = OperationPriority::Interactive,
+    std::chrono::milliseconds timeout  = GattCharacteristic::DEFAULT_TIMEOUT,
+    BluezError*               error    = nullptr);
+  bool write_characteristic(
+    const std::string&          service_uuid,
+    const std::string&          char_uuid,
+    const std::vector<uint8_t>& data,
+    OperationPriority           priority = OperationPriority::Interactive,
+    std::chrono::milliseconds   timeout = GattCharacteristic::DEFAULT_TIMEOUT,
+    BluezError*                 error   = nullptr);
+  // Read cache TTL for every characteristic with this UUID, kept across
+  // service refreshes; 0 turns caching off again
+  void set_read_cache_ttl(const std::string&        char_uuid,
+                          std::chrono::milliseconds ttl);
+  // Retry policy of connect() and of every characteristic, current and
+  // discovered later
+  void               set_retry_policy(const RetryPolicy& policy);
+  const RetryPolicy& get_retry_policy() const { return retry_policy_; }
+  // Issue ReadValue for every readable characteristic at once instead of one
+  // round trip after another; bluetoothd queues them on the ATT bearer. The
+  // reads run in the background class, as many at a time as the scheduler
+  // allows. The callback runs on the device's context once every read has
+  // completed.
+  void read_all_async(SnapshotCallback callback);
+  // Blocking wrapper around read_all_async()
+  DeviceSnapshot read_all();
+  // Returns the subscription id (0 on failure); other subscribers of the
+  // same characteristic keep receiving notifications
+  uint32_t subscribe_to_notifications(const std::string&   service_uuid,
+                                      const std::string&   char_uuid,
+                                      NotificationCallback callback,
+                                      BluezError*          error = nullptr);
+  // A subscription_id of 0 drops every subscriber of the characteristic
   bool unsubscribe_from_notifications(const std::string& service_uuid,
-                                      const std::string& char_uuid);
+                                      const std::string& char_uuid,
+                                      uint32_t           subscription_id = 0);
+
+  std::shared_ptr<OperationScheduler> get_scheduler() const
+  {
+    return scheduler_;
+  }
 
   // Utility
   void print_device_info();
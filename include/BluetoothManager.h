@@ -1,17 +1,225 @@
 #pragma once
 
+#include <atomic>
+#include <future>
+#include <set>
+#include "Advertisement.h"
+#include "AdvertisementMonitor.h"
 #include "BluetoothDevice.h"
 #include "Common.h"
 
+// Per-controller state and counters
+struct AdapterStats
+{
+  std::string path;
+  bool        powered;
+  bool        discovering;
+  uint32_t    active_links;
+  uint32_t    pending_connects;
+  uint64_t    devices_seen;
+  uint64_t    connects_succeeded;
+  uint64_t    connects_failed;
+
+  uint32_t load() const { return active_links + pending_connects; }
+};
+
+// Time spent in each phase of initialize()
+struct StartupTimings
+{
+  std::chrono::microseconds bus_connect{0};
+  std::chrono::microseconds load_objects{0};
+  std::chrono::microseconds power_on{0};  // waiting for Powered=true
+  std::chrono::microseconds total{0};
+  size_t                    adapters_powered_on = 0;
+};
+
+using InitializeCallback = std::function<void(bool success)>;
+
+// Discovery duty cycle. With a window shorter than the interval, discovery
+// runs for `window` out of every `interval`; otherwise it is continuous.
+struct ScanSchedule
+{
+  std::chrono::milliseconds window{0};
+  std::chrono::milliseconds interval{0};
+  bool                      pause_while_connecting = true;
+  uint32_t                  max_notification_rate  = 0;  // per second, 0: off
+};
+
+// Notification throughput with the radio scanning and with discovery paused
+struct ScanStats
+{
+  uint64_t                      windows_started   = 0;
+  uint64_t                      windows_cut_short = 0;
+  uint64_t                      suspensions       = 0;
+  std::chrono::duration<double> time_scanning{0};
+  std::chrono::duration<double> time_paused{0};
+  uint64_t                      notifications_scanning = 0;
+  uint64_t                      notifications_paused   = 0;
+
+  double rate_while_scanning() const
+  {
+    return time_scanning.count() > 0
+             ? notifications_scanning / time_scanning.count()
+             : 0.0;
+  }
+  double rate_while_paused() const
+  {
+    return time_paused.count() > 0 ? notifications_paused / time_paused.count()
+                                   : 0.0;
+  }
+};
+
+// Removal of BlueZ device objects nobody needs any more: not paired, bonded
+// or trusted, not connected, and not seen for `max_age`. Keeps bluetoothd's
+// object tree (and every GetManagedObjects reply) bounded over long uptimes.
+struct DeviceGcPolicy
+{
+  std::chrono::seconds max_age{0};  // 0: disabled
+  std::chrono::seconds interval{60};
+  uint32_t             max_removals_per_sweep = 32;
+};
+
+struct DeviceGcStats
+{
+  uint64_t sweeps  = 0;
+  uint64_t removed = 0;
+  uint64_t failed  = 0;
+  size_t   tracked = 0;  // Device1 objects currently known
+};
+
+// Allow-listed device connected automatically on advertisement
+struct AutoConnectStats
+{
+  std::string               address;
+  uint32_t                  attempts  = 0;
+  uint32_t                  connected = 0;
+  std::chrono::microseconds last_latency{0};  // advertisement to connected
+};
+
+using AutoConnectCallback =
+  std::function<void(std::shared_ptr<BluetoothDevice> device,
+                     std::chrono::microseconds        latency)>;
+
 class BluetoothManager
 {
 private:
-  GDBusConnection*                                        connection_;
-  std::string                                             adapter_path_;
-  bool                                                    is_scanning_;
-  std::mutex                                              scan_mutex_;
+  static constexpr guint       POWER_ON_TIMEOUT_MS   = 5000;
+  static constexpr guint       SCAN_RECHECK_MS       = 1000;
+  static constexpr guint       AUTO_CONNECT_RETRY_MS = 1000;
+  static constexpr const char* MONITOR_ROOT_PATH     = "/org/bscm/monitor";
+
+  // Deadline of every BlueZ call the manager makes
+  static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{10000};
+
+  // Startup sequence state, only touched on the manager's context
+  struct Startup
+  {
+    InitializeCallback                    callback;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point phase_begin;
+    StartupTimings                        timings;
+    std::set<std::string>                 powering;  // awaiting Powered=true
+    GSource*                              power_timeout       = nullptr;
+    size_t                                connections_pending = 0;
+    bool                                  objects_loaded      = false;
+    bool                                  running             = false;
+  };
+
+  GDBusConnection*   connection_;
+  GMainContext*      context_;
+  GMainLoop*         main_loop_;  // only set when the manager owns the context
+  std::thread        io_thread_;
+  std::vector<guint> signal_subscriptions_;
+  std::string        adapter_path_;  // default adapter, under adapters_mutex_
+  bool               is_scanning_;  // requested; the window may be closed
+  std::mutex         scan_mutex_;
+  std::mutex         devices_mutex_;
   std::map<std::string, std::shared_ptr<BluetoothDevice>> devices_;
-  std::vector<std::string>                                target_service_uuids_;
+  std::vector<std::string> target_service_uuids_;
+
+  // When a Device1 object was last seen and whether it must be kept
+  struct DeviceRecord
+  {
+    std::chrono::steady_clock::time_point last_seen;
+    bool                                  paired  = false;
+    bool                                  bonded  = false;
+    bool                                  trusted = false;
+  };
+
+  // Every controller, plus the device object paths each address has on them
+  // (BlueZ creates one Device1 per adapter that sees a device)
+  std::mutex                                      adapters_mutex_;
+  std::vector<AdapterStats>                       adapters_;
+  std::map<std::string, std::vector<std::string>> device_paths_;
+  std::set<std::string>                           connected_paths_;
+  std::map<std::string, DeviceRecord>             device_records_;  // by path
+  std::condition_variable                         adapters_cv_;
+
+  // Stale device collector, swept by a timer on the manager's context
+  std::mutex     gc_mutex_;
+  DeviceGcPolicy gc_policy_;
+  DeviceGcStats  gc_stats_;
+  GSource*       gc_timer_;
+
+  Startup        startup_;
+  std::mutex     startup_mutex_;
+  StartupTimings startup_timings_;
+
+  // Discovery duty cycle, guarded by scan_mutex_ and driven by a timer on
+  // the manager's context
+  ScanSchedule                          scan_schedule_;
+  ScanStats                             scan_stats_;
+  GSource*                              scan_timer_;
+  bool                                  scan_window_open_;
+  bool                                  scan_suspended_;
+  std::chrono::steady_clock::time_point scan_window_end_;
+  std::chrono::steady_clock::time_point scan_next_window_;
+  std::chrono::steady_clock::time_point scan_sample_time_;
+  uint64_t                              scan_sample_notifications_;
+  double                                notification_rate_;
+
+  // Advertisement stream state, keyed by device address
+  std::mutex                                            advertisement_mutex_;
+  std::map<std::string, AdvertisementData, std::less<>> advertisements_;
+  std::shared_ptr<const AdvertisementCallback>          advertisement_callback_;
+  std::atomic<uint64_t>                                 advertisement_count_;
+
+  // Auto-connect allow-list, keyed by device address
+  struct AutoConnectEntry
+  {
+    AutoConnectStats                      stats;
+    std::chrono::steady_clock::time_point last_attempt;
+    bool                                  in_flight = false;
+  };
+  std::mutex                                           auto_connect_mutex_;
+  std::map<std::string, AutoConnectEntry, std::less<>> auto_connect_;
+  AutoConnectCallback                                  auto_connect_callback_;
+
+  // Created with the first advertisement monitor
+  std::mutex                            monitor_mutex_;
+  std::unique_ptr<AdvertisementMonitor> advertisement_monitor_;
+
+  // Pending async calls, cancelled by cleanup(). Replies may still be
+  // dispatched on a caller-supplied context after the manager is gone, so
+  // handlers using `this` are wrapped by guarded(), which drops them once
+  // lifetime_ has expired or the call was cancelled.
+  DBusCall::CancelGroup  cancel_group_;
+  std::shared_ptr<void>  lifetime_;
+  DBusCall::ReplyHandler guarded(DBusCall::ReplyHandler handler);
+
+  // Dedicated bus connections devices are spread over, each with its own
+  // socket and bus daemon queue. Opened during startup and only read after
+  // that; empty when every device shares connection_. Each connection only
+  // matches the characteristic signals of the devices bound to it.
+  struct DeviceConnection
+  {
+    GDBusConnection*      connection;
+    guint                 properties_subscription;
+    std::set<std::string> device_paths;  // with a bus match rule
+  };
+  size_t                        device_connection_count_;
+  std::vector<DeviceConnection> device_connections_;
+  std::mutex                    device_paths_mutex_;
 
   // D-Bus signal handlers
   static void on_interfaces_added(GDBusConnection* connection,
@@ -38,6 +246,22 @@ private:
                                     GVariant*        parameters,
                                     gpointer         user_data);
 
+  // Startup sequence
+  static void     on_bus_ready(GObject*      source_object,
+                               GAsyncResult* result,
+                               gpointer      user_data);
+  static gboolean on_power_timeout(gpointer user_data);
+  static void     on_device_connection_ready(GObject*      source_object,
+                                             GAsyncResult* result,
+                                             gpointer      user_data);
+  void            open_device_connections();
+  void            load_objects_async();
+  void            subscribe_signals();
+  void            request_power_on();
+  void            check_startup_powered();
+  void            finish_startup(bool success);
+  std::chrono::microseconds end_startup_phase();
+
   // Helper methods
   void handle_interfaces_added(const std::string& object_path,
                                GVariant*          interfaces);
@@ -46,38 +270,158 @@ private:
   void handle_properties_changed(const std::string& object_path,
                                  const std::string& interface_name,
                                  GVariant*          changed_properties);
+  void handle_advertisement(const gchar* object_path, GVariant* properties);
+  void invalidate_cached_read(const std::string& char_path,
+                              GVariant*          changed_properties);
+  void add_device(const std::string& object_path, GVariant* properties);
+  // The connection for a device, adding its match rule on first use
+  GDBusConnection* device_connection(const std::string& device_path);
+  // Drops the match rule of a device whose object is gone
+  void release_device_connection(const std::string& device_path);
+
+  bool set_discovery_filter(const std::string&              adapter_path,
+                            const std::vector<std::string>& service_uuids);
+  bool stop_discovery_locked();
 
-  bool        device_has_target_service(const std::string& device_path);
-  std::string find_default_adapter();
-  bool        ensure_adapter_powered();
+  // Discovery scheduler, all called with scan_mutex_ held
+  static gboolean on_scan_timer(gpointer user_data);
+  void            run_scan_scheduler_locked();
+  void            schedule_scan_check_locked(guint delay_ms);
+  void            sample_notifications_locked();
+  const char*     scan_suspend_reason_locked();
+  void            open_scan_window_locked();
+  void            send_discovery_method_locked(const DBusCall::Method& method);
+  void            poke_scan_scheduler();
+  bool device_has_target_service(GVariant* properties);
+  bool load_managed_objects(GVariant* result);
+  // Fulfils `owned` once the thread owns the context
+  void io_thread_main(std::promise<void>* owned);
+  bool any_adapter_powered();
+  bool set_adapter_powered(const std::string& adapter_path, bool powered);
+  bool is_adapter_powered(const std::string& adapter_path);
+
+  // Adapter bookkeeping, all called with adapters_mutex_ held
+  AdapterStats*            find_adapter_locked(const std::string& device_path);
+  void                     set_link_state_locked(const std::string& device_path,
+                                                 bool               connected);
+  std::vector<std::string> adapter_paths_locked(bool powered_only) const;
+
+  void add_adapter(const std::string& adapter_path, GVariant* properties);
+  void remove_adapter(const std::string& adapter_path);
+  // Copy of the default adapter's path; adapters come and go on the I/O thread
+  std::string default_adapter();
+  void register_advertisement_monitors();
+  static gboolean on_gc_timer(gpointer user_data);
+  void            update_device_record_locked(const std::string& device_path,
+                                              GVariant*          properties,
+                                              bool               seen);
+  // `properties`: the Device1 a{sv} of the triggering signal, full or not
+  void try_auto_connect(const std::string& object_path, GVariant* properties);
+  void finish_auto_connect(const std::string&                    address,
+                           const std::string&                    device_path,
+                           std::shared_ptr<BluetoothDevice>      device,
+                           std::chrono::steady_clock::time_point seen,
+                           bool                                  connected);
 
 public:
-  BluetoothManager();
+  // With no context the manager creates a private one and iterates it on its
+  // own I/O thread. A caller-supplied context is only used for dispatch; the
+  // caller keeps iterating it.
+  explicit BluetoothManager(GMainContext* context = nullptr);
   ~BluetoothManager();
 
-  // Initialize connection to BlueZ
+  // Connect to BlueZ, load known objects and power on every adapter. The
+  // steps are chained asynchronously: adapters power up while devices are
+  // loaded, and completion follows PropertiesChanged(Powered) rather than a
+  // fixed delay. The callback runs on the manager's context.
+  void initialize_async(InitializeCallback callback);
+  // Blocking wrapper around initialize_async()
   bool initialize();
   void cleanup();
 
-  // Adapter management
-  bool power_on_adapter();
-  bool power_off_adapter();
-  bool is_adapter_powered();
+  StartupTimings get_startup_timings();
+
+  // Opens `count` dedicated bus connections on the next initialize() and
+  // spreads devices over them by object path, so their calls and
+  // notifications no longer share the manager's socket and match rules.
+  // 0 (the default) keeps every device on the manager's connection.
+  void   set_device_connection_count(size_t count);
+  size_t get_device_connection_count() const
+  {
+    return device_connections_.size();
+  }
+
+  // Adapter management. Power and scan operations apply to every adapter;
+  // is_adapter_powered() reports the default one.
+  bool                      power_on_adapter();
+  bool                      power_off_adapter();
+  bool                      is_adapter_powered();
+  std::vector<AdapterStats> get_adapter_stats();
+  void                      print_adapter_stats();
 
   // Scanning operations
   bool start_discovery(const std::vector<std::string>& service_uuids = {});
   bool stop_discovery();
   bool is_discovering();
 
+  // Scan windows follow the schedule and are paused while connects are
+  // pending or notification throughput exceeds the configured limit
+  void         set_scan_schedule(const ScanSchedule& schedule);
+  ScanSchedule get_scan_schedule();
+  ScanStats    get_scan_stats();
+  void         print_scan_stats();
+
+  // Presence detection offloaded to the controller through BlueZ
+  // advertisement monitors: a lower-power alternative to start_discovery()
+  // when only the arrival and departure of known devices matter. Callbacks
+  // run on the manager's context. Returns the monitor id, or 0 on failure.
+  uint32_t add_advertisement_monitor(const MonitorConfig& config,
+                                     MonitorCallback      on_found,
+                                     MonitorCallback      on_lost = nullptr);
+  bool     remove_advertisement_monitor(uint32_t id);
+
   // Device management
   std::vector<std::shared_ptr<BluetoothDevice>> get_discovered_devices();
   std::shared_ptr<BluetoothDevice> get_device(const std::string& address);
   bool                             remove_device(const std::string& address);
 
+  // Connect through the least-loaded powered adapter (active links plus
+  // pending connects) among those that have seen the device
+  std::shared_ptr<BluetoothDevice> connect_device(const std::string& address);
+
+  // Stale device collection: each sweep asks bluetoothd (Adapter1.RemoveDevice)
+  // to drop up to max_removals_per_sweep of the oldest unneeded objects.
+  // collect_stale_devices() runs one sweep now and returns the number of
+  // removals requested.
+  void           set_device_gc_policy(const DeviceGcPolicy& policy);
+  DeviceGcPolicy get_device_gc_policy();
+  DeviceGcStats  get_device_gc_stats();
+  size_t         collect_stale_devices();
+
+  // Connect allow-listed devices from the event loop as soon as one of their
+  // advertisements is seen, through the adapter that heard it. The
+  // advertisement-to-connected latency is exported as
+  // bscm_auto_connect_latency_seconds (per device in
+  // get_auto_connect_stats()); the callback runs on the manager's context
+  // after each successful auto-connect.
+  void add_auto_connect(const std::string& address);
+  bool remove_auto_connect(const std::string& address);
+  std::vector<AutoConnectStats> get_auto_connect_stats();
+  void set_auto_connect_callback(AutoConnectCallback callback);
+
   // Utility
   void print_discovered_devices();
   void set_target_service_uuids(const std::vector<std::string>& uuids);
 
+  // Advertisement stream (RSSI, TxPower, ManufacturerData, ServiceData).
+  // The callback runs on the manager's context for every update.
+  void     set_advertisement_callback(AdvertisementCallback callback);
+  bool     get_advertisement(const std::string& address,
+                             AdvertisementData& data);
+  uint64_t get_advertisement_count() const { return advertisement_count_; }
+
   // Get the D-Bus connection for devices to use
   GDBusConnection* get_connection() const { return connection_; }
+  // Context on which all signals and async replies are dispatched
+  GMainContext*    get_context() const { return context_; }
 };
\ No newline at end of file
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Common.h"
+
+// BlueZ and GDBus failures, grouped by how a caller can react to them
+enum class BluezErrorCode
+{
+  None,
+  InProgress,        // org.bluez.Error.InProgress: another operation is busy
+  Failed,            // org.bluez.Error.Failed: ATT busy, link glitches
+  NotReady,          // adapter or service discovery not ready yet
+  NotConnected,
+  AlreadyConnected,
+  NotPermitted,      // also NotAuthorized: the attribute refuses the access
+  NotSupported,
+  InvalidArguments,  // also InvalidOffset and InvalidValueLength
+  DoesNotExist,      // also UnknownObject: the object has gone away
+  AuthenticationFailed,
+  Timeout,           // no reply before the deadline
+  Cancelled,
+  Unknown,
+};
+
+// Structured outcome of an operation, filled in through an optional
+// `BluezError*` argument
+struct BluezError
+{
+  BluezErrorCode code = BluezErrorCode::None;
+  std::string    message;
+  unsigned       attempts = 0;  // calls made, retries included
+
+  bool ok() const { return code == BluezErrorCode::None; }
+
+  static BluezErrorCode classify(const GError* error);
+  // `error` may be null for success
+  static BluezError from(const GError* error, unsigned attempts = 1);
+};
+
+const char* error_code_name(BluezErrorCode code);
+
+// Which failures are retried and how long to back off in between. The
+// defaults retry the errors bluetoothd returns for a momentarily busy link
+// or controller; timeouts are not among them since a write may well have
+// been applied.
+struct RetryPolicy
+{
+  unsigned                    max_attempts = 3;  // 1: no retries
+  std::chrono::milliseconds   initial_backoff{100};
+  std::chrono::milliseconds   max_backoff{2000};
+  double                      backoff_multiplier = 2.0;
+  std::vector<BluezErrorCode> retryable          = {BluezErrorCode::InProgress,
+                                                    BluezErrorCode::Failed,
+                                                    BluezErrorCode::NotReady};
+
+  bool should_retry(BluezErrorCode code) const;
+  // Backoff before attempt `attempt` + 1
+  std::chrono::milliseconds backoff(unsigned attempt) const;
+};
+
+// One call attempt, to be given up after `timeout`: returns false and sets
+// `error` on failure
+using RetryAttempt =
+  std::function<bool(std::chrono::milliseconds timeout, GError** error)>;
+
+// Calls `attempt` until it succeeds, fails with an error the policy does not
+// retry, or max_attempts or `timeout` is used up, sleeping the backoff in
+// between. `timeout` covers every attempt and backoff together; each attempt
+// gets what is left of it (a negative timeout is passed on unchanged). On
+// failure `error` receives the last attempt's error. Retries and their
+// outcomes are counted per operation in bscm_retries_total.
+bool run_with_retry(const RetryPolicy&        policy,
+                    const char*               operation,
+                    std::chrono::milliseconds timeout,
+                    const RetryAttempt&       attempt,
+                    GError**                  error,
+                    unsigned*                 attempts = nullptr);
+
+// Reports how one asynchronous attempt ended: null on success, otherwise
+// its error, which stays owned by the caller
+using AsyncRetryDone = std::function<void(GError* error)>;
+// One asynchronous call attempt, to be given up after `timeout`; it calls
+// `done` exactly once, on the context the retries run on
+using AsyncRetryAttempt =
+  std::function<void(std::chrono::milliseconds timeout, AsyncRetryDone done)>;
+// The outcome of the whole operation: the last attempt's error (null on
+// success, released when this returns) and the number of attempts made
+using AsyncRetryComplete =
+  std::function<void(GError* error, unsigned attempts)>;
+
+// run_with_retry() without blocking: the same policy, timeout and metrics,
+// but the backoff is a timer on `context` (the thread-default one if null)
+// instead of a sleep, so retries are made on that context. The first
+// attempt is made right away. Once `cancellable` is cancelled no further
+// attempt is made and `complete` gets a G_IO_ERROR_CANCELLED error.
+void run_with_retry_async(const RetryPolicy&            policy,
+                          const char*                   operation,
+                          std::chrono::milliseconds     timeout,
+                          AsyncRetryAttempt             attempt,
+                          AsyncRetryComplete            complete,
+                          GMainContext*                 context,
+                          std::shared_ptr<GCancellable> cancellable = nullptr);
\ No newline at end of file
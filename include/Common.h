@@ -23,6 +23,11 @@ constexpr const char* DEVICE_INTERFACE       = "org.bluez.Device1";
 constexpr const char* GATT_SERVICE_INTERFACE = "org.bluez.GattService1";
 constexpr const char* GATT_CHARACTERISTIC_INTERFACE =
   "org.bluez.GattCharacteristic1";
+constexpr const char* GATT_DESCRIPTOR_INTERFACE = "org.bluez.GattDescriptor1";
+constexpr const char* ADVERTISEMENT_MONITOR_INTERFACE =
+  "org.bluez.AdvertisementMonitor1";
+constexpr const char* ADVERTISEMENT_MONITOR_MANAGER_INTERFACE =
+  "org.bluez.AdvertisementMonitorManager1";
 constexpr const char* PROPERTIES_INTERFACE = "org.freedesktop.DBus.Properties";
 constexpr const char* OBJECT_MANAGER_INTERFACE =
   "org.freedesktop.DBus.ObjectManager";
@@ -42,9 +47,63 @@ namespace Utils
 {
 std::string          bytes_to_hex_string(const std::vector<uint8_t>& data);
 std::vector<uint8_t> hex_string_to_bytes(const std::string& hex_str);
+bool                 hex_string_to_bytes(const std::string&    hex_str,
+                                         std::vector<uint8_t>& bytes);
+
+// Hex kernels working on caller-provided buffers. hex_encode writes lowercase
+// digits, with `separator` between bytes unless it is '\0', and returns the
+// number of characters written (0 if `out` is too small; no terminator is
+// added). hex_decode skips spaces and returns false on invalid digits, an odd
+// digit count or insufficient room in `out`. The contiguous encoding is
+// vectorized; the spaced one, whose 3-byte stride needs a byte shuffle SSE2
+// lacks, writes one table-driven group per byte.
+size_t hex_encoded_length(size_t length, char separator);
+size_t hex_encode(const uint8_t* data,
+                  size_t         length,
+                  char*          out,
+                  size_t         out_size,
+                  char           separator = ' ');
+bool   hex_decode(const char* hex,
+                  size_t      length,
+                  uint8_t*    out,
+                  size_t      out_size,
+                  size_t&     out_length);
 std::string          variant_to_string(GVariant* variant);
 std::vector<uint8_t> variant_to_bytes(GVariant* variant);
 void                 print_with_timestamp(const std::string& message);
+
+// Formats "YYYY-MM-DD HH:MM:SS.mmm" into buffer (at least 24 bytes). The
+// date/time part is cached per thread and only re-rendered once a second.
+size_t format_timestamp(std::chrono::system_clock::time_point time,
+                        char*                                 buffer,
+                        size_t                                size);
+
+// Makes `context` the calling thread's default main context for the scope, so
+// signal subscriptions and async calls made inside it dispatch there. GLib
+// only lets a thread push a context it can acquire; use invoke() where
+// another thread may be iterating `context`.
+class ScopedMainContext
+{
+public:
+  explicit ScopedMainContext(GMainContext* context) : context_(context)
+  {
+    g_main_context_push_thread_default(context_);
+  }
+  ~ScopedMainContext() { g_main_context_pop_thread_default(context_); }
+
+  ScopedMainContext(const ScopedMainContext&)            = delete;
+  ScopedMainContext& operator=(const ScopedMainContext&) = delete;
+
+private:
+  GMainContext* context_;
+};
+
+// Runs `function` with `context` as the thread-default context: right here if
+// this thread can acquire it, otherwise on the thread iterating it. invoke()
+// then returns at once; invoke_sync() waits, so it must not be called holding
+// a lock that thread may need.
+void invoke(GMainContext* context, std::function<void()> function);
+void invoke_sync(GMainContext* context, const std::function<void()>& function);
 }  // namespace Utils
 
 // Exception class for Bluetooth operations
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Common.h"
+#include "Metrics.h"
+
+namespace DBusCall
+{
+// A method as called from one place in the library, with the call metrics
+// of that component (count, outcome and latency). Declare it static where it
+// is called, so that the metrics are looked up on the first call only:
+//
+//   static const DBusCall::Method connect_call{
+//     "BluetoothDevice", BlueZ::DEVICE_INTERFACE, "Connect"};
+struct Method
+{
+  Method(const char* component,
+         const char* interface_name,
+         const char* method_name);
+
+  const char*           interface_name;
+  const char*           method_name;
+  Metrics::CallMetrics& metrics;
+};
+
+// g_dbus_connection_call_sync() of `method` on org.bluez, recording its
+// outcome (ok, error, cancelled, timeout) and latency. Ownership and error
+// semantics are those of g_dbus_connection_call_sync().
+GVariant* call_sync(GDBusConnection*    connection,
+                    const gchar*        object_path,
+                    const Method&       method,
+                    GVariant*           parameters,
+                    const GVariantType* reply_type,
+                    gint                timeout_msec,
+                    GError**            error,
+                    GCancellable*       cancellable = nullptr);
+
+// Receives the outcome of call(); exactly one of `reply` and `error` is set.
+// Both are released when the handler returns.
+using ReplyHandler = std::function<void(GVariant* reply, GError* error)>;
+
+// Asynchronous counterpart of call_sync() with the same metrics. The handler
+// runs on `context`, or on the thread-default main context of the calling
+// thread if that is null. With a context another thread is iterating, the
+// call is issued from that thread (Utils::invoke()), so `method` must
+// outlive the call.
+void call(GDBusConnection*    connection,
+          const gchar*        object_path,
+          const Method&       method,
+          GVariant*           parameters,
+          const GVariantType* reply_type,
+          gint                timeout_msec,
+          ReplyHandler        handler,
+          GCancellable*       cancellable = nullptr,
+          GMainContext*       context     = nullptr);
+
+// Milliseconds for the timeout_msec argument; negative means the GDBus
+// default of 25 s
+inline gint timeout_ms(std::chrono::milliseconds timeout)
+{
+  return timeout.count() < 0 ? -1 : static_cast<gint>(timeout.count());
+}
+
+// Cancels every call made with its cancellable at once, e.g. all pending
+// operations of a device when it disconnects. Each cancel() starts a new
+// generation, so calls made afterwards are unaffected.
+class CancelGroup
+{
+public:
+  CancelGroup();
+  ~CancelGroup();
+
+  // The current generation's cancellable, kept alive for as long as the
+  // returned pointer is held
+  std::shared_ptr<GCancellable> current();
+  void                          cancel();
+
+  CancelGroup(const CancelGroup&)            = delete;
+  CancelGroup& operator=(const CancelGroup&) = delete;
+
+private:
+  std::mutex                    mutex_;
+  std::shared_ptr<GCancellable> cancellable_;
+};
+}  // namespace DBusCall
\ No newline at end of file
@@ -1,18 +1,117 @@
 #pragma once
 
+#include <atomic>
+#include "BluezError.h"
 #include "Common.h"
+#include "DBusCall.h"
+#include "GattDatabase.h"
+#include "Metrics.h"
 #include "NotificationHandler.h"
 
+// Outcome of read_value_async(): `error` is null on success
+using ReadCallback =
+  std::function<void(const std::vector<uint8_t>& data, const GError* error)>;
+
+// Outcome of write_value_async(): `error` is null on success
+using WriteCallback = std::function<void(const GError* error)>;
+
+// Progress of a long transfer: bytes done and the total (0 if unknown)
+using TransferProgress = std::function<void(size_t done, size_t total)>;
+
+// Options for read_value_into() and write_value_long()
+struct LongTransferOptions
+{
+  uint16_t         offset     = 0;      // position within the value
+  size_t           chunk_size = 0;      // writes: bytes per WriteValue, 0: all
+  bool             reliable   = false;  // writes: verified prepared writes
+  TransferProgress progress;
+  // Per ReadValue/WriteValue request; 0: 10 s for reads, 30 s for writes
+  std::chrono::milliseconds timeout{0};
+};
+
 class GattCharacteristic
 {
 private:
-  GDBusConnection*                     connection_;
-  std::string                          object_path_;
-  std::string                          service_path_;
-  std::string                          uuid_;
-  std::vector<std::string>             flags_;
-  std::shared_ptr<NotificationHandler> notification_handler_;
-  bool                                 notifications_enabled_;
+  static constexpr uint16_t ATT_DEFAULT_MTU      = 23;
+  static constexpr size_t   ATT_MAX_VALUE_LENGTH = 512;
+
+  // One ReadValue shared by every read issued while it is in flight
+  struct ReadFlight
+  {
+    bool                      done  = false;
+    bool                      async = false;  // completed on the context
+    std::vector<uint8_t>      value;
+    GError*                   error = nullptr;  // null on success
+    std::vector<ReadCallback> waiters;          // coalesced async reads
+
+    ~ReadFlight()
+    {
+      if (error)
+      {
+        g_error_free(error);
+      }
+    }
+  };
+
+  // Shared with pending replies, which may outlive the characteristic
+  struct ReadCache
+  {
+    std::mutex                            mutex;
+    std::condition_variable               done_cv;
+    std::chrono::milliseconds             ttl{0};
+    bool                                  valid = false;
+    std::vector<uint8_t>                  value;
+    std::chrono::steady_clock::time_point stored;
+    uint64_t                              generation = 0;  // bumped on reset
+    std::shared_ptr<ReadFlight>           flight;
+    Metrics::Counter*                     hits;
+    Metrics::Counter*                     misses;
+    Metrics::Counter*                     coalesced;
+  };
+
+  // Last-value-wins writes; shared with pending replies like ReadCache
+  struct WriteQueue
+  {
+    GDBusConnection*                       connection;
+    GMainContext*                          context;
+    std::string                            object_path;
+    std::mutex                             mutex;
+    bool                                   in_flight = false;
+    bool                                   queued    = false;
+    std::vector<uint8_t>                   value;  // queued behind in_flight
+    std::chrono::milliseconds              timeout{0};
+    std::shared_ptr<DBusCall::CancelGroup> cancel_group;
+    Metrics::Counter*                      sent;
+    Metrics::Counter*                      collapsed;
+    Metrics::Counter*                      failed;
+
+    ~WriteQueue()
+    {
+      if (connection)
+      {
+        g_object_unref(connection);
+      }
+      g_main_context_unref(context);
+    }
+  };
+
+  GDBusConnection*                       connection_;
+  GMainContext*                          context_;
+  // Path, service and UUID are set by the constructor and never change;
+  // flags and MTU follow rediscovery and are read from any thread
+  std::string                            object_path_;
+  std::string                            service_path_;
+  std::string                            uuid_;
+  std::atomic<uint32_t>                  flags_;  // GattFlags
+  std::mutex                             notify_mutex_;
+  std::shared_ptr<NotificationHandler>   notification_handler_;
+  bool                                   notifications_enabled_;
+  std::atomic<uint16_t>                  mtu_;
+  std::shared_ptr<DBusCall::CancelGroup> cancel_group_;
+  std::shared_ptr<ReadCache>             read_cache_;
+  std::shared_ptr<WriteQueue>            write_queue_;
+  std::mutex                             retry_mutex_;
+  RetryPolicy                            retry_policy_;
 
   // D-Bus callbacks
   static void on_read_ready(GObject*      source_object,
@@ -30,25 +129,164 @@ private:
 
   // Helper methods
   GVariant* get_property(const std::string& property);
+  GVariant* get_all_properties();
   bool      set_property(const std::string& property, GVariant* value);
   void      update_properties();
+  void      load_properties(GVariant* properties);
+  bool      check_writable();
+  bool      write_variant(GVariant*                 value,
+                          std::chrono::milliseconds timeout,
+                          BluezError*               error);
+  // Sends StopNotify and hands back the handler, to be disabled once
+  // notify_mutex_ is released
+  std::shared_ptr<NotificationHandler> stop_notifications_locked();
+  // StartNotify with retries; marks the subscription active on success.
+  // Called with notify_mutex_ held.
+  bool      send_start_notify(BluezError* error);
+  uint32_t  attach_subscriber_locked(NotificationCallback callback,
+                                     BluezError*          error);
+  // Called once the UUID is known: their metrics are per UUID, which stays
+  // bounded however many devices come and go
+  void      create_read_cache();
+  void      create_write_queue();
+  static void send_queued_write(const std::shared_ptr<WriteQueue>& queue,
+                                const std::vector<uint8_t>&        data,
+                                std::chrono::milliseconds          timeout);
+  bool      fetch_value(std::vector<uint8_t>&     data,
+                        std::chrono::milliseconds timeout,
+                        GError**                  error);
+  static void finish_read(const std::shared_ptr<ReadCache>&  cache,
+                          const std::shared_ptr<ReadFlight>& flight,
+                          uint64_t                           generation,
+                          std::vector<uint8_t>               value,
+                          GError*                            error);
 
 public:
-  GattCharacteristic(GDBusConnection*   connection,
-                     const std::string& object_path);
+  static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{10000};
+  static constexpr std::chrono::milliseconds LONG_WRITE_TIMEOUT{30000};
+
+  // Calls are made cancellable through `cancel_group`, which the device
+  // shares with all its characteristics to abort them on disconnect
+  GattCharacteristic(
+    GDBusConnection*                       connection,
+    const std::string&                     object_path,
+    GMainContext*                          context      = nullptr,
+    std::shared_ptr<DBusCall::CancelGroup> cancel_group = nullptr);
+  // Builds from an already known a{sv} of GattCharacteristic1 properties
+  // (GetManagedObjects, InterfacesAdded) without any D-Bus round trip
+  GattCharacteristic(
+    GDBusConnection*                       connection,
+    const std::string&                     object_path,
+    GVariant*                              properties,
+    GMainContext*                          context      = nullptr,
+    std::shared_ptr<DBusCall::CancelGroup> cancel_group = nullptr);
+  // Builds from characteristic `index` of a device's GATT database
+  GattCharacteristic(
+    GDBusConnection*                       connection,
+    const GattDatabase&                    database,
+    GattDatabase::Index                    index,
+    GMainContext*                          context      = nullptr,
+    std::shared_ptr<DBusCall::CancelGroup> cancel_group = nullptr);
   ~GattCharacteristic();
 
   // Basic properties
   const std::string& get_uuid() const { return uuid_; }
   const std::string& get_object_path() const { return object_path_; }
   const std::string& get_service_path() const { return service_path_; }
-  const std::vector<std::string>& get_flags() const { return flags_; }
+  uint32_t           get_flag_bits() const { return flags_; }  // GattFlags
+  // BlueZ flag names, as GattCharacteristic1.Flags lists them
+  std::vector<std::string> get_flags() const
+  {
+    return GattFlags::names(flags_);
+  }
+
+  // Whether database record `index` still describes this characteristic:
+  // same UUID and service. One that does not is a new characteristic.
+  bool matches_record(const GattDatabase& database,
+                      GattDatabase::Index index) const;
+  // Takes flags and MTU from a rediscovered record of this characteristic,
+  // keeping subscriptions, caches and queued writes
+  void load_record(const GattDatabase& database, GattDatabase::Index index);
+
+  // GATT operations. Reads issued while another read of the characteristic
+  // is in flight share its ReadValue instead of sending their own (except a
+  // blocking read on the context thread, which cannot wait for an async
+  // one). Every request gives up after `timeout`, waiting for a shared read
+  // included, or when the cancel group is cancelled.
+  // Blocking reads, writes and StartNotify retry transient failures as the
+  // retry policy says and describe the outcome in `error` if given (with
+  // 0 attempts when served from the cache or another read's call).
+  bool read_value(std::vector<uint8_t>&     data,
+                  std::chrono::milliseconds timeout = DEFAULT_TIMEOUT,
+                  BluezError*               error   = nullptr);
+  // Non-blocking read; the callback runs on the characteristic's context, or
+  // on the thread of a blocking read_value() it was coalesced with
+  void read_value_async(ReadCallback              callback,
+                        std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+
+  // With a non-zero TTL, successful reads are served from memory until the
+  // TTL expires or the cache is invalidated (on disconnect or a Value
+  // change). Meant for values that rarely change, such as Device Information.
+  void                      set_read_cache_ttl(std::chrono::milliseconds ttl);
+  std::chrono::milliseconds get_read_cache_ttl();
+  void                      invalidate_read_cache();
+
+  void        set_retry_policy(const RetryPolicy& policy);
+  RetryPolicy get_retry_policy();
 
-  // GATT operations
-  bool read_value(std::vector<uint8_t>& data);
-  bool write_value(const std::vector<uint8_t>& data);
-  bool start_notifications(NotificationCallback callback);
-  bool stop_notifications();
+  // Long values. read_value_into() reads from options.offset straight into
+  // `buffer`, following up with the offset option until the value ends or
+  // the buffer is full; `length` receives the bytes stored.
+  // write_value_long() sends the value in chunk_size pieces at increasing
+  // offsets, or with type=reliable as one prepared-write sequence that the
+  // server executes only once every piece has been echoed back intact.
+  bool read_value_into(uint8_t*                   buffer,
+                       size_t                     capacity,
+                       size_t&                    length,
+                       const LongTransferOptions& options = {});
+  bool write_value_long(const uint8_t*             data,
+                        size_t                     length,
+                        const LongTransferOptions& options = {});
+  bool write_value(const std::vector<uint8_t>& data,
+                   std::chrono::milliseconds   timeout = DEFAULT_TIMEOUT,
+                   BluezError*                 error   = nullptr);
+  // Zero-copy writes. The pointer overload wraps `data` in place, so it only
+  // has to stay valid until the call returns. The GBytes overloads take their
+  // own reference for as long as GDBus needs the payload, so the caller may
+  // unref `bytes` as soon as they return.
+  bool write_value(const uint8_t*            data,
+                   size_t                    length,
+                   std::chrono::milliseconds timeout = DEFAULT_TIMEOUT,
+                   BluezError*               error   = nullptr);
+  bool write_value(GBytes*                   bytes,
+                   std::chrono::milliseconds timeout = DEFAULT_TIMEOUT,
+                   BluezError*               error   = nullptr);
+  // Non-blocking write; the callback runs on the characteristic's context
+  void write_value_async(GBytes*                   bytes,
+                         WriteCallback             callback,
+                         std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+  // Last-value-wins write for rapidly updated values such as setpoints.
+  // Returns at once; at most one WriteValue is in flight and one value is
+  // queued behind it, each new value replacing the queued one, so a slow
+  // link delays a value by at most one round trip instead of building a
+  // backlog. Failures are logged and counted, not reported.
+  bool write_value_latest(const std::vector<uint8_t>& data,
+                          std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+  // Notification subscriptions are reference counted: the first subscriber
+  // issues StartNotify, later ones join the same fan-out, and StopNotify is
+  // only sent once the last one leaves. start_notifications() returns the
+  // subscription id, or 0 on failure.
+  uint32_t start_notifications(NotificationCallback callback,
+                               BluezError*          error = nullptr);
+  bool     stop_notifications(uint32_t subscription_id);
+  // Drops every subscriber at once
+  bool     stop_notifications();
+  size_t   get_subscriber_count();
+  // Called by BluetoothDevice: a dropped link suspends the subscription but
+  // keeps its subscribers, and once services are resolved again resuming
+  // sends StartNotify for them
+  void     suspend_notifications();
+  void     resume_notifications();
 
   // Properties
   bool can_read() const;
@@ -56,6 +294,9 @@ public:
   bool can_write_without_response() const;
   bool can_notify() const;
   bool can_indicate() const;
+  bool can_write_reliable() const;
+  // ATT MTU of the link as last reported by BlueZ (the default 23 if unknown)
+  uint16_t get_mtu() const { return mtu_; }
   bool are_notifications_enabled() const { return notifications_enabled_; }
 
   // Utility
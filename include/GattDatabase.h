@@ -0,0 +1,175 @@
+#pragma once
+
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include "Common.h"
+
+// GattCharacteristic1.Flags as a bit set
+namespace GattFlags
+{
+enum : uint32_t
+{
+  Broadcast                    = 1u << 0,
+  Read                         = 1u << 1,
+  WriteWithoutResponse         = 1u << 2,
+  Write                        = 1u << 3,
+  Notify                       = 1u << 4,
+  Indicate                     = 1u << 5,
+  AuthenticatedSignedWrites    = 1u << 6,
+  ExtendedProperties           = 1u << 7,
+  ReliableWrite                = 1u << 8,
+  WritableAuxiliaries          = 1u << 9,
+  EncryptRead                  = 1u << 10,
+  EncryptWrite                 = 1u << 11,
+  EncryptNotify                = 1u << 12,
+  EncryptIndicate              = 1u << 13,
+  EncryptAuthenticatedRead     = 1u << 14,
+  EncryptAuthenticatedWrite    = 1u << 15,
+  EncryptAuthenticatedNotify   = 1u << 16,
+  EncryptAuthenticatedIndicate = 1u << 17,
+  SecureRead                   = 1u << 18,
+  SecureWrite                  = 1u << 19,
+  SecureNotify                 = 1u << 20,
+  SecureIndicate               = 1u << 21,
+  Authorize                    = 1u << 22,
+};
+
+// Bits of an `as` of BlueZ flag names; unknown names are ignored
+uint32_t parse(GVariant* flags);
+// BlueZ names of the set bits, in bit order
+std::vector<std::string> names(uint32_t flags);
+// The same names, comma separated ("None" if there are none)
+std::string to_string(uint32_t flags);
+}  // namespace GattFlags
+
+// The GATT tree of one device, as discovered from GetManagedObjects. Services,
+// characteristics and descriptors live in three contiguous arrays and refer
+// to each other by index; the characteristics of a service, and the
+// descriptors of a characteristic, are adjacent. Paths and UUIDs are interned
+// in a string pool that survives rebuilds, so rediscovering the same device
+// reuses the arrays' capacity and adds no strings; objects whose serialized
+// interfaces are unchanged since the last rebuild are copied over instead
+// of being unpacked again.
+class GattDatabase
+{
+public:
+  using Index    = uint32_t;
+  using StringId = uint32_t;
+
+  static constexpr Index NONE = UINT32_MAX;
+
+  struct Service
+  {
+    StringId path;
+    StringId uuid;
+    bool     primary;
+    Index    first_characteristic;
+    Index    characteristic_count;
+  };
+
+  struct Characteristic
+  {
+    StringId path;
+    StringId uuid;
+    StringId service_path;
+    Index    service;  // NONE while its service is unknown
+    uint32_t flags;    // GattFlags
+    uint16_t mtu;      // 0 if not reported
+    Index    first_descriptor;
+    Index    descriptor_count;
+  };
+
+  struct Descriptor
+  {
+    StringId path;
+    StringId uuid;
+    StringId characteristic_path;
+    Index    characteristic;  // NONE while its characteristic is unknown
+  };
+
+  // Rebuilding: begin_update() drops every record, the add_*() calls record
+  // objects (replacing any with the same path) and end_update() orders and
+  // links them. Records may also be added to a finished database; they are
+  // linked by the next end_update().
+  void begin_update();
+  // Records whichever GATT interfaces the a{sa{sv}} of an object carries
+  void add_object(const char* object_path, GVariant* interfaces);
+  void add_service(const char* object_path, GVariant* properties);
+  void add_characteristic(const char* object_path, GVariant* properties);
+  void add_descriptor(const char* object_path, GVariant* properties);
+  void end_update();
+
+  const std::vector<Service>&        services() const { return services_; }
+  const std::vector<Characteristic>& characteristics() const
+  {
+    return characteristics_;
+  }
+  const std::vector<Descriptor>& descriptors() const { return descriptors_; }
+
+  std::string_view string(StringId id) const { return strings_[id]; }
+  size_t           string_count() const { return strings_.size(); }
+
+  // Lookups return NONE when nothing matches; UUIDs compare ignoring case
+  Index find_characteristic(std::string_view object_path) const;
+  // The characteristic `char_uuid` of service `service_uuid`, or of any
+  // service if that one has none (or `service_uuid` is empty)
+  Index find_characteristic(std::string_view service_uuid,
+                            std::string_view char_uuid) const;
+  Index find_service(std::string_view uuid) const;
+
+private:
+  enum class Kind : uint8_t
+  {
+    None,  // no GATT interface
+    Service,
+    Characteristic,
+    Descriptor,
+  };
+
+  // What add_object() made of an object path the last time it saw it
+  struct KnownObject
+  {
+    std::string bytes;       // the object's serialized a{sa{sv}}
+    uint32_t    generation;  // update that recorded it
+    Kind        kind;
+    Index       index;  // of its record once that update ended
+  };
+
+  // Never shrinks: object paths derive from attribute handles, so the pool
+  // stays bounded by what the device has ever exposed
+  std::deque<std::string>                        strings_;
+  std::unordered_map<std::string_view, StringId> ids_;
+  std::vector<Service>                           services_;
+  std::vector<Characteristic>                    characteristics_;
+  std::vector<Descriptor>                        descriptors_;
+
+  // The previous update's records, kept during an update for add_object()
+  // to copy from
+  std::unordered_map<StringId, KnownObject> known_;
+  std::vector<Service>                      previous_services_;
+  std::vector<Characteristic>               previous_characteristics_;
+  std::vector<Descriptor>                   previous_descriptors_;
+  uint32_t                                  generation_ = 0;
+  bool                                      updating_   = false;
+
+  // Record one object, replacing any record with the same path
+  void record_service(StringId path, GVariant* properties);
+  void record_characteristic(StringId path, GVariant* properties);
+  void record_descriptor(StringId path, GVariant* properties);
+  // Copies the previous update's record of an unchanged object
+  bool reuse(const KnownObject& known);
+  void set_index(StringId path, Index index);
+
+  StringId intern(std::string_view value);
+  // NONE if `value` was never interned
+  StringId lookup(std::string_view value) const;
+  bool     uuid_matches(StringId uuid, std::string_view value) const;
+  // First record in [begin, end) with UUID `uuid`, ignoring case
+  template <typename Record>
+  Index find_uuid(const std::vector<Record>& records,
+                  Index                      begin,
+                  Index                      end,
+                  std::string_view           uuid) const;
+  bool     less(StringId a, StringId b) const;
+};
\ No newline at end of file
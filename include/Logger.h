@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include "Common.h"
+
+enum class LogLevel
+{
+  Debug = 0,
+  Info,
+  Warning,
+  Error,
+  None
+};
+
+struct LogRecord
+{
+  LogLevel    level;
+  const char* timestamp;  // "YYYY-MM-DD HH:MM:SS.mmm"
+  const char* message;
+  size_t      length;
+};
+
+using LogSink = std::function<void(const LogRecord& record)>;
+
+// Asynchronous logger. Producers copy the message into a fixed-size slot of a
+// lock-free ring buffer; a single sink thread formats timestamps and hands
+// records to the configured sink. With no sink installed nothing is formatted
+// or written, so the library stays silent unless the application opts in.
+class Logger
+{
+public:
+  static constexpr size_t QUEUE_CAPACITY     = 1024;  // must be a power of 2
+  static constexpr size_t MAX_MESSAGE_LENGTH = 240;
+
+  static Logger& instance();
+
+  void     set_level(LogLevel level);
+  LogLevel get_level() const { return level_.load(std::memory_order_relaxed); }
+  bool     is_enabled(LogLevel level) const
+  {
+    return has_sink_.load(std::memory_order_relaxed) &&
+           level >= level_.load(std::memory_order_relaxed);
+  }
+
+  // Passing an empty sink disables output and stops the sink thread
+  void set_sink(LogSink sink);
+  void log(LogLevel level, const std::string& message);
+  void log(LogLevel level, const char* message, size_t length);
+
+  // Block until every record queued so far has reached the sink
+  void flush();
+
+  uint64_t get_dropped_count() const { return dropped_; }
+
+  // Writes "[timestamp] LEVEL message" lines to a stdio stream
+  static LogSink     stream_sink(FILE* stream);
+  static const char* level_to_string(LogLevel level);
+
+private:
+  struct Slot
+  {
+    std::atomic<size_t>                   sequence;
+    LogLevel                              level;
+    std::chrono::system_clock::time_point time;
+    uint16_t                              length;
+    char                                  text[MAX_MESSAGE_LENGTH];
+  };
+
+  Slot                    slots_[QUEUE_CAPACITY];
+  std::atomic<size_t>     enqueue_pos_;
+  std::atomic<size_t>     dequeue_pos_;
+  std::atomic<LogLevel>   level_;
+  std::atomic<bool>       has_sink_;
+  std::atomic<bool>       sink_idle_;
+  std::atomic<bool>       running_;
+  std::atomic<uint64_t>   dropped_;
+  std::mutex              sink_mutex_;
+  std::mutex              wake_mutex_;
+  std::condition_variable wake_cv_;
+  LogSink                 sink_;
+  std::thread             sink_thread_;
+
+  Logger();
+  ~Logger();
+  Logger(const Logger&)            = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  bool drain();
+  void sink_thread_main();
+  void stop_sink_thread();
+};
+
+#define BSCM_LOG(level, message)                  \
+  do                                              \
+  {                                               \
+    if (Logger::instance().is_enabled(level))     \
+    {                                             \
+      Logger::instance().log((level), (message)); \
+    }                                             \
+  } while (0)
+
+// Build with -DBSCM_DISABLE_DEBUG_LOG to compile debug logging out entirely;
+// the message expression is then never evaluated.
+#ifdef BSCM_DISABLE_DEBUG_LOG
+#define LOG_DEBUG(message) \
+  do                       \
+  {                        \
+  } while (0)
+#else
+#define LOG_DEBUG(message) BSCM_LOG(LogLevel::Debug, message)
+#endif
+#define LOG_INFO(message)    BSCM_LOG(LogLevel::Info, message)
+#define LOG_WARNING(message) BSCM_LOG(LogLevel::Warning, message)
+#define LOG_ERROR(message)   BSCM_LOG(LogLevel::Error, message)
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Common.h"
+
+namespace ManagedObjects
+{
+// Receives one object of a GetManagedObjects reply: its path and its
+// a{sa{sv}} interfaces. Both stay valid for as long as the reply does;
+// `interfaces` is borrowed.
+using ObjectVisitor =
+  std::function<void(const char* object_path, GVariant* interfaces)>;
+
+// Calls `visit` for every object of a (a{oa{sa{sv}}}) reply whose path
+// starts with `path_prefix`. Paths are compared in the serialized reply, and
+// only the interfaces of matching objects are wrapped in a GVariant (sharing
+// the reply's buffer), so objects of unrelated devices cost no allocations.
+// Entries whose framing cannot be read this way go through regular GVariant
+// accessors instead.
+void for_each_object(GVariant*            reply,
+                     const char*          path_prefix,
+                     const ObjectVisitor& visit);
+
+// The same walk over one object's a{sa{sv}}: calls `visit` with the name and
+// the a{sv} properties of every interface whose name starts with
+// `name_prefix`, leaving the others unpacked
+void for_each_interface(GVariant*            interfaces,
+                        const char*          name_prefix,
+                        const ObjectVisitor& visit);
+}  // namespace ManagedObjects
\ No newline at end of file
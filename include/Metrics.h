@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include "Common.h"
+
+namespace Metrics
+{
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+constexpr size_t SHARD_COUNT = 16;
+
+// Index of the calling thread's shard, assigned round-robin on first use
+size_t shard_index();
+
+// Monotonic counter split across cache-line-sized shards so that concurrent
+// writers never contend on the same line. Reads sum all shards.
+class Counter
+{
+public:
+  void increment(uint64_t value = 1)
+  {
+    shards_[shard_index()].value.fetch_add(value, std::memory_order_relaxed);
+  }
+  uint64_t value() const;
+
+private:
+  struct alignas(64) Shard
+  {
+    std::atomic<uint64_t> value{0};
+  };
+  Shard shards_[SHARD_COUNT];
+};
+
+class Gauge
+{
+public:
+  void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  void add(int64_t delta)
+  {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Latency histogram with fixed upper bounds (seconds), sharded like Counter
+class Histogram
+{
+public:
+  static constexpr size_t MAX_BUCKETS = 16;
+
+  explicit Histogram(const std::vector<double>& bounds);
+
+  void observe(double seconds);
+  void observe(std::chrono::steady_clock::duration duration)
+  {
+    observe(std::chrono::duration<double>(duration).count());
+  }
+  void observe_since(std::chrono::steady_clock::time_point start)
+  {
+    observe(std::chrono::steady_clock::now() - start);
+  }
+
+  const std::vector<double>& bounds() const { return bounds_; }
+  // Cumulative per-bucket counts (last entry is +Inf), total count and sum
+  void snapshot(std::vector<uint64_t>& buckets,
+                uint64_t&              count,
+                double&                sum) const;
+
+private:
+  struct alignas(64) Shard
+  {
+    std::atomic<uint64_t> buckets[MAX_BUCKETS + 1];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+  };
+
+  std::vector<double> bounds_;
+  Shard               shards_[SHARD_COUNT];
+};
+
+// 100 us .. 30 s, suited to D-Bus round trips and connection setup
+const std::vector<double>& latency_buckets();
+
+class Registry
+{
+public:
+  static Registry& instance();
+
+  // Metrics are created on first use and live as long as the registry;
+  // callers on hot paths should look them up once and keep the reference.
+  Counter&   counter(const std::string& name,
+                     const std::string& help,
+                     const Labels&      labels = {});
+  Gauge&     gauge(const std::string& name,
+                   const std::string& help,
+                   const Labels&      labels = {});
+  Histogram& histogram(const std::string&         name,
+                       const std::string&         help,
+                       const Labels&              labels = {},
+                       const std::vector<double>& bounds = latency_buckets());
+
+  // Prometheus text exposition format
+  std::string render();
+  bool        write_to_file(const std::string& path);
+
+  // Serve render() to every client connecting to a local Unix socket
+  bool start_socket_exporter(const std::string& socket_path);
+  void stop_socket_exporter();
+
+private:
+  enum class Type
+  {
+    Counter,
+    Gauge,
+    Histogram
+  };
+
+  struct Family
+  {
+    std::string                                       help;
+    Type                                              type;
+    std::map<std::string, std::unique_ptr<Counter>>   counters;
+    std::map<std::string, std::unique_ptr<Gauge>>     gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+
+  std::mutex                    mutex_;
+  std::map<std::string, Family> families_;
+  std::string                   socket_path_;
+  int                           socket_fd_;
+  std::atomic<bool>             exporter_running_;
+  std::thread                   exporter_thread_;
+
+  Registry();
+  ~Registry();
+  Registry(const Registry&)            = delete;
+  Registry& operator=(const Registry&) = delete;
+
+  Family& family(const std::string& name, const std::string& help, Type type);
+  void    exporter_thread_main();
+};
+
+// Per-method D-Bus call metrics, labelled by component, interface and method
+struct CallMetrics
+{
+  Counter*   succeeded;
+  Counter*   failed;
+  Counter*   cancelled;
+  Counter*   timed_out;
+  Histogram* latency;
+
+  // `error` tells cancelled and timed out calls from other failures
+  void record(bool                                  success,
+              std::chrono::steady_clock::time_point start,
+              const GError*                         error = nullptr);
+};
+
+// Looked up under the registry lock; DBusCall::Method keeps the result for
+// its call site
+CallMetrics& dbus_call(const char* component,
+                       const char* interface_name,
+                       const char* method_name);
+
+// Time spent inside a D-Bus signal handler, labelled by signal
+Histogram& signal_dispatch(const char* signal_name);
+}  // namespace Metrics
\ No newline at end of file
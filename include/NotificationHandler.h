@@ -1,14 +1,33 @@
 #pragma once
 
+#include <atomic>
 #include "Common.h"
+#include "Metrics.h"
 
+// Receives the Value changes of one characteristic over a single match rule
+// and fans them out to any number of subscribers
 class NotificationHandler
 {
 private:
-  GDBusConnection*     connection_;
-  std::string          characteristic_path_;
-  NotificationCallback callback_;
-  guint                properties_changed_subscription_;
+  struct Subscriber
+  {
+    uint32_t             id;
+    NotificationCallback callback;
+  };
+  using SubscriberList = std::vector<Subscriber>;
+
+  GDBusConnection* connection_;
+  GMainContext*    context_;
+  std::string      characteristic_path_;
+  guint            properties_changed_subscription_;
+  // Copy-on-write: dispatch takes a snapshot of the list without holding the
+  // lock, so callbacks may add or remove subscribers
+  std::mutex                            subscribers_mutex_;
+  std::shared_ptr<const SubscriberList> subscribers_;
+  uint32_t                              next_subscriber_id_;
+  Metrics::Counter*                     notifications_received_;
+  Metrics::Counter*                     notifications_dropped_;
+  std::atomic<bool>                     active_;
 
   // D-Bus signal handler
   static void on_properties_changed(GDBusConnection* connection,
@@ -23,18 +42,45 @@ private:
   void handle_properties_changed(GVariant* changed_properties);
 
 public:
+  // Notifications are dispatched on `context`, or on the thread-default
+  // context of the constructing thread when it is null. Metrics are
+  // labelled by the characteristic's UUID, which unlike its path stays the
+  // same across devices.
   NotificationHandler(GDBusConnection*   connection,
-                      const std::string& characteristic_path);
+                      const std::string& characteristic_path,
+                      const std::string& uuid,
+                      GMainContext*      context = nullptr);
   ~NotificationHandler();
 
-  // Enable/disable notifications
-  bool enable_notifications(NotificationCallback callback);
+  // Enable/disable the signal subscription; disabling also drops every
+  // subscriber. Both wait for the context's thread (Utils::invoke_sync()), so
+  // they must not be called holding a lock that a notification callback may
+  // take.
+  bool enable_notifications();
   bool disable_notifications();
 
+  // Subscribers are identified by the returned id (never 0). A subscriber
+  // removed while a notification is being dispatched may still receive that
+  // one notification.
+  uint32_t add_subscriber(NotificationCallback callback);
+  bool     remove_subscriber(uint32_t id);
+  size_t   get_subscriber_count();
+
   // Properties
   const std::string& get_characteristic_path() const
   {
     return characteristic_path_;
   }
   bool is_enabled() const { return properties_changed_subscription_ != 0; }
+  // Whether bluetoothd is sending values: StartNotify succeeded on the
+  // current link. A dropped link makes the subscription inactive but keeps
+  // its subscribers, for StartNotify to be sent again.
+  bool is_active() const { return active_.load(std::memory_order_acquire); }
+  void set_active(bool active)
+  {
+    active_.store(active, std::memory_order_release);
+  }
+
+  // Notifications received by every handler in the process
+  static uint64_t get_total_received();
 };
\ No newline at end of file
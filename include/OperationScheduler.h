@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include "Common.h"
+#include "Metrics.h"
+
+// Priority classes, most urgent first
+enum class OperationPriority
+{
+  Interactive,  // user-facing requests and alarm acknowledgements
+  Control,      // control loop reads and writes
+  Bulk,         // large transfers
+  Background,   // snapshots, polling
+};
+
+struct SchedulerConfig
+{
+  // Operations running at once; 1 serializes the device completely
+  size_t max_in_flight = 4;
+  // Starvation protection: a queued operation is promoted one class for
+  // every period it has waited (0: strict priority)
+  std::chrono::milliseconds aging_period{250};
+};
+
+// Orders the GATT operations of one device by priority class, FIFO within a
+// class, with a limited number in flight. Operations that need a slot call
+// submit() or the blocking acquire(), and release() once they finish.
+class OperationScheduler
+{
+public:
+  // `granted` is false when the scheduler shut down before a slot was
+  // free; the operation must then fail without calling release()
+  using Start = std::function<void(bool granted)>;
+
+  static constexpr size_t CLASS_COUNT = 4;
+
+  // Blocking acquires iterate `context` when no one else does, so replies
+  // that free slots keep arriving; `label` names the adapter in metrics,
+  // which its devices' schedulers add up in
+  OperationScheduler(const std::string& label, GMainContext* context);
+  ~OperationScheduler();
+
+  void            set_config(const SchedulerConfig& config);
+  SchedulerConfig get_config();
+
+  // Runs `start` as soon as a slot is granted: right away on the calling
+  // thread, or later on the thread whose release() frees the slot
+  void submit(OperationPriority priority, Start start);
+  // Blocks until a slot is granted; false after shutdown(). On the thread
+  // that owns the context it never waits: waiting would mean dispatching
+  // the context's other callbacks from inside the caller's, so it fails
+  // unless a slot is free right away.
+  bool acquire(OperationPriority priority);
+  void release();
+  // Fails every queued operation, and every later one, with granted=false.
+  // Called when the device goes away; operations in flight are unaffected.
+  void shutdown();
+
+  size_t get_queue_depth(OperationPriority priority);
+  size_t get_in_flight();
+
+  static const char* priority_name(OperationPriority priority);
+
+private:
+  struct Waiter
+  {
+    Start                                 start;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  struct ClassQueue
+  {
+    std::deque<Waiter>  waiters;
+    Metrics::Gauge*     depth;
+    Metrics::Histogram* wait_time;
+  };
+
+  GMainContext*                       context_;
+  std::mutex                          mutex_;
+  std::condition_variable             granted_cv_;
+  SchedulerConfig                     config_;
+  size_t                              in_flight_;
+  bool                                shut_down_;
+  std::array<ClassQueue, CLASS_COUNT> queues_;
+
+  // Pops the waiters that may start now; they are started after unlocking
+  void dispatch_locked(std::vector<Start>& ready);
+};
+
+// Releases a slot taken with acquire() when it goes out of scope
+class ScopedOperation
+{
+public:
+  ScopedOperation(const std::shared_ptr<OperationScheduler>& scheduler,
+                  OperationPriority                          priority)
+    : scheduler_(scheduler)
+    , granted_(scheduler_->acquire(priority))
+  {
+  }
+  ~ScopedOperation()
+  {
+    if (granted_)
+    {
+      scheduler_->release();
+    }
+  }
+
+  // False if acquire() failed; the operation must not run
+  bool granted() const { return granted_; }
+
+  ScopedOperation(const ScopedOperation&)            = delete;
+  ScopedOperation& operator=(const ScopedOperation&) = delete;
+
+private:
+  std::shared_ptr<OperationScheduler> scheduler_;
+  bool                                granted_;
+};
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include "Common.h"
+
+namespace Tracing
+{
+constexpr size_t EVENTS_PER_THREAD = 8192;  // must be a power of 2
+constexpr size_t MAX_DETAIL_LENGTH = 63;
+
+struct Event
+{
+  const char* category;  // static strings only
+  const char* name;
+  int64_t     begin_us;
+  int64_t     end_us;
+  char        detail[MAX_DETAIL_LENGTH + 1];
+};
+
+extern std::atomic<bool> enabled_flag;
+
+inline bool is_enabled()
+{
+  return enabled_flag.load(std::memory_order_relaxed);
+}
+void set_enabled(bool enabled);
+
+// Drop everything recorded so far. Safe while other threads record spans.
+void clear();
+
+// Write all buffered spans as Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev). Safe while other threads record spans: a span being
+// written, or overwritten by a newer one, while it is copied is skipped.
+bool write_chrome_trace(const std::string& path);
+
+// Records [construction, destruction) into the calling thread's ring buffer.
+// When tracing is disabled the constructor only reads one relaxed atomic.
+class Span
+{
+public:
+  Span(const char* category, const char* name, const char* detail = nullptr)
+    : category_(category), name_(name), begin_us_(0)
+  {
+    if (is_enabled())
+    {
+      if (detail)
+      {
+        detail_ = detail;
+      }
+      begin_us_ = g_get_monotonic_time();
+    }
+  }
+  Span(const char* category, const char* name, const std::string& detail)
+    : category_(category), name_(name), begin_us_(0)
+  {
+    if (is_enabled())
+    {
+      detail_   = detail;
+      begin_us_ = g_get_monotonic_time();
+    }
+  }
+  ~Span()
+  {
+    if (begin_us_ != 0)
+    {
+      record(
+        category_, name_, detail_.c_str(), begin_us_, g_get_monotonic_time());
+    }
+  }
+
+  Span(const Span&)            = delete;
+  Span& operator=(const Span&) = delete;
+
+private:
+  friend class AsyncSpan;
+
+  const char* category_;
+  const char* name_;
+  std::string detail_;
+  int64_t     begin_us_;
+
+  static void record(const char* category,
+                     const char* name,
+                     const char* detail,
+                     int64_t     begin_us,
+                     int64_t     end_us);
+};
+
+// A span of an asynchronous operation: from construction until end(),
+// called where the operation completes, typically in its reply handler and
+// on another thread. Copyable so that handlers can capture it; only the
+// first end() of a copy is recorded, so end exactly one of them.
+class AsyncSpan
+{
+public:
+  // Records nothing; to be assigned a started span
+  AsyncSpan() : category_(nullptr), name_(nullptr), begin_us_(0) {}
+  AsyncSpan(const char* category, const char* name, const std::string& detail)
+    : category_(category), name_(name), begin_us_(0)
+  {
+#ifndef BSCM_DISABLE_TRACING
+    if (is_enabled())
+    {
+      detail_   = detail;
+      begin_us_ = g_get_monotonic_time();
+    }
+#else
+    (void)detail;
+#endif
+  }
+
+  void end()
+  {
+    if (begin_us_ != 0)
+    {
+      Span::record(
+        category_, name_, detail_.c_str(), begin_us_, g_get_monotonic_time());
+      begin_us_ = 0;
+    }
+  }
+
+private:
+  const char* category_;
+  const char* name_;
+  std::string detail_;
+  int64_t     begin_us_;
+};
+}  // namespace Tracing
+
+// Build with -DBSCM_DISABLE_TRACING to remove spans from the binary
+#define BSCM_TRACE_CONCAT_INNER(a, b) a##b
+#define BSCM_TRACE_CONCAT(a, b)       BSCM_TRACE_CONCAT_INNER(a, b)
+#ifdef BSCM_DISABLE_TRACING
+#define TRACE_SPAN(...) \
+  do                    \
+  {                     \
+  } while (0)
+#else
+#define TRACE_SPAN(...) \
+  Tracing::Span BSCM_TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#endif
\ No newline at end of file
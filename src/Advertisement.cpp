@@ -0,0 +1,180 @@
+#include "Advertisement.h"
+#include <cstring>
+
+namespace
+{
+// Copy an "ay" variant into a fixed buffer, returning the stored length
+uint8_t copy_byte_array(GVariant* value,
+                        uint8_t (&out)[AdvertisementData::MAX_DATA_LENGTH],
+                        bool& truncated)
+{
+  if (!g_variant_is_of_type(value, G_VARIANT_TYPE_BYTESTRING))
+    return 0;
+
+  gsize         length;
+  const guchar* bytes = reinterpret_cast<const guchar*>(
+    g_variant_get_fixed_array(value, &length, sizeof(guchar)));
+
+  if (length > AdvertisementData::MAX_DATA_LENGTH)
+  {
+    truncated = true;
+    length    = AdvertisementData::MAX_DATA_LENGTH;
+  }
+
+  if (length > 0)
+  {
+    std::memcpy(out, bytes, length);
+  }
+  return static_cast<uint8_t>(length);
+}
+
+void parse_manufacturer_data(GVariant* dict, AdvertisementData& data)
+{
+  if (!g_variant_is_of_type(dict, G_VARIANT_TYPE("a{qv}")))
+    return;
+
+  GVariantIter iter;
+  g_variant_iter_init(&iter, dict);
+
+  guint16   company_id;
+  GVariant* value;
+
+  data.manufacturer_count = 0;
+  while (g_variant_iter_loop(&iter, "{qv}", &company_id, &value))
+  {
+    if (data.manufacturer_count >= AdvertisementData::MAX_MANUFACTURER_ENTRIES)
+    {
+      data.truncated = true;
+      continue;
+    }
+
+    auto& entry      = data.manufacturer[data.manufacturer_count++];
+    entry.company_id = company_id;
+    entry.length     = copy_byte_array(value, entry.data, data.truncated);
+  }
+}
+
+void parse_service_data(GVariant* dict, AdvertisementData& data)
+{
+  if (!g_variant_is_of_type(dict, G_VARIANT_TYPE("a{sv}")))
+    return;
+
+  GVariantIter iter;
+  g_variant_iter_init(&iter, dict);
+
+  const gchar* uuid;
+  GVariant*    value;
+
+  data.service_count = 0;
+  while (g_variant_iter_loop(&iter, "{&sv}", &uuid, &value))
+  {
+    if (data.service_count >= AdvertisementData::MAX_SERVICE_ENTRIES)
+    {
+      data.truncated = true;
+      continue;
+    }
+
+    auto& entry = data.service[data.service_count++];
+    g_strlcpy(entry.uuid, uuid, sizeof(entry.uuid));
+    entry.length = copy_byte_array(value, entry.data, data.truncated);
+  }
+}
+}  // namespace
+
+const AdvertisementData::ManufacturerEntry* AdvertisementData::find_manufacturer(
+  uint16_t company_id) const
+{
+  for (uint8_t i = 0; i < manufacturer_count; ++i)
+  {
+    if (manufacturer[i].company_id == company_id)
+    {
+      return &manufacturer[i];
+    }
+  }
+  return nullptr;
+}
+
+const AdvertisementData::ServiceEntry* AdvertisementData::find_service(
+  const char* uuid) const
+{
+  for (uint8_t i = 0; i < service_count; ++i)
+  {
+    if (g_ascii_strcasecmp(service[i].uuid, uuid) == 0)
+    {
+      return &service[i];
+    }
+  }
+  return nullptr;
+}
+
+namespace Advertisement
+{
+
+bool address_from_object_path(
+  const char* object_path,
+  char (&address)[AdvertisementData::ADDRESS_LENGTH + 1])
+{
+  const char* dev = object_path ? std::strstr(object_path, "/dev_") : nullptr;
+  if (!dev)
+    return false;
+
+  dev += 5;
+  if (std::strlen(dev) < AdvertisementData::ADDRESS_LENGTH)
+    return false;
+
+  for (size_t i = 0; i < AdvertisementData::ADDRESS_LENGTH; ++i)
+  {
+    address[i] = (dev[i] == '_') ? ':' : dev[i];
+  }
+  address[AdvertisementData::ADDRESS_LENGTH] = '\0';
+  return true;
+}
+
+bool parse_properties(GVariant* properties, AdvertisementData& data)
+{
+  if (!properties)
+    return false;
+
+  GVariantIter iter;
+  g_variant_iter_init(&iter, properties);
+
+  const gchar* key;
+  GVariant*    value;
+
+  data.changed = 0;
+  while (g_variant_iter_loop(&iter, "{&sv}", &key, &value))
+  {
+    if (g_strcmp0(key, "RSSI") == 0 &&
+        g_variant_is_of_type(value, G_VARIANT_TYPE_INT16))
+    {
+      data.rssi     = g_variant_get_int16(value);
+      data.has_rssi = true;
+      data.changed |= AdvertisementData::CHANGED_RSSI;
+    }
+    else if (g_strcmp0(key, "TxPower") == 0 &&
+             g_variant_is_of_type(value, G_VARIANT_TYPE_INT16))
+    {
+      data.tx_power     = g_variant_get_int16(value);
+      data.has_tx_power = true;
+      data.changed |= AdvertisementData::CHANGED_TX_POWER;
+    }
+    else if (g_strcmp0(key, "ManufacturerData") == 0)
+    {
+      parse_manufacturer_data(value, data);
+      data.changed |= AdvertisementData::CHANGED_MANUFACTURER_DATA;
+    }
+    else if (g_strcmp0(key, "ServiceData") == 0)
+    {
+      parse_service_data(value, data);
+      data.changed |= AdvertisementData::CHANGED_SERVICE_DATA;
+    }
+  }
+
+  if (data.changed)
+  {
+    data.timestamp = std::chrono::steady_clock::now();
+  }
+  return data.changed != 0;
+}
+
+}  // namespace Advertisement
\ No newline at end of file
@@ -0,0 +1,551 @@
+#include "AdvertisementMonitor.h"
+#include "Advertisement.h"
+#include "DBusCall.h"
+#include "Logger.h"
+#include <algorithm>
+
+namespace
+{
+const char* const INTROSPECTION_XML =
+  "<node>"
+  "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+  "    <method name='GetManagedObjects'>"
+  "      <arg type='a{oa{sa{sv}}}' name='objects' direction='out'/>"
+  "    </method>"
+  "    <signal name='InterfacesAdded'>"
+  "      <arg type='o' name='object'/>"
+  "      <arg type='a{sa{sv}}' name='interfaces'/>"
+  "    </signal>"
+  "    <signal name='InterfacesRemoved'>"
+  "      <arg type='o' name='object'/>"
+  "      <arg type='as' name='interfaces'/>"
+  "    </signal>"
+  "  </interface>"
+  "  <interface name='org.bluez.AdvertisementMonitor1'>"
+  "    <method name='Release'/>"
+  "    <method name='Activate'/>"
+  "    <method name='DeviceFound'>"
+  "      <arg type='o' name='device' direction='in'/>"
+  "    </method>"
+  "    <method name='DeviceLost'>"
+  "      <arg type='o' name='device' direction='in'/>"
+  "    </method>"
+  "    <property name='Type' type='s' access='read'/>"
+  "    <property name='RSSIHighThreshold' type='n' access='read'/>"
+  "    <property name='RSSIHighTimeout' type='q' access='read'/>"
+  "    <property name='RSSILowThreshold' type='n' access='read'/>"
+  "    <property name='RSSILowTimeout' type='q' access='read'/>"
+  "    <property name='RSSISamplingPeriod' type='q' access='read'/>"
+  "    <property name='Patterns' type='a(yyay)' access='read'/>"
+  "  </interface>"
+  "</node>";
+
+// Parsed once; interfaces[0] is the ObjectManager, [1] the monitor
+GDBusNodeInfo* introspection_data()
+{
+  static GDBusNodeInfo* info =
+    g_dbus_node_info_new_for_xml(INTROSPECTION_XML, nullptr);
+  return info;
+}
+}  // namespace
+
+const GDBusInterfaceVTable AdvertisementMonitor::vtable_ = {
+  on_method_call, on_get_property, nullptr, {}};
+
+AdvertisementMonitor::AdvertisementMonitor(GDBusConnection*   connection,
+                                           const std::string& root_path,
+                                           GMainContext*      context)
+  : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
+  , root_path_(root_path)
+  , root_registration_(0)
+  , next_id_(1)
+  , lifetime_(std::make_shared<int>(0))
+{
+  auto& registry = Metrics::Registry::instance();
+  devices_found_ = &registry.counter("bscm_monitor_events_total",
+                                     "Advertisement monitor device events",
+                                     {{"event", "found"}});
+  devices_lost_  = &registry.counter("bscm_monitor_events_total",
+                                    "Advertisement monitor device events",
+                                    {{"event", "lost"}});
+
+  if (connection_)
+  {
+    g_object_ref(connection_);
+  }
+}
+
+AdvertisementMonitor::~AdvertisementMonitor()
+{
+  std::set<std::string> adapters;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    adapters = adapters_;
+  }
+  for (const auto& adapter_path : adapters)
+  {
+    unregister_from_adapter(adapter_path);
+  }
+
+  // Method calls and replies are dispatched on the context, so once this
+  // has run there, none of them can reach the object any more
+  Utils::invoke_sync(context_,
+                     [this]
+                     {
+                       lifetime_.reset();
+                       if (!connection_)
+                         return;
+
+                       for (const auto& pair : monitors_)
+                       {
+                         g_dbus_connection_unregister_object(
+                           connection_, pair.second->registration);
+                       }
+                       if (root_registration_)
+                       {
+                         g_dbus_connection_unregister_object(
+                           connection_, root_registration_);
+                       }
+                     });
+
+  if (connection_)
+  {
+    g_object_unref(connection_);
+  }
+  g_main_context_unref(context_);
+}
+
+uint32_t AdvertisementMonitor::add_monitor(const MonitorConfig& config,
+                                           MonitorCallback      on_found,
+                                           MonitorCallback      on_lost)
+{
+  if (!connection_)
+    return 0;
+
+  if (config.patterns.empty())
+  {
+    LOG_ERROR("Advertisement monitor needs at least one pattern");
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!root_registration_ && !export_root())
+    return 0;
+
+  auto monitor      = std::make_shared<Monitor>();
+  monitor->id       = next_id_++;
+  monitor->path     = root_path_ + "/monitor" + std::to_string(monitor->id);
+  monitor->config   = config;
+  monitor->on_found = std::move(on_found);
+  monitor->on_lost  = std::move(on_lost);
+
+  // Method calls from bluetoothd are dispatched on the context that is
+  // thread-default while registering
+  GError*                  error = nullptr;
+  Utils::ScopedMainContext scope(context_);
+  monitor->registration =
+    g_dbus_connection_register_object(connection_,
+                                      monitor->path.c_str(),
+                                      introspection_data()->interfaces[1],
+                                      &vtable_,
+                                      this,
+                                      nullptr,
+                                      &error);
+  if (!monitor->registration)
+  {
+    if (error)
+    {
+      LOG_ERROR("Failed to export " + monitor->path + ": " +
+                std::string(error->message));
+      g_error_free(error);
+    }
+    return 0;
+  }
+
+  monitors_.emplace(monitor->path, monitor);
+
+  // Adapters we are already registered with pick it up from the signal
+  if (!adapters_.empty())
+  {
+    GVariantBuilder interfaces;
+    g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_variant_builder_add(&interfaces,
+                          "{s@a{sv}}",
+                          BlueZ::ADVERTISEMENT_MONITOR_INTERFACE,
+                          monitor_properties(config));
+    emit_object_manager_signal(
+      "InterfacesAdded",
+      g_variant_new("(o@a{sa{sv}})",
+                    monitor->path.c_str(),
+                    g_variant_builder_end(&interfaces)));
+  }
+
+  LOG_INFO("Advertisement monitor " + std::to_string(monitor->id) +
+           " added with " + std::to_string(config.patterns.size()) +
+           " pattern(s)");
+  return monitor->id;
+}
+
+bool AdvertisementMonitor::remove_monitor(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto                        it =
+    std::find_if(monitors_.begin(),
+                 monitors_.end(),
+                 [id](const auto& pair) { return pair.second->id == id; });
+  if (it == monitors_.end())
+    return false;
+
+  if (!adapters_.empty())
+  {
+    const gchar* interfaces[] = {BlueZ::ADVERTISEMENT_MONITOR_INTERFACE,
+                                 nullptr};
+    emit_object_manager_signal(
+      "InterfacesRemoved",
+      g_variant_new("(o^as)", it->first.c_str(), interfaces));
+  }
+
+  g_dbus_connection_unregister_object(connection_, it->second->registration);
+  monitors_.erase(it);
+
+  LOG_INFO("Advertisement monitor " + std::to_string(id) + " removed");
+  return true;
+}
+
+size_t AdvertisementMonitor::get_monitor_count()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return monitors_.size();
+}
+
+void AdvertisementMonitor::register_with_adapter(
+  const std::string& adapter_path)
+{
+  if (!connection_)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!root_registration_ && !export_root())
+      return;
+    if (!adapters_.insert(adapter_path).second)
+      return;
+  }
+
+  std::weak_ptr<void>           alive = lifetime_;
+  static const DBusCall::Method register_monitor_call{
+    "AdvertisementMonitor",
+    BlueZ::ADVERTISEMENT_MONITOR_MANAGER_INTERFACE,
+    "RegisterMonitor"};
+  DBusCall::call(connection_,
+                 adapter_path.c_str(),
+                 register_monitor_call,
+                 g_variant_new("(o)", root_path_.c_str()),
+                 nullptr,
+                 -1,
+                 [this, alive, adapter_path](GVariant* reply, GError* error)
+                 {
+                   (void)reply;
+                   if (error)
+                   {
+                     LOG_ERROR("RegisterMonitor failed on " + adapter_path +
+                               ": " + error->message);
+                     // Not registered after all, so a later call retries
+                     if (!alive.expired())
+                     {
+                       std::lock_guard<std::mutex> lock(mutex_);
+                       adapters_.erase(adapter_path);
+                     }
+                     return;
+                   }
+                   LOG_INFO("Advertisement monitors registered with " +
+                            adapter_path);
+                 },
+                 nullptr,
+                 context_);
+}
+
+void AdvertisementMonitor::unregister_from_adapter(
+  const std::string& adapter_path)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connection_ || !adapters_.erase(adapter_path))
+      return;
+  }
+
+  // The handler must not touch this object, which may be gone by then
+  static const DBusCall::Method unregister_monitor_call{
+    "AdvertisementMonitor",
+    BlueZ::ADVERTISEMENT_MONITOR_MANAGER_INTERFACE,
+    "UnregisterMonitor"};
+  DBusCall::call(connection_,
+                 adapter_path.c_str(),
+                 unregister_monitor_call,
+                 g_variant_new("(o)", root_path_.c_str()),
+                 nullptr,
+                 -1,
+                 [adapter_path](GVariant* reply, GError* error)
+                 {
+                   (void)reply;
+                   if (error)
+                   {
+                     LOG_DEBUG("UnregisterMonitor failed on " + adapter_path +
+                               ": " + error->message);
+                   }
+                 },
+                 nullptr,
+                 context_);
+}
+
+bool AdvertisementMonitor::export_root()
+{
+  GError*                  error = nullptr;
+  Utils::ScopedMainContext scope(context_);
+  root_registration_ =
+    g_dbus_connection_register_object(connection_,
+                                      root_path_.c_str(),
+                                      introspection_data()->interfaces[0],
+                                      &vtable_,
+                                      this,
+                                      nullptr,
+                                      &error);
+  if (!root_registration_)
+  {
+    if (error)
+    {
+      LOG_ERROR("Failed to export " + root_path_ + ": " +
+                std::string(error->message));
+      g_error_free(error);
+    }
+    return false;
+  }
+  return true;
+}
+
+void AdvertisementMonitor::emit_object_manager_signal(const char* signal_name,
+                                                      GVariant*   parameters)
+{
+  GError* error = nullptr;
+  if (!g_dbus_connection_emit_signal(connection_,
+                                     nullptr,
+                                     root_path_.c_str(),
+                                     BlueZ::OBJECT_MANAGER_INTERFACE,
+                                     signal_name,
+                                     parameters,
+                                     &error))
+  {
+    LOG_ERROR("Failed to emit " + std::string(signal_name) + ": " +
+              std::string(error->message));
+    g_error_free(error);
+  }
+}
+
+GVariant* AdvertisementMonitor::monitor_properties(const MonitorConfig& config)
+{
+  GVariantBuilder patterns;
+  g_variant_builder_init(&patterns, G_VARIANT_TYPE("a(yyay)"));
+  for (const auto& pattern : config.patterns)
+  {
+    g_variant_builder_add(
+      &patterns,
+      "(yy@ay)",
+      pattern.start_position,
+      pattern.ad_type,
+      g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                pattern.content.data(),
+                                pattern.content.size(),
+                                sizeof(uint8_t)));
+  }
+
+  GVariantBuilder properties;
+  g_variant_builder_init(&properties, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add(
+    &properties, "{sv}", "Type", g_variant_new_string("or_patterns"));
+  g_variant_builder_add(
+    &properties, "{sv}", "Patterns", g_variant_builder_end(&patterns));
+
+  // Unset values are left out so bluetoothd uses its defaults
+  if (config.rssi_high_threshold != MonitorConfig::RSSI_UNSET)
+  {
+    g_variant_builder_add(&properties,
+                          "{sv}",
+                          "RSSIHighThreshold",
+                          g_variant_new_int16(config.rssi_high_threshold));
+  }
+  if (config.rssi_high_timeout)
+  {
+    g_variant_builder_add(&properties,
+                          "{sv}",
+                          "RSSIHighTimeout",
+                          g_variant_new_uint16(config.rssi_high_timeout));
+  }
+  if (config.rssi_low_threshold != MonitorConfig::RSSI_UNSET)
+  {
+    g_variant_builder_add(&properties,
+                          "{sv}",
+                          "RSSILowThreshold",
+                          g_variant_new_int16(config.rssi_low_threshold));
+  }
+  if (config.rssi_low_timeout)
+  {
+    g_variant_builder_add(&properties,
+                          "{sv}",
+                          "RSSILowTimeout",
+                          g_variant_new_uint16(config.rssi_low_timeout));
+  }
+  if (config.rssi_sampling_period != MonitorConfig::SAMPLING_PERIOD_UNSET)
+  {
+    g_variant_builder_add(&properties,
+                          "{sv}",
+                          "RSSISamplingPeriod",
+                          g_variant_new_uint16(config.rssi_sampling_period));
+  }
+
+  return g_variant_builder_end(&properties);
+}
+
+GVariant* AdvertisementMonitor::get_managed_objects()
+{
+  GVariantBuilder objects;
+  g_variant_builder_init(&objects, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& pair : monitors_)
+  {
+    GVariantBuilder interfaces;
+    g_variant_builder_init(&interfaces, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_variant_builder_add(&interfaces,
+                          "{s@a{sv}}",
+                          BlueZ::ADVERTISEMENT_MONITOR_INTERFACE,
+                          monitor_properties(pair.second->config));
+    g_variant_builder_add(&objects,
+                          "{o@a{sa{sv}}}",
+                          pair.first.c_str(),
+                          g_variant_builder_end(&interfaces));
+  }
+
+  return g_variant_new("(@a{oa{sa{sv}}})", g_variant_builder_end(&objects));
+}
+
+void AdvertisementMonitor::on_method_call(
+  GDBusConnection*       connection,
+  const gchar*           sender,
+  const gchar*           object_path,
+  const gchar*           interface_name,
+  const gchar*           method_name,
+  GVariant*              parameters,
+  GDBusMethodInvocation* invocation,
+  gpointer               user_data)
+{
+  (void)connection;
+  (void)sender;
+  (void)interface_name;
+
+  AdvertisementMonitor* monitor = static_cast<AdvertisementMonitor*>(user_data);
+
+  if (g_strcmp0(method_name, "GetManagedObjects") == 0)
+  {
+    g_dbus_method_invocation_return_value(invocation,
+                                          monitor->get_managed_objects());
+    return;
+  }
+
+  bool found = g_strcmp0(method_name, "DeviceFound") == 0;
+  if (found || g_strcmp0(method_name, "DeviceLost") == 0)
+  {
+    monitor->handle_device_event(object_path, found, parameters);
+  }
+  else if (g_strcmp0(method_name, "Activate") == 0)
+  {
+    LOG_DEBUG(std::string("Advertisement monitor active: ") + object_path);
+  }
+  else if (g_strcmp0(method_name, "Release") == 0)
+  {
+    LOG_DEBUG(std::string("Advertisement monitor released: ") + object_path);
+  }
+
+  g_dbus_method_invocation_return_value(invocation, nullptr);
+}
+
+GVariant* AdvertisementMonitor::on_get_property(
+  GDBusConnection* connection,
+  const gchar*     sender,
+  const gchar*     object_path,
+  const gchar*     interface_name,
+  const gchar*     property_name,
+  GError**         error,
+  gpointer         user_data)
+{
+  (void)connection;
+  (void)sender;
+  (void)interface_name;
+
+  AdvertisementMonitor* monitor = static_cast<AdvertisementMonitor*>(user_data);
+
+  GVariant* properties = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(monitor->mutex_);
+    auto                        it = monitor->monitors_.find(object_path);
+    if (it != monitor->monitors_.end())
+    {
+      properties =
+        g_variant_ref_sink(monitor->monitor_properties(it->second->config));
+    }
+  }
+
+  GVariant* value =
+    properties ? g_variant_lookup_value(properties, property_name, nullptr)
+               : nullptr;
+  if (properties)
+  {
+    g_variant_unref(properties);
+  }
+
+  // Unset optional properties are reported as absent
+  if (!value)
+  {
+    g_set_error(error,
+                G_DBUS_ERROR,
+                G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                "Property %s is not set",
+                property_name);
+  }
+  return value;
+}
+
+void AdvertisementMonitor::handle_device_event(const std::string& object_path,
+                                               bool               found,
+                                               GVariant*          parameters)
+{
+  const gchar* device_path = nullptr;
+  g_variant_get(parameters, "(&o)", &device_path);
+
+  std::shared_ptr<Monitor> monitor;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto                        it = monitors_.find(object_path);
+    if (it == monitors_.end())
+      return;
+    monitor = it->second;
+  }
+
+  (found ? devices_found_ : devices_lost_)->increment();
+
+  char address[AdvertisementData::ADDRESS_LENGTH + 1];
+  if (!Advertisement::address_from_object_path(device_path, address))
+    return;
+
+  LOG_DEBUG(std::string(found ? "Monitor found " : "Monitor lost ") +
+            address + " (monitor " + std::to_string(monitor->id) + ")");
+
+  // Callbacks run without the lock so they may add or remove monitors
+  const MonitorCallback& callback = found ? monitor->on_found
+                                          : monitor->on_lost;
+  if (callback)
+  {
+    callback(address, device_path);
+  }
+}
\ No newline at end of file
@@ -1,11 +1,68 @@
 #include "BluetoothDevice.h"
+#include <algorithm>
+#include "Advertisement.h"
+#include "DBusCall.h"
+#include "Logger.h"
+#include "ManagedObjects.h"
+#include "Metrics.h"
+#include "Tracing.h"
+
+namespace
+{
+void record_link_operation(const char*                           operation,
+                           bool                                  success,
+                           std::chrono::steady_clock::time_point start)
+{
+  Metrics::Registry::instance()
+    .histogram("bscm_link_operation_duration_seconds",
+               "Connect/disconnect time including state confirmation",
+               {{"operation", operation},
+                {"outcome", success ? "ok" : "error"}})
+    .observe_since(start);
+}
+
+// Scheduler metrics are per adapter, so they stay bounded as devices come
+// and go
+std::string adapter_path_of(const std::string& device_path)
+{
+  return device_path.substr(0, device_path.find("/dev_"));
+}
+
+void report_not_found(BluezError* error, const std::string& char_uuid)
+{
+  if (error)
+  {
+    error->code     = BluezErrorCode::DoesNotExist;
+    error->message  = "Characteristic not found: " + char_uuid;
+    error->attempts = 0;
+  }
+}
+
+void report_no_slot(BluezError* error)
+{
+  LOG_WARNING("No free operation slot on the device's context thread");
+  if (error)
+  {
+    error->code     = BluezErrorCode::InProgress;
+    error->message  = "Every operation slot is busy and waiting would block "
+                      "the device's context";
+    error->attempts = 0;
+  }
+}
+}  // namespace
 
 BluetoothDevice::BluetoothDevice(GDBusConnection*   connection,
-                                 const std::string& object_path)
+                                 const std::string& object_path,
+                                 GMainContext*      context)
   : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
   , object_path_(object_path)
   , connected_(false)
   , services_resolved_(false)
+  , scheduler_(std::make_shared<OperationScheduler>(
+      adapter_path_of(object_path), context_))
+  , cancel_group_(std::make_shared<DBusCall::CancelGroup>())
 {
   if (connection_)
   {
@@ -14,8 +71,32 @@ BluetoothDevice::BluetoothDevice(GDBusConnection*   connection,
   update_properties();
 }
 
+BluetoothDevice::BluetoothDevice(GDBusConnection*   connection,
+                                 const std::string& object_path,
+                                 GVariant*          properties,
+                                 GMainContext*      context)
+  : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
+  , object_path_(object_path)
+  , connected_(false)
+  , services_resolved_(false)
+  , scheduler_(std::make_shared<OperationScheduler>(
+      adapter_path_of(object_path), context_))
+  , cancel_group_(std::make_shared<DBusCall::CancelGroup>())
+{
+  if (connection_)
+  {
+    g_object_ref(connection_);
+  }
+  load_properties(properties);
+}
+
 BluetoothDevice::~BluetoothDevice()
 {
+  // Queued operations fail now instead of running against a dead device
+  scheduler_->shutdown();
+  cancel_group_->cancel();
   if (connected_)
   {
     disconnect();
@@ -25,92 +106,132 @@ BluetoothDevice::~BluetoothDevice()
   {
     g_object_unref(connection_);
   }
+  g_main_context_unref(context_);
 }
 
 void BluetoothDevice::update_properties()
 {
-  // Get basic device properties
-  auto address_var = get_property(BlueZ::DEVICE_INTERFACE, "Address");
-  if (address_var)
+  // One GetAll instead of a Get per property
+  GVariant* properties = get_all_properties(BlueZ::DEVICE_INTERFACE);
+  if (properties)
   {
-    address_ = g_variant_get_string(address_var, nullptr);
-    g_variant_unref(address_var);
+    load_properties(properties);
+    g_variant_unref(properties);
   }
+}
 
-  auto name_var = get_property(BlueZ::DEVICE_INTERFACE, "Name");
-  if (name_var)
+void BluetoothDevice::load_properties(GVariant* properties)
+{
+  // Get basic device properties
+  const gchar* value;
+  if (g_variant_lookup(properties, "Address", "&s", &value))
   {
-    name_ = g_variant_get_string(name_var, nullptr);
-    g_variant_unref(name_var);
+    address_ = value;
   }
-  else
+  else if (address_.empty())
   {
-    // Fallback to alias if name is not available
-    auto alias_var = get_property(BlueZ::DEVICE_INTERFACE, "Alias");
-    if (alias_var)
-    {
-      name_ = g_variant_get_string(alias_var, nullptr);
-      g_variant_unref(alias_var);
-    }
-    else
+    // Changed properties alone carry no address, but the path does
+    char address[AdvertisementData::ADDRESS_LENGTH + 1];
+    if (Advertisement::address_from_object_path(object_path_.c_str(), address))
     {
-      name_ = "Unknown Device";
+      address_ = address;
     }
   }
 
-  auto connected_var = get_property(BlueZ::DEVICE_INTERFACE, "Connected");
-  if (connected_var)
+  // Fallback to alias if name is not available
+  if (g_variant_lookup(properties, "Name", "&s", &value) ||
+      g_variant_lookup(properties, "Alias", "&s", &value))
   {
-    connected_ = g_variant_get_boolean(connected_var);
-    g_variant_unref(connected_var);
+    name_ = value;
+  }
+  else if (name_.empty())
+  {
+    name_ = "Unknown Device";
   }
 
-  auto services_resolved_var =
-    get_property(BlueZ::DEVICE_INTERFACE, "ServicesResolved");
-  if (services_resolved_var)
+  gboolean flag;
+  if (g_variant_lookup(properties, "Connected", "b", &flag))
   {
-    services_resolved_ = g_variant_get_boolean(services_resolved_var);
-    g_variant_unref(services_resolved_var);
+    connected_ = flag;
+  }
+
+  if (g_variant_lookup(properties, "ServicesResolved", "b", &flag))
+  {
+    services_resolved_ = flag;
   }
 
   // Get service UUIDs
-  auto uuids_var = get_property(BlueZ::DEVICE_INTERFACE, "UUIDs");
-  if (uuids_var)
+  GVariantIter* uuids_iter;
+  if (g_variant_lookup(properties, "UUIDs", "as", &uuids_iter))
   {
     service_uuids_.clear();
 
-    GVariantIter iter;
-    g_variant_iter_init(&iter, uuids_var);
     const gchar* uuid;
-
-    while (g_variant_iter_loop(&iter, "&s", &uuid))
+    while (g_variant_iter_loop(uuids_iter, "&s", &uuid))
     {
       service_uuids_.push_back(uuid);
     }
 
-    g_variant_unref(uuids_var);
+    g_variant_iter_free(uuids_iter);
+  }
+}
+
+GVariant* BluetoothDevice::get_all_properties(const std::string& interface)
+{
+  TRACE_SPAN("device", "get_all_properties", object_path_);
+
+  if (!connection_)
+    return nullptr;
+
+  static const DBusCall::Method get_all_call{
+    "BluetoothDevice", BlueZ::PROPERTIES_INTERFACE, "GetAll"};
+  GError*   error  = nullptr;
+  GVariant* result =
+    DBusCall::call_sync(connection_,
+                        object_path_.c_str(),
+                        get_all_call,
+                        g_variant_new("(s)", interface.c_str()),
+                        G_VARIANT_TYPE("(a{sv})"),
+                        DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                        &error,
+                        cancel_group_->current().get());
+
+  if (!result)
+  {
+    if (error)
+    {
+      g_error_free(error);
+    }
+    return nullptr;
   }
+
+  GVariant* properties;
+  g_variant_get(result, "(@a{sv})", &properties);
+  g_variant_unref(result);
+
+  return properties;
 }
 
 GVariant* BluetoothDevice::get_property(const std::string& interface,
                                         const std::string& property)
 {
+  TRACE_SPAN("device", "get_property", property);
+
   if (!connection_)
     return nullptr;
 
+  static const DBusCall::Method get_call{
+    "BluetoothDevice", BlueZ::PROPERTIES_INTERFACE, "Get"};
   GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(
+  GVariant* result = DBusCall::call_sync(
     connection_,
-    BlueZ::SERVICE_NAME,
     object_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Get",
+    get_call,
     g_variant_new("(ss)", interface.c_str(), property.c_str()),
     G_VARIANT_TYPE("(v)"),
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error,
+    cancel_group_->current().get());
 
   if (!result)
   {
@@ -135,26 +256,24 @@ bool BluetoothDevice::set_property(const std::string& interface,
   if (!connection_)
     return false;
 
+  static const DBusCall::Method set_call{
+    "BluetoothDevice", BlueZ::PROPERTIES_INTERFACE, "Set"};
   GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(
+  GVariant* result = DBusCall::call_sync(
     connection_,
-    BlueZ::SERVICE_NAME,
     object_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Set",
+    set_call,
     g_variant_new("(ssv)", interface.c_str(), property.c_str(), value),
     nullptr,
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error,
+    cancel_group_->current().get());
 
   if (!result)
   {
     if (error)
     {
-      std::cerr << "Failed to set property " << property << ": "
-                << error->message << std::endl;
+      LOG_ERROR("Failed to set property " + property + ": " + error->message);
       g_error_free(error);
     }
     return false;
@@ -164,37 +283,61 @@ bool BluetoothDevice::set_property(const std::string& interface,
   return true;
 }
 
-bool BluetoothDevice::connect()
+bool BluetoothDevice::connect(std::chrono::milliseconds timeout,
+                              BluezError*               error)
 {
+  TRACE_SPAN("device", "connect", object_path_);
+
   if (!connection_ || connected_)
     return connected_;
 
-  GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(connection_,
-                                                 BlueZ::SERVICE_NAME,
-                                                 object_path_.c_str(),
-                                                 BlueZ::DEVICE_INTERFACE,
-                                                 "Connect",
-                                                 nullptr,
-                                                 nullptr,
-                                                 G_DBUS_CALL_FLAGS_NONE,
-                                                 30000,  // 30 second timeout
-                                                 nullptr,
-                                                 &error);
+  auto start = std::chrono::steady_clock::now();
+
+  // Connect attempts often fail transiently (le-connection-abort-by-local,
+  // another connect still in progress)
+  GError*  connect_error = nullptr;
+  unsigned attempts      = 0;
+  bool     success       = run_with_retry(
+    retry_policy_,
+    "Connect",
+    timeout,
+    [&](std::chrono::milliseconds remaining, GError** attempt_error)
+    {
+      static const DBusCall::Method connect_call{
+        "BluetoothDevice", BlueZ::DEVICE_INTERFACE, "Connect"};
+      GVariant* result =
+        DBusCall::call_sync(connection_,
+                            object_path_.c_str(),
+                            connect_call,
+                            nullptr,
+                            nullptr,
+                            DBusCall::timeout_ms(remaining),
+                            attempt_error,
+                            cancel_group_->current().get());
+      if (!result)
+        return false;
+      g_variant_unref(result);
+      return true;
+    },
+    &connect_error,
+    &attempts);
 
-  if (!result)
+  if (error)
   {
-    if (error)
+    *error = BluezError::from(connect_error, attempts);
+  }
+  if (!success)
+  {
+    if (connect_error)
     {
-      std::cerr << "Failed to connect to device: " << error->message
-                << std::endl;
-      g_error_free(error);
+      LOG_ERROR("Failed to connect to device: " +
+                std::string(connect_error->message));
+      g_error_free(connect_error);
     }
+    record_link_operation("connect", false, start);
     return false;
   }
 
-  g_variant_unref(result);
-
   // Wait for connection to be established
   for (int i = 0; i < 50; ++i)
   {
@@ -204,35 +347,99 @@ bool BluetoothDevice::connect()
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
 
+  record_link_operation("connect", connected_, start);
   return connected_;
 }
 
-bool BluetoothDevice::disconnect()
+void BluetoothDevice::connect_async(ConnectCallback           callback,
+                                    std::chrono::milliseconds timeout)
+{
+  if (!connection_ || connected_)
+  {
+    if (callback)
+    {
+      callback(connected_);
+    }
+    return;
+  }
+
+  auto               start = std::chrono::steady_clock::now();
+  Tracing::AsyncSpan span("device", "connect_async", object_path_);
+  auto               cancellable = cancel_group_->current();
+
+  // Retried like connect(), with the backoff waited out on the context
+  run_with_retry_async(
+    retry_policy_,
+    "Connect",
+    timeout,
+    [this, cancellable](std::chrono::milliseconds remaining,
+                        AsyncRetryDone            done)
+    {
+      static const DBusCall::Method connect_call{
+        "BluetoothDevice", BlueZ::DEVICE_INTERFACE, "Connect"};
+      DBusCall::call(connection_,
+                     object_path_.c_str(),
+                     connect_call,
+                     nullptr,
+                     nullptr,
+                     DBusCall::timeout_ms(remaining),
+                     [done](GVariant*, GError* error) { done(error); },
+                     cancellable.get(),
+                     context_);
+    },
+    [this, start, span, callback](GError* error, unsigned) mutable
+    {
+      span.end();
+      if (error)
+      {
+        LOG_ERROR("Failed to connect to device: " +
+                  std::string(error->message));
+      }
+      else
+      {
+        // BlueZ replies once the link is up
+        update_connection_state(true);
+      }
+
+      record_link_operation("connect", error == nullptr, start);
+      if (callback)
+      {
+        callback(error == nullptr);
+      }
+    },
+    context_,
+    cancellable);
+}
+
+bool BluetoothDevice::disconnect(std::chrono::milliseconds timeout)
 {
+  TRACE_SPAN("device", "disconnect", object_path_);
+
   if (!connection_ || !connected_)
     return true;
 
+  auto start = std::chrono::steady_clock::now();
+
+  static const DBusCall::Method disconnect_call{
+    "BluetoothDevice", BlueZ::DEVICE_INTERFACE, "Disconnect"};
   GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(connection_,
-                                                 BlueZ::SERVICE_NAME,
-                                                 object_path_.c_str(),
-                                                 BlueZ::DEVICE_INTERFACE,
-                                                 "Disconnect",
-                                                 nullptr,
-                                                 nullptr,
-                                                 G_DBUS_CALL_FLAGS_NONE,
-                                                 10000,
-                                                 nullptr,
-                                                 &error);
+  GVariant* result = DBusCall::call_sync(connection_,
+                                         object_path_.c_str(),
+                                         disconnect_call,
+                                         nullptr,
+                                         nullptr,
+                                         DBusCall::timeout_ms(timeout),
+                                         &error);
 
   if (!result)
   {
     if (error)
     {
-      std::cerr << "Failed to disconnect from device: " << error->message
-                << std::endl;
+      LOG_ERROR("Failed to disconnect from device: " +
+                std::string(error->message));
       g_error_free(error);
     }
+    record_link_operation("disconnect", false, start);
     return false;
   }
 
@@ -247,33 +454,32 @@ bool BluetoothDevice::disconnect()
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
 
+  record_link_operation("disconnect", !connected_, start);
   return !connected_;
 }
 
-bool BluetoothDevice::pair()
+bool BluetoothDevice::pair(std::chrono::milliseconds timeout)
 {
   if (!connection_)
     return false;
 
+  static const DBusCall::Method pair_call{
+    "BluetoothDevice", BlueZ::DEVICE_INTERFACE, "Pair"};
   GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(connection_,
-                                                 BlueZ::SERVICE_NAME,
-                                                 object_path_.c_str(),
-                                                 BlueZ::DEVICE_INTERFACE,
-                                                 "Pair",
-                                                 nullptr,
-                                                 nullptr,
-                                                 G_DBUS_CALL_FLAGS_NONE,
-                                                 30000,
-                                                 nullptr,
-                                                 &error);
+  GVariant* result = DBusCall::call_sync(connection_,
+                                         object_path_.c_str(),
+                                         pair_call,
+                                         nullptr,
+                                         nullptr,
+                                         DBusCall::timeout_ms(timeout),
+                                         &error,
+                                         cancel_group_->current().get());
 
   if (!result)
   {
     if (error)
     {
-      std::cerr << "Failed to pair with device: " << error->message
-                << std::endl;
+      LOG_ERROR("Failed to pair with device: " + std::string(error->message));
       g_error_free(error);
     }
     return false;
@@ -305,97 +511,158 @@ bool BluetoothDevice::refresh_services()
 
   if (!services_resolved_)
   {
-    Utils::print_with_timestamp(
+    LOG_WARNING(
       "Services not resolved yet, discovering characteristics anyway...");
   }
 
   discover_services_and_characteristics();
-  return !characteristics_.empty();
+
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  return !gatt_.characteristics().empty();
 }
 
 void BluetoothDevice::discover_services_and_characteristics()
 {
+  TRACE_SPAN("device", "discover_services", object_path_);
+
   if (!connection_)
     return;
 
-  characteristics_.clear();
-
   // Get all managed objects to find characteristics for this device
+  static const DBusCall::Method get_managed_objects_call{
+    "BluetoothDevice", BlueZ::OBJECT_MANAGER_INTERFACE, "GetManagedObjects"};
   GError*   error = nullptr;
-  GVariant* result =
-    g_dbus_connection_call_sync(connection_,
-                                BlueZ::SERVICE_NAME,
-                                "/",
-                                BlueZ::OBJECT_MANAGER_INTERFACE,
-                                "GetManagedObjects",
-                                nullptr,
-                                G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
-                                G_DBUS_CALL_FLAGS_NONE,
-                                -1,
-                                nullptr,
-                                &error);
-
-  if (!result)
+  GVariant* result = DBusCall::call_sync(connection_,
+                                         "/",
+                                         get_managed_objects_call,
+                                         nullptr,
+                                         G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
+                                         DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                                         &error,
+                                         cancel_group_->current().get());
+
+  if (!result && error)
   {
-    if (error)
-    {
-      std::cerr << "Failed to get managed objects: " << error->message
-                << std::endl;
-      g_error_free(error);
-    }
-    return;
+    LOG_ERROR("Failed to get managed objects: " + std::string(error->message));
+    g_error_free(error);
   }
 
-  GVariantIter* objects_iter;
-  g_variant_get(result, "(a{oa{sa{sv}}})", &objects_iter);
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  gatt_.begin_update();
+  if (result)
+  {
+    // Only objects under this device are unpacked; the reply covers every
+    // object bluetoothd knows
+    ManagedObjects::for_each_object(
+      result,
+      object_path_.c_str(),
+      [this](const char* object_path, GVariant* interfaces)
+      { gatt_.add_object(object_path, interfaces); });
+    g_variant_unref(result);
+  }
+  gatt_.end_update();
+  update_handles_locked();
 
-  const gchar* object_path;
-  GVariant*    interfaces_dict;
+  LOG_INFO("Discovered " + std::to_string(gatt_.services().size()) +
+           " services, " + std::to_string(gatt_.characteristics().size()) +
+           " characteristics");
+}
 
-  while (g_variant_iter_loop(
-    objects_iter, "{&o@a{sa{sv}}}", &object_path, &interfaces_dict))
+void BluetoothDevice::add_characteristics(
+  const std::vector<std::pair<std::string, GVariant*>>& characteristics)
+{
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  for (const auto& characteristic : characteristics)
   {
-    // Check if this object path belongs to our device
-    if (g_str_has_prefix(object_path, object_path_.c_str()))
-    {
-      GVariantIter* interfaces_iter;
-      g_variant_get(interfaces_dict, "a{sa{sv}}", &interfaces_iter);
+    gatt_.add_characteristic(characteristic.first.c_str(),
+                             characteristic.second);
+  }
+  // Sorting and linking once for the whole batch
+  gatt_.end_update();
+  update_handles_locked();
+}
 
-      const gchar* interface_name;
-      GVariant*    properties_dict;
+std::shared_ptr<GattCharacteristic> BluetoothDevice::characteristic_locked(
+  GattDatabase::Index index)
+{
+  GattDatabase::StringId path = gatt_.characteristics()[index].path;
+
+  auto it = std::lower_bound(handles_.begin(),
+                             handles_.end(),
+                             path,
+                             [](const Handle& handle, GattDatabase::StringId id)
+                             { return handle.path < id; });
+  if (it != handles_.end() && it->path == path)
+    return it->characteristic;
+
+  auto characteristic = std::make_shared<GattCharacteristic>(
+    connection_, gatt_, index, context_, cancel_group_);
+  characteristic->set_retry_policy(retry_policy_);
+
+  auto ttl = read_cache_ttls_.find(characteristic->get_uuid());
+  if (ttl != read_cache_ttls_.end())
+  {
+    characteristic->set_read_cache_ttl(ttl->second);
+  }
+  handles_.insert(it, {path, characteristic});
+  return characteristic;
+}
 
-      while (g_variant_iter_loop(
-        interfaces_iter, "{&s@a{sv}}", &interface_name, &properties_dict))
-      {
-        if (g_strcmp0(interface_name, BlueZ::GATT_CHARACTERISTIC_INTERFACE) ==
-            0)
-        {
-          auto characteristic =
-            std::make_shared<GattCharacteristic>(connection_, object_path);
-          characteristics_[object_path] = characteristic;
-        }
-      }
+void BluetoothDevice::update_handles_locked()
+{
+  handles_.erase(
+    std::remove_if(handles_.begin(),
+                   handles_.end(),
+                   [this](const Handle& handle)
+                   {
+                     GattDatabase::Index index =
+                       gatt_.find_characteristic(gatt_.string(handle.path));
+                     // A handle whose UUID or service changed is stale;
+                     // the next lookup builds a new one
+                     if (index == GattDatabase::NONE ||
+                         !handle.characteristic->matches_record(gatt_, index))
+                       return true;
+
+                     handle.characteristic->load_record(gatt_, index);
+                     return false;
+                   }),
+    handles_.end());
+}
 
-      g_variant_iter_free(interfaces_iter);
+void BluetoothDevice::set_read_cache_ttl(const std::string&        char_uuid,
+                                         std::chrono::milliseconds ttl)
+{
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  read_cache_ttls_[char_uuid] = ttl;
+  for (const auto& handle : handles_)
+  {
+    if (handle.characteristic->get_uuid() == char_uuid)
+    {
+      handle.characteristic->set_read_cache_ttl(ttl);
     }
   }
+}
 
-  g_variant_iter_free(objects_iter);
-  g_variant_unref(result);
-
-  Utils::print_with_timestamp("Discovered " +
-                              std::to_string(characteristics_.size()) +
-                              " characteristics");
+void BluetoothDevice::set_retry_policy(const RetryPolicy& policy)
+{
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  retry_policy_ = policy;
+  for (const auto& handle : handles_)
+  {
+    handle.characteristic->set_retry_policy(policy);
+  }
 }
 
 std::vector<std::shared_ptr<GattCharacteristic>>
 BluetoothDevice::get_characteristics()
 {
+  std::lock_guard<std::mutex>                      lock(gatt_mutex_);
   std::vector<std::shared_ptr<GattCharacteristic>> char_list;
 
-  for (const auto& pair : characteristics_)
+  char_list.reserve(gatt_.characteristics().size());
+  for (GattDatabase::Index i = 0; i < gatt_.characteristics().size(); ++i)
   {
-    char_list.push_back(pair.second);
+    char_list.push_back(characteristic_locked(i));
   }
 
   return char_list;
@@ -405,83 +672,250 @@ std::shared_ptr<GattCharacteristic> BluetoothDevice::get_characteristic(
   const std::string& service_uuid,
   const std::string& char_uuid)
 {
-  for (const auto& pair : characteristics_)
-  {
-    if (g_ascii_strcasecmp(pair.second->get_uuid().c_str(),
-                           char_uuid.c_str()) == 0)
-    {
-      return pair.second;
-    }
-  }
-  return nullptr;
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  GattDatabase::Index         index =
+    gatt_.find_characteristic(service_uuid, char_uuid);
+  if (index == GattDatabase::NONE)
+    return nullptr;
+  return characteristic_locked(index);
 }
 
 std::shared_ptr<GattCharacteristic> BluetoothDevice::get_characteristic_by_path(
   const std::string& char_path)
 {
-  auto it = characteristics_.find(char_path);
-  if (it != characteristics_.end())
-  {
-    return it->second;
-  }
-  return nullptr;
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  GattDatabase::Index         index = gatt_.find_characteristic(char_path);
+  if (index == GattDatabase::NONE)
+    return nullptr;
+  return characteristic_locked(index);
 }
 
-bool BluetoothDevice::read_characteristic(const std::string&    service_uuid,
-                                          const std::string&    char_uuid,
-                                          std::vector<uint8_t>& data)
+bool BluetoothDevice::read_characteristic(
+  const std::string&        service_uuid,
+  const std::string&        char_uuid,
+  std::vector<uint8_t>&     data,
+  OperationPriority         priority,
+  std::chrono::milliseconds timeout,
+  BluezError*               error)
 {
   auto characteristic = get_characteristic(service_uuid, char_uuid);
   if (!characteristic)
   {
-    Utils::print_with_timestamp("Characteristic not found: " + char_uuid);
+    LOG_WARNING("Characteristic not found: " + char_uuid);
+    report_not_found(error, char_uuid);
     return false;
   }
 
-  return characteristic->read_value(data);
+  ScopedOperation operation(scheduler_, priority);
+  if (!operation.granted())
+  {
+    report_no_slot(error);
+    return false;
+  }
+  return characteristic->read_value(data, timeout, error);
 }
 
-bool BluetoothDevice::write_characteristic(const std::string& service_uuid,
-                                           const std::string& char_uuid,
-                                           const std::vector<uint8_t>& data)
+bool BluetoothDevice::write_characteristic(
+  const std::string&          service_uuid,
+  const std::string&          char_uuid,
+  const std::vector<uint8_t>& data,
+  OperationPriority           priority,
+  std::chrono::milliseconds   timeout,
+  BluezError*                 error)
 {
   auto characteristic = get_characteristic(service_uuid, char_uuid);
   if (!characteristic)
   {
-    Utils::print_with_timestamp("Characteristic not found: " + char_uuid);
+    LOG_WARNING("Characteristic not found: " + char_uuid);
+    report_not_found(error, char_uuid);
+    return false;
+  }
+
+  ScopedOperation operation(scheduler_, priority);
+  if (!operation.granted())
+  {
+    report_no_slot(error);
     return false;
   }
+  return characteristic->write_value(data, timeout, error);
+}
+
+void BluetoothDevice::read_all_async(SnapshotCallback callback)
+{
+  // Filled in by the reply handlers. Most run on context_, but cached or
+  // coalesced reads may complete on whichever thread started them.
+  struct PendingSnapshot
+  {
+    std::mutex                            mutex;
+    DeviceSnapshot                        snapshot;
+    size_t                                remaining;
+    std::chrono::steady_clock::time_point start;
+    Tracing::AsyncSpan                    span;
+    SnapshotCallback                      callback;
+  };
+
+  // Only readable characteristics need a GattCharacteristic
+  std::vector<std::shared_ptr<GattCharacteristic>> readable;
+  {
+    std::lock_guard<std::mutex> lock(gatt_mutex_);
+    const auto&                 records = gatt_.characteristics();
+    for (GattDatabase::Index i = 0; i < records.size(); ++i)
+    {
+      if (records[i].flags & GattFlags::Read)
+      {
+        readable.push_back(characteristic_locked(i));
+      }
+    }
+  }
+
+  auto pending       = std::make_shared<PendingSnapshot>();
+  pending->remaining = readable.size();
+  pending->start     = std::chrono::steady_clock::now();
+  pending->span      = Tracing::AsyncSpan("device", "read_all", object_path_);
+  pending->callback  = std::move(callback);
+  pending->snapshot.readings.resize(readable.size());
+
+  if (readable.empty())
+  {
+    pending->span.end();
+    pending->callback(pending->snapshot);
+    return;
+  }
+
+  // Every slot is sized and labelled before the first reply can arrive
+  for (size_t i = 0; i < readable.size(); ++i)
+  {
+    pending->snapshot.readings[i].uuid = readable[i]->get_uuid();
+    pending->snapshot.readings[i].path = readable[i]->get_object_path();
+  }
+
+  // Stores reading `i`; the last one to arrive reports the snapshot
+  auto record = [pending](size_t                                i,
+                          std::chrono::steady_clock::time_point issued,
+                          const std::vector<uint8_t>&           data,
+                          const GError*                         error)
+  {
+    auto now = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(pending->mutex);
+      CharacteristicReading&      reading = pending->snapshot.readings[i];
+      reading.latency =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - issued);
+      reading.success = error == nullptr;
+      if (error)
+      {
+        reading.error = error->message;
+      }
+      else
+      {
+        reading.value = data;
+        ++pending->snapshot.succeeded;
+      }
+
+      if (--pending->remaining > 0)
+        return;
+    }
+
+    pending->snapshot.wall_time =
+      std::chrono::duration_cast<std::chrono::microseconds>(now -
+                                                            pending->start);
+    pending->span.end();
+    pending->callback(pending->snapshot);
+  };
+
+  for (size_t i = 0; i < readable.size(); ++i)
+  {
+    auto issued = std::chrono::steady_clock::now();
+    scheduler_->submit(
+      OperationPriority::Background,
+      [scheduler = scheduler_, characteristic = readable[i], record, i, issued](
+        bool granted)
+      {
+        if (!granted)
+        {
+          GError* error = g_error_new_literal(
+            G_IO_ERROR, G_IO_ERROR_CANCELLED, "Device is going away");
+          record(i, issued, {}, error);
+          g_error_free(error);
+          return;
+        }
+
+        characteristic->read_value_async(
+          [scheduler, record, i, issued](const std::vector<uint8_t>& data,
+                                         const GError*               error)
+          {
+            scheduler->release();
+            record(i, issued, data, error);
+          });
+      });
+  }
+}
+
+DeviceSnapshot BluetoothDevice::read_all()
+{
+  std::mutex              mutex;
+  std::condition_variable done_cv;
+  std::atomic<bool>       done{false};
+  DeviceSnapshot          result;
+
+  // Reads coalesced with a blocking read_value() complete on that caller's
+  // thread, so the iteration below must be woken up explicitly
+  read_all_async(
+    [&](const DeviceSnapshot& snapshot)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      result = snapshot;
+      done   = true;
+      done_cv.notify_all();
+      g_main_context_wakeup(context_);
+    });
+
+  // Iterate the context here if no one else is; otherwise just wait
+  if (g_main_context_acquire(context_))
+  {
+    while (!done)
+    {
+      g_main_context_iteration(context_, TRUE);
+    }
+    g_main_context_release(context_);
+  }
 
-  return characteristic->write_value(data);
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&] { return done.load(); });
+  return result;
 }
 
-bool BluetoothDevice::subscribe_to_notifications(
+uint32_t BluetoothDevice::subscribe_to_notifications(
   const std::string&   service_uuid,
   const std::string&   char_uuid,
-  NotificationCallback callback)
+  NotificationCallback callback,
+  BluezError*          error)
 {
   auto characteristic = get_characteristic(service_uuid, char_uuid);
   if (!characteristic)
   {
-    Utils::print_with_timestamp("Characteristic not found: " + char_uuid);
-    return false;
+    LOG_WARNING("Characteristic not found: " + char_uuid);
+    report_not_found(error, char_uuid);
+    return 0;
   }
 
-  return characteristic->start_notifications(callback);
+  return characteristic->start_notifications(std::move(callback), error);
 }
 
 bool BluetoothDevice::unsubscribe_from_notifications(
   const std::string& service_uuid,
-  const std::string& char_uuid)
+  const std::string& char_uuid,
+  uint32_t           subscription_id)
 {
   auto characteristic = get_characteristic(service_uuid, char_uuid);
   if (!characteristic)
   {
-    Utils::print_with_timestamp("Characteristic not found: " + char_uuid);
+    LOG_WARNING("Characteristic not found: " + char_uuid);
     return false;
   }
 
-  return characteristic->stop_notifications();
+  return subscription_id ? characteristic->stop_notifications(subscription_id)
+                         : characteristic->stop_notifications();
 }
 
 void BluetoothDevice::print_device_info()
@@ -503,13 +937,23 @@ void BluetoothDevice::print_device_info()
     }
   }
 
-  std::cout << "Characteristics: " << characteristics_.size() << std::endl;
+  {
+    std::lock_guard<std::mutex> lock(gatt_mutex_);
+    std::cout << "Services: " << gatt_.services().size() << std::endl;
+    std::cout << "Characteristics: " << gatt_.characteristics().size()
+              << std::endl;
+  }
   std::cout << std::endl;
 }
 
 void BluetoothDevice::print_services_and_characteristics()
 {
-  if (characteristics_.empty())
+  std::lock_guard<std::mutex> lock(gatt_mutex_);
+  const auto&                 services        = gatt_.services();
+  const auto&                 characteristics = gatt_.characteristics();
+  const auto&                 descriptors     = gatt_.descriptors();
+
+  if (characteristics.empty())
   {
     Utils::print_with_timestamp(
       "No characteristics discovered. Make sure device is connected and "
@@ -517,16 +961,50 @@ void BluetoothDevice::print_services_and_characteristics()
     return;
   }
 
+  auto print_characteristic = [&](const GattDatabase::Characteristic& record,
+                                  const char*                         indent)
+  {
+    std::cout << indent << "Characteristic: " << gatt_.string(record.uuid)
+              << std::endl;
+    std::cout << indent << "  Path: " << gatt_.string(record.path)
+              << std::endl;
+    std::cout << indent << "  Flags: " << GattFlags::to_string(record.flags)
+              << std::endl;
+    for (GattDatabase::Index d = record.first_descriptor;
+         d < record.first_descriptor + record.descriptor_count;
+         ++d)
+    {
+      std::cout << indent << "  Descriptor: "
+                << gatt_.string(descriptors[d].uuid) << std::endl;
+    }
+  };
+
   std::cout << "\n=== Services and Characteristics ===" << std::endl;
 
-  for (const auto& pair : characteristics_)
+  for (const auto& service : services)
   {
-    const auto& characteristic = pair.second;
-    std::cout << "Characteristic: " << characteristic->get_uuid() << std::endl;
-    std::cout << "  Path: " << characteristic->get_object_path() << std::endl;
-    std::cout << "  Flags: " << characteristic->flags_to_string() << std::endl;
+    std::cout << "Service: " << gatt_.string(service.uuid)
+              << (service.primary ? " (primary)" : " (secondary)")
+              << std::endl;
+    std::cout << "  Path: " << gatt_.string(service.path) << std::endl;
+    for (GattDatabase::Index c = service.first_characteristic;
+         c < service.first_characteristic + service.characteristic_count;
+         ++c)
+    {
+      print_characteristic(characteristics[c], "  ");
+    }
     std::cout << std::endl;
   }
+
+  // Characteristics known without their service (added one by one)
+  for (const auto& characteristic : characteristics)
+  {
+    if (characteristic.service == GattDatabase::NONE)
+    {
+      print_characteristic(characteristic, "");
+      std::cout << std::endl;
+    }
+  }
 }
 
 bool BluetoothDevice::has_service(const std::string& service_uuid)
@@ -546,9 +1024,22 @@ void BluetoothDevice::update_connection_state(bool connected)
   if (connected_ != connected)
   {
     connected_ = connected;
-    Utils::print_with_timestamp("Device " + address_ +
-                                " connection state changed: " +
-                                (connected ? "Connected" : "Disconnected"));
+    LOG_INFO("Device " + address_ + " connection state changed: " +
+             (connected ? "Connected" : "Disconnected"));
+
+    // Nothing in flight can complete over the dropped link; fail it now
+    // rather than at its deadline. Cached values may not survive a reconnect
+    // (e.g. a firmware update).
+    if (!connected)
+    {
+      cancel_group_->cancel();
+      std::lock_guard<std::mutex> lock(gatt_mutex_);
+      for (const auto& handle : handles_)
+      {
+        handle.characteristic->invalidate_read_cache();
+        handle.characteristic->suspend_notifications();
+      }
+    }
 
     if (connected && !services_resolved_)
     {
@@ -569,12 +1060,18 @@ void BluetoothDevice::update_services_resolved_state(bool resolved)
   if (services_resolved_ != resolved)
   {
     services_resolved_ = resolved;
-    Utils::print_with_timestamp("Device " + address_ + " services resolved: " +
-                                (resolved ? "Yes" : "No"));
+    LOG_INFO("Device " + address_ + " services resolved: " +
+             (resolved ? "Yes" : "No"));
 
     if (resolved && connected_)
     {
       discover_services_and_characteristics();
+
+      std::lock_guard<std::mutex> lock(gatt_mutex_);
+      for (const auto& handle : handles_)
+      {
+        handle.characteristic->resume_notifications();
+      }
     }
   }
 }
\ No newline at end of file
@@ -1,676 +1,2589 @@
 #include "BluetoothManager.h"
+#include "DBusCall.h"
+#include "NotificationHandler.h"
+#include "Logger.h"
+#include "ManagedObjects.h"
+#include "Metrics.h"
+#include "Tracing.h"
 #include <algorithm>
+#include <cstring>
+#include <string_view>
 
-BluetoothManager::BluetoothManager() : connection_(nullptr), is_scanning_(false)
+namespace
+{
+std::string format_ms(std::chrono::microseconds duration)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.1f ms", duration.count() / 1000.0);
+  return buffer;
+}
+
+// True if a Device1 a{sv} carries a property that only changes when the
+// device advertises
+bool has_advertisement_property(GVariant* properties)
+{
+  GVariantIter iter;
+  const gchar* key;
+  GVariant*    value;
+
+  g_variant_iter_init(&iter, properties);
+  while (g_variant_iter_next(&iter, "{&sv}", &key, &value))
+  {
+    g_variant_unref(value);
+    if (g_strcmp0(key, "RSSI") == 0 ||
+        g_strcmp0(key, "ManufacturerData") == 0 ||
+        g_strcmp0(key, "ServiceData") == 0)
+      return true;
+  }
+  return false;
+}
+}  // namespace
+
+BluetoothManager::BluetoothManager(GMainContext* context)
+  : connection_(nullptr)
+  , context_(context ? g_main_context_ref(context) : g_main_context_new())
+  , main_loop_(context ? nullptr : g_main_loop_new(context_, FALSE))
+  , is_scanning_(false)
+  , gc_timer_(nullptr)
+  , scan_timer_(nullptr)
+  , scan_window_open_(false)
+  , scan_suspended_(false)
+  , scan_sample_notifications_(0)
+  , notification_rate_(0.0)
+  , advertisement_count_(0)
+  , lifetime_(std::make_shared<int>(0))
+  , device_connection_count_(0)
 {
 }
 
 BluetoothManager::~BluetoothManager()
 {
   cleanup();
+  lifetime_.reset();
+
+  if (main_loop_)
+  {
+    g_main_loop_unref(main_loop_);
+  }
+  g_main_context_unref(context_);
+}
+
+DBusCall::ReplyHandler BluetoothManager::guarded(DBusCall::ReplyHandler handler)
+{
+  std::weak_ptr<void> alive = lifetime_;
+  return [alive, handler = std::move(handler)](GVariant* reply, GError* error)
+  {
+    if (alive.expired() ||
+        g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      return;
+    handler(reply, error);
+  };
 }
 
 bool BluetoothManager::initialize()
 {
-  GError* error = nullptr;
+  std::mutex              mutex;
+  std::condition_variable done_cv;
+  bool                    done   = false;
+  bool                    result = false;
 
-  // Connect to the system D-Bus
-  connection_ = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &error);
-  if (!connection_)
+  initialize_async(
+    [&](bool success)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      result = success;
+      done   = true;
+      done_cv.notify_all();
+    });
+
+  // Iterate the context here if no one else is (a caller-supplied context
+  // whose loop is not running yet); otherwise just wait for the callback
+  if (g_main_context_acquire(context_))
   {
-    if (error)
+    Utils::ScopedMainContext scope(context_);
+    while (!done)
     {
-      std::cerr << "Failed to connect to D-Bus: " << error->message
-                << std::endl;
-      g_error_free(error);
+      g_main_context_iteration(context_, TRUE);
     }
-    return false;
+    g_main_context_release(context_);
   }
 
-  // Find the default adapter
-  adapter_path_ = find_default_adapter();
-  if (adapter_path_.empty())
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&] { return done; });
+  return result;
+}
+
+void BluetoothManager::initialize_async(InitializeCallback callback)
+{
+  if (connection_ || startup_.running)
   {
-    std::cerr << "No Bluetooth adapter found" << std::endl;
-    return false;
+    LOG_ERROR("Bluetooth manager is already initialized");
+    if (callback)
+    {
+      callback(false);
+    }
+    return;
   }
 
-  Utils::print_with_timestamp("Using adapter: " + adapter_path_);
-
-  // Subscribe to D-Bus signals for device discovery
-  g_dbus_connection_signal_subscribe(connection_,
-                                     BlueZ::SERVICE_NAME,
-                                     BlueZ::OBJECT_MANAGER_INTERFACE,
-                                     "InterfacesAdded",
-                                     nullptr,
-                                     nullptr,
-                                     G_DBUS_SIGNAL_FLAGS_NONE,
-                                     on_interfaces_added,
-                                     this,
-                                     nullptr);
-
-  g_dbus_connection_signal_subscribe(connection_,
-                                     BlueZ::SERVICE_NAME,
-                                     BlueZ::OBJECT_MANAGER_INTERFACE,
-                                     "InterfacesRemoved",
-                                     nullptr,
-                                     nullptr,
-                                     G_DBUS_SIGNAL_FLAGS_NONE,
-                                     on_interfaces_removed,
-                                     this,
-                                     nullptr);
-
-  g_dbus_connection_signal_subscribe(connection_,
-                                     BlueZ::SERVICE_NAME,
-                                     BlueZ::PROPERTIES_INTERFACE,
-                                     "PropertiesChanged",
-                                     nullptr,
-                                     nullptr,
-                                     G_DBUS_SIGNAL_FLAGS_NONE,
-                                     on_properties_changed,
-                                     this,
-                                     nullptr);
-
-  // Ensure adapter is powered on
-  return ensure_adapter_powered();
-}
+  startup_             = Startup();
+  startup_.callback    = std::move(callback);
+  startup_.begin       = std::chrono::steady_clock::now();
+  startup_.phase_begin = startup_.begin;
+  startup_.running     = true;
 
-void BluetoothManager::cleanup()
-{
-  if (connection_)
+  // Private contexts are iterated on the manager's own I/O thread. It owns
+  // the context from here on, so calls made on other threads are handed to
+  // it rather than pushing the context there.
+  if (main_loop_ && !io_thread_.joinable())
   {
-    stop_discovery();
-    devices_.clear();
-    g_object_unref(connection_);
-    connection_ = nullptr;
+    std::promise<void> owned;
+    io_thread_ = std::thread(&BluetoothManager::io_thread_main, this, &owned);
+    owned.get_future().wait();
   }
+
+  // Connect to the system D-Bus
+  Utils::invoke(context_,
+                [this]
+                { g_bus_get(G_BUS_TYPE_SYSTEM, nullptr, on_bus_ready, this); });
 }
 
-std::string BluetoothManager::find_default_adapter()
+void BluetoothManager::on_bus_ready(GObject*      source_object,
+                                    GAsyncResult* result,
+                                    gpointer      user_data)
 {
-  if (!connection_)
-    return "";
+  (void)source_object;
 
-  GError*   error = nullptr;
-  GVariant* result =
-    g_dbus_connection_call_sync(connection_,
-                                BlueZ::SERVICE_NAME,
-                                "/",
-                                BlueZ::OBJECT_MANAGER_INTERFACE,
-                                "GetManagedObjects",
-                                nullptr,
-                                G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
-                                G_DBUS_CALL_FLAGS_NONE,
-                                -1,
-                                nullptr,
-                                &error);
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
 
-  if (!result)
+  GError*          error      = nullptr;
+  GDBusConnection* connection = g_bus_get_finish(result, &error);
+  if (!connection)
   {
     if (error)
     {
-      std::cerr << "Failed to get managed objects: " << error->message
-                << std::endl;
+      LOG_ERROR("Failed to connect to D-Bus: " + std::string(error->message));
       g_error_free(error);
     }
-    return "";
+    manager->finish_startup(false);
+    return;
   }
 
-  GVariantIter* objects_iter;
-  g_variant_get(result, "(a{oa{sa{sv}}})", &objects_iter);
+  manager->connection_ = connection;
+  manager->open_device_connections();
+}
 
-  const gchar* object_path;
-  GVariant*    interfaces_dict;
+void BluetoothManager::open_device_connections()
+{
+  if (device_connection_count_ == 0)
+  {
+    load_objects_async();
+    return;
+  }
 
-  std::string adapter_path;
-  while (g_variant_iter_loop(
-    objects_iter, "{&o@a{sa{sv}}}", &object_path, &interfaces_dict))
+  GError* error   = nullptr;
+  gchar*  address =
+    g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SYSTEM, nullptr, &error);
+  if (!address)
   {
-    if (g_str_has_prefix(object_path, BlueZ::ADAPTER_PATH_PREFIX))
-    {
-      GVariantIter* interfaces_iter;
-      g_variant_get(interfaces_dict, "a{sa{sv}}", &interfaces_iter);
+    LOG_WARNING("No system bus address, devices share one connection: " +
+                std::string(error->message));
+    g_error_free(error);
+    load_objects_async();
+    return;
+  }
 
-      const gchar* interface_name;
-      GVariant*    properties_dict;
+  // Opened side by side; objects are loaded once the last one is ready
+  Utils::ScopedMainContext scope(context_);
+  startup_.connections_pending = device_connection_count_;
+  for (size_t i = 0; i < device_connection_count_; ++i)
+  {
+    g_dbus_connection_new_for_address(
+      address,
+      static_cast<GDBusConnectionFlags>(
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+      nullptr,
+      nullptr,
+      on_device_connection_ready,
+      this);
+  }
+  g_free(address);
+}
 
-      while (g_variant_iter_loop(
-        interfaces_iter, "{&s@a{sv}}", &interface_name, &properties_dict))
-      {
-        if (g_strcmp0(interface_name, BlueZ::ADAPTER_INTERFACE) == 0)
-        {
-          adapter_path = object_path;
-          break;
-        }
-      }
+void BluetoothManager::on_device_connection_ready(GObject*      source_object,
+                                                  GAsyncResult* result,
+                                                  gpointer      user_data)
+{
+  (void)source_object;
 
-      g_variant_iter_free(interfaces_iter);
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
 
-      if (!adapter_path.empty())
-      {
-        break;
-      }
-    }
+  GError*          error = nullptr;
+  GDBusConnection* connection =
+    g_dbus_connection_new_for_address_finish(result, &error);
+  if (connection)
+  {
+    manager->device_connections_.push_back({connection, 0, {}});
+  }
+  else
+  {
+    // Fewer connections only means coarser partitioning
+    LOG_WARNING("Failed to open a device bus connection: " +
+                std::string(error->message));
+    g_error_free(error);
   }
 
-  g_variant_iter_free(objects_iter);
-  g_variant_unref(result);
-
-  return adapter_path;
+  if (--manager->startup_.connections_pending == 0)
+  {
+    LOG_INFO("Spreading devices over " +
+             std::to_string(manager->device_connections_.size()) +
+             " bus connections");
+    manager->load_objects_async();
+  }
 }
 
-bool BluetoothManager::ensure_adapter_powered()
+void BluetoothManager::load_objects_async()
 {
-  if (adapter_path_.empty())
-    return false;
+  startup_.timings.bus_connect = end_startup_phase();
+
+  // Subscribing before the object snapshot means nothing that appears in
+  // between is missed
+  subscribe_signals();
+
+  // Load adapters, known devices and resolved GATT trees in one round trip
+  static const DBusCall::Method get_managed_objects_call{
+    "BluetoothManager", BlueZ::OBJECT_MANAGER_INTERFACE, "GetManagedObjects"};
+  DBusCall::call(connection_,
+                 "/",
+                 get_managed_objects_call,
+                 nullptr,
+                 G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
+                 DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                 guarded([this](GVariant* reply, GError* error)
+                         {
+                           if (!reply)
+                           {
+                             LOG_ERROR("Failed to get managed objects: " +
+                                       std::string(error->message));
+                             finish_startup(false);
+                             return;
+                           }
+
+                           if (!load_managed_objects(reply))
+                           {
+                             LOG_ERROR("No Bluetooth adapter found");
+                             finish_startup(false);
+                             return;
+                           }
+
+                           LOG_INFO("Using adapter: " + default_adapter());
+                           startup_.timings.load_objects = end_startup_phase();
+                           startup_.objects_loaded = true;
+                           check_startup_powered();
+                         }),
+                 cancel_group_.current().get(),
+                 context_);
+}
 
-  // Check if already powered
-  if (is_adapter_powered())
+void BluetoothManager::subscribe_signals()
+{
+  // GDBus delivers signals on the context that is thread-default while
+  // subscribing
+  Utils::ScopedMainContext scope(context_);
+
+  signal_subscriptions_.push_back(
+    g_dbus_connection_signal_subscribe(connection_,
+                                       BlueZ::SERVICE_NAME,
+                                       BlueZ::OBJECT_MANAGER_INTERFACE,
+                                       "InterfacesAdded",
+                                       nullptr,
+                                       nullptr,
+                                       G_DBUS_SIGNAL_FLAGS_NONE,
+                                       on_interfaces_added,
+                                       this,
+                                       nullptr));
+
+  signal_subscriptions_.push_back(
+    g_dbus_connection_signal_subscribe(connection_,
+                                       BlueZ::SERVICE_NAME,
+                                       BlueZ::OBJECT_MANAGER_INTERFACE,
+                                       "InterfacesRemoved",
+                                       nullptr,
+                                       nullptr,
+                                       G_DBUS_SIGNAL_FLAGS_NONE,
+                                       on_interfaces_removed,
+                                       this,
+                                       nullptr));
+
+  if (device_connections_.empty())
   {
-    return true;
+    signal_subscriptions_.push_back(
+      g_dbus_connection_signal_subscribe(connection_,
+                                         BlueZ::SERVICE_NAME,
+                                         BlueZ::PROPERTIES_INTERFACE,
+                                         "PropertiesChanged",
+                                         nullptr,
+                                         nullptr,
+                                         G_DBUS_SIGNAL_FLAGS_NONE,
+                                         on_properties_changed,
+                                         this,
+                                         nullptr));
+    return;
   }
 
-  return power_on_adapter();
+  // With dedicated device connections the manager's own connection only
+  // carries adapter and device changes (arg0 is the changed interface).
+  // Characteristic values, the bulk of the traffic, arrive on the device
+  // connections, so no single socket receives every notification.
+  for (const char* interface :
+       {BlueZ::ADAPTER_INTERFACE, BlueZ::DEVICE_INTERFACE})
+  {
+    signal_subscriptions_.push_back(
+      g_dbus_connection_signal_subscribe(connection_,
+                                         BlueZ::SERVICE_NAME,
+                                         BlueZ::PROPERTIES_INTERFACE,
+                                         "PropertiesChanged",
+                                         nullptr,
+                                         interface,
+                                         G_DBUS_SIGNAL_FLAGS_NONE,
+                                         on_properties_changed,
+                                         this,
+                                         nullptr));
+  }
+  // Without a match rule of their own: device_connection() adds one per
+  // bound device, or every connection would receive every notification
+  for (auto& device_connection : device_connections_)
+  {
+    device_connection.properties_subscription =
+      g_dbus_connection_signal_subscribe(device_connection.connection,
+                                         BlueZ::SERVICE_NAME,
+                                         BlueZ::PROPERTIES_INTERFACE,
+                                         "PropertiesChanged",
+                                         nullptr,
+                                         BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+                                         G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+                                         on_properties_changed,
+                                         this,
+                                         nullptr);
+  }
 }
 
-bool BluetoothManager::power_on_adapter()
+void BluetoothManager::request_power_on()
 {
-  if (!connection_ || adapter_path_.empty())
-    return false;
-
-  GError* error = nullptr;
-
-  GVariant* powered_value = g_variant_new_boolean(TRUE);
-  GVariant* result        = g_dbus_connection_call_sync(
-    connection_,
-    BlueZ::SERVICE_NAME,
-    adapter_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Set",
-    g_variant_new("(ssv)", BlueZ::ADAPTER_INTERFACE, "Powered", powered_value),
-    nullptr,
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
-
-  if (!result)
+  std::vector<std::string> unpowered;
   {
-    if (error)
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    for (const auto& adapter : adapters_)
     {
-      std::cerr << "Failed to power on adapter: " << error->message
-                << std::endl;
-      g_error_free(error);
+      if (!adapter.powered)
+      {
+        unpowered.push_back(adapter.path);
+      }
     }
-    return false;
   }
 
-  g_variant_unref(result);
+  if (unpowered.empty())
+    return;
 
-  // Wait a moment for the adapter to power on
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  // Completion is signalled by PropertiesChanged(Powered); a failed Set
+  // just stops us waiting for that adapter
+  for (const auto& path : unpowered)
+  {
+    startup_.powering.insert(path);
+    static const DBusCall::Method set_call{
+      "BluetoothManager", BlueZ::PROPERTIES_INTERFACE, "Set"};
+    DBusCall::call(connection_,
+                   path.c_str(),
+                   set_call,
+                   g_variant_new("(ssv)",
+                                 BlueZ::ADAPTER_INTERFACE,
+                                 "Powered",
+                                 g_variant_new_boolean(TRUE)),
+                   nullptr,
+                   DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                   guarded([this, path](GVariant* reply, GError* error)
+                           {
+                             (void)reply;
+                             if (error)
+                             {
+                               LOG_ERROR("Failed to power on " + path + ": " +
+                                         error->message);
+                               startup_.powering.erase(path);
+                               check_startup_powered();
+                             }
+                           }),
+                   cancel_group_.current().get(),
+                   context_);
+  }
+  startup_.timings.adapters_powered_on = unpowered.size();
 
-  return is_adapter_powered();
+  startup_.power_timeout = g_timeout_source_new(POWER_ON_TIMEOUT_MS);
+  g_source_set_callback(
+    startup_.power_timeout, on_power_timeout, this, nullptr);
+  g_source_attach(startup_.power_timeout, context_);
 }
 
-bool BluetoothManager::power_off_adapter()
+gboolean BluetoothManager::on_power_timeout(gpointer user_data)
 {
-  if (!connection_ || adapter_path_.empty())
-    return false;
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
 
-  // Stop discovery first
-  stop_discovery();
+  g_source_unref(manager->startup_.power_timeout);
+  manager->startup_.power_timeout = nullptr;
 
-  GError* error = nullptr;
+  LOG_WARNING("Timed out waiting for adapters to power on");
+  manager->finish_startup(manager->any_adapter_powered());
+  return G_SOURCE_REMOVE;
+}
 
-  GVariant* powered_value = g_variant_new_boolean(FALSE);
-  GVariant* result        = g_dbus_connection_call_sync(
-    connection_,
-    BlueZ::SERVICE_NAME,
-    adapter_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Set",
-    g_variant_new("(ssv)", BlueZ::ADAPTER_INTERFACE, "Powered", powered_value),
-    nullptr,
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
+void BluetoothManager::check_startup_powered()
+{
+  if (!startup_.running || !startup_.objects_loaded)
+    return;
 
-  if (!result)
   {
-    if (error)
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    for (auto it = startup_.powering.begin(); it != startup_.powering.end();)
     {
-      std::cerr << "Failed to power off adapter: " << error->message
-                << std::endl;
-      g_error_free(error);
+      AdapterStats* adapter = find_adapter_locked(*it);
+      it = (!adapter || adapter->powered) ? startup_.powering.erase(it)
+                                          : std::next(it);
     }
-    return false;
   }
 
-  g_variant_unref(result);
-  return true;
+  if (startup_.powering.empty())
+  {
+    finish_startup(any_adapter_powered());
+  }
 }
 
-bool BluetoothManager::is_adapter_powered()
+void BluetoothManager::finish_startup(bool success)
 {
-  if (!connection_ || adapter_path_.empty())
-    return false;
+  if (!startup_.running)
+    return;
+  startup_.running = false;
 
-  GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(
-    connection_,
-    BlueZ::SERVICE_NAME,
-    adapter_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Get",
-    g_variant_new("(ss)", BlueZ::ADAPTER_INTERFACE, "Powered"),
-    G_VARIANT_TYPE("(v)"),
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
+  if (startup_.power_timeout)
+  {
+    g_source_destroy(startup_.power_timeout);
+    g_source_unref(startup_.power_timeout);
+    startup_.power_timeout = nullptr;
+  }
 
-  if (!result)
+  StartupTimings& timings = startup_.timings;
+  if (startup_.objects_loaded)
   {
-    if (error)
-    {
-      g_error_free(error);
-    }
-    return false;
+    timings.power_on = end_startup_phase();
   }
+  timings.total = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - startup_.begin);
 
-  GVariant* value;
-  g_variant_get(result, "(v)", &value);
+  auto& registry = Metrics::Registry::instance();
+  auto  observe  = [&](const char* phase, std::chrono::microseconds duration)
+  {
+    registry
+      .histogram("bscm_startup_phase_duration_seconds",
+                 "Time spent in each phase of initialize()",
+                 {{"phase", phase}})
+      .observe(duration);
+  };
+  observe("bus_connect", timings.bus_connect);
+  observe("load_objects", timings.load_objects);
+  observe("power_on", timings.power_on);
+  observe("total", timings.total);
+
+  LOG_INFO(std::string("Startup ") + (success ? "finished" : "failed") +
+           " in " + format_ms(timings.total) + " (bus " +
+           format_ms(timings.bus_connect) + ", objects " +
+           format_ms(timings.load_objects) + ", power-on " +
+           format_ms(timings.power_on) + ")");
 
-  gboolean powered = g_variant_get_boolean(value);
+  {
+    std::lock_guard<std::mutex> lock(startup_mutex_);
+    startup_timings_ = timings;
+  }
 
-  g_variant_unref(value);
-  g_variant_unref(result);
+  InitializeCallback callback = std::move(startup_.callback);
+  if (callback)
+  {
+    callback(success);
+  }
+}
 
-  return powered;
+std::chrono::microseconds BluetoothManager::end_startup_phase()
+{
+  auto now     = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+    now - startup_.phase_begin);
+  startup_.phase_begin = now;
+  return elapsed;
 }
 
-bool BluetoothManager::start_discovery(
-  const std::vector<std::string>& service_uuids)
+void BluetoothManager::set_device_connection_count(size_t count)
 {
-  if (!connection_ || adapter_path_.empty())
-    return false;
+  device_connection_count_ = count;
+}
 
-  std::lock_guard<std::mutex> lock(scan_mutex_);
+namespace
+{
+// Characteristic changes below one device object
+std::string device_match_rule(const std::string& device_path)
+{
+  return std::string("type='signal',sender='") + BlueZ::SERVICE_NAME +
+         "',interface='" + BlueZ::PROPERTIES_INTERFACE +
+         "',member='PropertiesChanged',arg0='" +
+         BlueZ::GATT_CHARACTERISTIC_INTERFACE + "',path_namespace='" +
+         device_path + "'";
+}
 
-  if (is_scanning_)
+// Fire and forget: with no callback the bus daemon sends no reply, and
+// the rule is in place before any later call on the same connection
+void call_bus_daemon(GDBusConnection*   connection,
+                     const char*        method,
+                     const std::string& rule)
+{
+  g_dbus_connection_call(connection,
+                         "org.freedesktop.DBus",
+                         "/org/freedesktop/DBus",
+                         "org.freedesktop.DBus",
+                         method,
+                         g_variant_new("(s)", rule.c_str()),
+                         nullptr,
+                         G_DBUS_CALL_FLAGS_NONE,
+                         -1,
+                         nullptr,
+                         nullptr,
+                         nullptr);
+}
+}  // namespace
+
+GDBusConnection* BluetoothManager::device_connection(
+  const std::string& device_path)
+{
+  if (device_connections_.empty())
+    return connection_;
+
+  // By path, so a device lands on the same connection every time its
+  // object is rebuilt
+  size_t index = std::hash<std::string>()(device_path) %
+                 device_connections_.size();
+  DeviceConnection& device_connection = device_connections_[index];
+
+  std::lock_guard<std::mutex> lock(device_paths_mutex_);
+  if (device_connection.device_paths.insert(device_path).second)
   {
-    stop_discovery();
+    call_bus_daemon(
+      device_connection.connection, "AddMatch", device_match_rule(device_path));
   }
+  return device_connection.connection;
+}
 
-  target_service_uuids_ = service_uuids;
+void BluetoothManager::release_device_connection(
+  const std::string& device_path)
+{
+  if (device_connections_.empty())
+    return;
 
-  GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(connection_,
-                                                 BlueZ::SERVICE_NAME,
-                                                 adapter_path_.c_str(),
-                                                 BlueZ::ADAPTER_INTERFACE,
-                                                 "StartDiscovery",
-                                                 nullptr,
-                                                 nullptr,
-                                                 G_DBUS_CALL_FLAGS_NONE,
-                                                 -1,
-                                                 nullptr,
-                                                 &error);
+  size_t index = std::hash<std::string>()(device_path) %
+                 device_connections_.size();
+  DeviceConnection& device_connection = device_connections_[index];
 
-  if (!result)
+  std::lock_guard<std::mutex> lock(device_paths_mutex_);
+  if (device_connection.device_paths.erase(device_path) != 0)
   {
-    if (error)
-    {
-      std::cerr << "Failed to start discovery: " << error->message << std::endl;
-      g_error_free(error);
-    }
-    return false;
+    call_bus_daemon(device_connection.connection,
+                    "RemoveMatch",
+                    device_match_rule(device_path));
   }
+}
 
-  g_variant_unref(result);
-  is_scanning_ = true;
+StartupTimings BluetoothManager::get_startup_timings()
+{
+  std::lock_guard<std::mutex> lock(startup_mutex_);
+  return startup_timings_;
+}
 
-  return true;
+bool BluetoothManager::any_adapter_powered()
+{
+  std::lock_guard<std::mutex> lock(adapters_mutex_);
+  return !adapter_paths_locked(true).empty();
 }
 
-bool BluetoothManager::stop_discovery()
+void BluetoothManager::cleanup()
 {
-  if (!connection_ || adapter_path_.empty())
-    return false;
+  if (connection_)
+  {
+    stop_discovery();
 
-  std::lock_guard<std::mutex> lock(scan_mutex_);
+    // Fail whatever is still in flight now rather than at its deadline
+    cancel_group_.cancel();
 
-  if (!is_scanning_)
-    return true;
+    for (guint subscription : signal_subscriptions_)
+    {
+      g_dbus_connection_signal_unsubscribe(connection_, subscription);
+    }
+    signal_subscriptions_.clear();
 
-  GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(connection_,
-                                                 BlueZ::SERVICE_NAME,
-                                                 adapter_path_.c_str(),
-                                                 BlueZ::ADAPTER_INTERFACE,
-                                                 "StopDiscovery",
-                                                 nullptr,
-                                                 nullptr,
-                                                 G_DBUS_CALL_FLAGS_NONE,
-                                                 -1,
-                                                 nullptr,
-                                                 &error);
+    // Destroyed unlocked: it waits for the I/O thread, which takes
+    // monitor_mutex_ when an adapter appears
+    std::unique_ptr<AdvertisementMonitor> monitor;
+    {
+      std::lock_guard<std::mutex> lock(monitor_mutex_);
+      monitor = std::move(advertisement_monitor_);
+    }
+    monitor.reset();
 
-  if (!result)
-  {
-    if (error)
     {
-      // Ignore errors - discovery might already be stopped
-      g_error_free(error);
+      std::lock_guard<std::mutex> lock(gc_mutex_);
+      if (gc_timer_)
+      {
+        g_source_destroy(gc_timer_);
+        g_source_unref(gc_timer_);
+        gc_timer_ = nullptr;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(devices_mutex_);
+      devices_.clear();
+    }
+
+    // Devices still held elsewhere keep their own reference
+    for (const auto& device_connection : device_connections_)
+    {
+      g_dbus_connection_signal_unsubscribe(
+        device_connection.connection,
+        device_connection.properties_subscription);
+      g_object_unref(device_connection.connection);
     }
+    device_connections_.clear();
+
+    g_object_unref(connection_);
+    connection_ = nullptr;
   }
-  else
+
+  if (io_thread_.joinable())
   {
-    g_variant_unref(result);
+    // Quit from inside the loop; quitting from here could race the loop
+    // starting up and be lost
+    GSource* source = g_idle_source_new();
+    g_source_set_callback(
+      source,
+      [](gpointer loop) -> gboolean
+      {
+        g_main_loop_quit(static_cast<GMainLoop*>(loop));
+        return G_SOURCE_REMOVE;
+      },
+      main_loop_,
+      nullptr);
+    g_source_attach(source, context_);
+    g_source_unref(source);
+
+    io_thread_.join();
   }
-
-  is_scanning_ = false;
-  return true;
 }
 
-bool BluetoothManager::is_discovering()
+void BluetoothManager::io_thread_main(std::promise<void>* owned)
 {
-  std::lock_guard<std::mutex> lock(scan_mutex_);
-  return is_scanning_;
+  // Another thread may be holding the context for a moment to issue a call
+  while (!g_main_context_acquire(context_))
+  {
+    std::this_thread::yield();
+  }
+  Utils::ScopedMainContext scope(context_);
+  g_main_context_release(context_);
+  owned->set_value();
+
+  g_main_loop_run(main_loop_);
 }
 
-void BluetoothManager::on_interfaces_added(GDBusConnection* connection,
-                                           const gchar*     sender_name,
-                                           const gchar*     object_path,
-                                           const gchar*     interface_name,
-                                           const gchar*     signal_name,
-                                           GVariant*        parameters,
-                                           gpointer         user_data)
+bool BluetoothManager::load_managed_objects(GVariant* result)
 {
-  (void)connection;
-  (void)sender_name;
-  (void)interface_name;
-  (void)signal_name;
+  TRACE_SPAN("manager", "load_managed_objects");
 
-  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+  // Property dicts stay owned by `result`; the reply is unordered, so
+  // devices and characteristics are only built once every parent is known
+  std::vector<std::pair<std::string, GVariant*>> device_objects;
+  std::vector<std::pair<std::string, GVariant*>> characteristic_objects;
 
-  GVariant* interfaces;
+  ManagedObjects::for_each_object(
+    result,
+    BlueZ::ADAPTER_PATH_PREFIX,
+    [&](const char* object_path, GVariant* interfaces_dict)
+    {
+      GVariantIter* interfaces_iter;
+      g_variant_get(interfaces_dict, "a{sa{sv}}", &interfaces_iter);
+
+      const gchar* interface_name;
+      GVariant*    properties_dict;
+
+      while (g_variant_iter_loop(
+        interfaces_iter, "{&s@a{sv}}", &interface_name, &properties_dict))
+      {
+        if (g_strcmp0(interface_name, BlueZ::ADAPTER_INTERFACE) == 0)
+        {
+          add_adapter(object_path, properties_dict);
+        }
+        else if (g_strcmp0(interface_name, BlueZ::DEVICE_INTERFACE) == 0)
+        {
+          device_objects.emplace_back(object_path,
+                                      g_variant_ref(properties_dict));
+        }
+        else if (g_strcmp0(interface_name,
+                           BlueZ::GATT_CHARACTERISTIC_INTERFACE) == 0)
+        {
+          characteristic_objects.emplace_back(
+            object_path, g_variant_ref(properties_dict));
+        }
+      }
+
+      g_variant_iter_free(interfaces_iter);
+    });
+
+  // Adapters power up while the device and GATT tables are being built
+  request_power_on();
+
+  // Bonded, previously seen and connected devices go straight into devices_,
+  // so reconnecting after a restart does not need a scan first
+  // The same device seen by several adapters: keep the connected object.
+  // It is chosen before any device is built, so that only the kept object
+  // gets a device connection and its match rule.
+  struct Candidate
+  {
+    const std::string* path;
+    GVariant*          properties;
+    bool               connected;
+  };
+  std::map<std::string, Candidate> candidates;  // by address
+  for (const auto& object : device_objects)
+  {
+    char address[AdvertisementData::ADDRESS_LENGTH + 1];
+    if (!Advertisement::address_from_object_path(object.first.c_str(),
+                                                 address))
+      continue;
+
+    gboolean connected = FALSE;
+    g_variant_lookup(object.second, "Connected", "b", &connected);
+    {
+      std::lock_guard<std::mutex> lock(adapters_mutex_);
+      auto& paths = device_paths_[address];
+      if (std::find(paths.begin(), paths.end(), object.first) == paths.end())
+      {
+        paths.push_back(object.first);
+      }
+      // Age counts from startup; we cannot know when BlueZ last saw it
+      update_device_record_locked(object.first, object.second, true);
+      if (connected)
+      {
+        set_link_state_locked(object.first, true);
+      }
+    }
+
+    if (!device_has_target_service(object.second))
+      continue;
+
+    Candidate candidate = {&object.first, object.second, connected != FALSE};
+    auto      it        = candidates.find(address);
+    if (it == candidates.end())
+    {
+      candidates.emplace(address, candidate);
+    }
+    else if (candidate.connected && !it->second.connected)
+    {
+      it->second = candidate;
+    }
+  }
+
+  size_t loaded = 0;
+  for (const auto& entry : candidates)
+  {
+    const Candidate& candidate = entry.second;
+    auto             device    = std::make_shared<BluetoothDevice>(
+      device_connection(*candidate.path),
+      *candidate.path,
+      candidate.properties,
+      context_);
+
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    auto                        it = devices_.find(entry.first);
+    if (it == devices_.end())
+    {
+      devices_.emplace(entry.first, device);
+      ++loaded;
+    }
+    else if (candidate.connected && !it->second->is_connected())
+    {
+      it->second = device;
+    }
+  }
+
+  // Grouped per device, which then links its GATT table once
+  std::map<std::shared_ptr<BluetoothDevice>,
+           std::vector<std::pair<std::string, GVariant*>>>
+         device_characteristics;
+  size_t characteristics = 0;
+  for (const auto& object : characteristic_objects)
+  {
+    char address[AdvertisementData::ADDRESS_LENGTH + 1];
+    if (Advertisement::address_from_object_path(object.first.c_str(),
+                                                address))
+    {
+      auto device = get_device(address);
+      if (device && g_str_has_prefix(object.first.c_str(),
+                                     (device->get_object_path() + "/").c_str()))
+      {
+        device_characteristics[device].push_back(object);
+        ++characteristics;
+      }
+    }
+  }
+  for (const auto& entry : device_characteristics)
+  {
+    entry.first->add_characteristics(entry.second);
+  }
+
+  for (auto& object : device_objects)
+  {
+    g_variant_unref(object.second);
+  }
+  for (auto& object : characteristic_objects)
+  {
+    g_variant_unref(object.second);
+  }
+
+  LOG_INFO("Loaded " + std::to_string(loaded) + " known devices and " +
+           std::to_string(characteristics) + " characteristics");
+
+  return !default_adapter().empty();
+}
+
+void BluetoothManager::add_adapter(const std::string& adapter_path,
+                                   GVariant*          properties)
+{
+  gboolean powered     = FALSE;
+  gboolean discovering = FALSE;
+  if (properties)
+  {
+    g_variant_lookup(properties, "Powered", "b", &powered);
+    g_variant_lookup(properties, "Discovering", "b", &discovering);
+  }
+
+  std::lock_guard<std::mutex> lock(adapters_mutex_);
+  for (const auto& adapter : adapters_)
+  {
+    if (adapter.path == adapter_path)
+      return;
+  }
+
+  AdapterStats adapter = {};
+  adapter.path         = adapter_path;
+  adapter.powered      = powered;
+  adapter.discovering  = discovering;
+  adapters_.push_back(adapter);
+
+  if (adapter_path_.empty())
+  {
+    adapter_path_ = adapter_path;
+  }
+
+  LOG_INFO("Adapter added: " + adapter_path);
+}
+
+std::string BluetoothManager::default_adapter()
+{
+  std::lock_guard<std::mutex> lock(adapters_mutex_);
+  return adapter_path_;
+}
+
+void BluetoothManager::remove_adapter(const std::string& adapter_path)
+{
+  std::lock_guard<std::mutex> lock(adapters_mutex_);
+  adapters_.erase(std::remove_if(adapters_.begin(),
+                                 adapters_.end(),
+                                 [&](const AdapterStats& adapter)
+                                 { return adapter.path == adapter_path; }),
+                  adapters_.end());
+
+  // The default adapter moves on to the next remaining controller
+  if (adapter_path_ == adapter_path)
+  {
+    adapter_path_ = adapters_.empty() ? "" : adapters_.front().path;
+  }
+
+  LOG_INFO("Adapter removed: " + adapter_path);
+}
+
+AdapterStats* BluetoothManager::find_adapter_locked(
+  const std::string& device_path)
+{
+  // Device paths look like /org/bluez/hciN/dev_XX_XX_XX_XX_XX_XX
+  size_t      end = device_path.find("/dev_");
+  std::string adapter_path =
+    end == std::string::npos ? device_path : device_path.substr(0, end);
+
+  for (auto& adapter : adapters_)
+  {
+    if (adapter.path == adapter_path)
+      return &adapter;
+  }
+  return nullptr;
+}
+
+void BluetoothManager::set_link_state_locked(const std::string& device_path,
+                                             bool               connected)
+{
+  bool changed = connected ? connected_paths_.insert(device_path).second
+                           : connected_paths_.erase(device_path) > 0;
+  if (!changed)
+    return;
+
+  AdapterStats* adapter = find_adapter_locked(device_path);
+  if (adapter)
+  {
+    if (connected)
+    {
+      ++adapter->active_links;
+    }
+    else if (adapter->active_links > 0)
+    {
+      --adapter->active_links;
+    }
+  }
+}
+
+std::vector<std::string> BluetoothManager::adapter_paths_locked(
+  bool powered_only) const
+{
+  std::vector<std::string> paths;
+  for (const auto& adapter : adapters_)
+  {
+    if (!powered_only || adapter.powered)
+    {
+      paths.push_back(adapter.path);
+    }
+  }
+  return paths;
+}
+
+bool BluetoothManager::set_adapter_powered(const std::string& adapter_path,
+                                           bool               powered)
+{
+  GError* error = nullptr;
+
+  GVariant* powered_value = g_variant_new_boolean(powered);
+  static const DBusCall::Method set_call{
+    "BluetoothManager", BlueZ::PROPERTIES_INTERFACE, "Set"};
+  GVariant* result        = DBusCall::call_sync(
+    connection_,
+    adapter_path.c_str(),
+    set_call,
+    g_variant_new("(ssv)", BlueZ::ADAPTER_INTERFACE, "Powered", powered_value),
+    nullptr,
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error);
+
+  if (!result)
+  {
+    if (error)
+    {
+      LOG_ERROR(std::string("Failed to power ") + (powered ? "on " : "off ") +
+                adapter_path + ": " + error->message);
+      g_error_free(error);
+    }
+    return false;
+  }
+
+  g_variant_unref(result);
+  return true;
+}
+
+bool BluetoothManager::power_on_adapter()
+{
+  if (!connection_ || default_adapter().empty())
+    return false;
+
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    paths = adapter_paths_locked(false);
+  }
+
+  for (const auto& path : paths)
+  {
+    set_adapter_powered(path, true);
+  }
+
+  // Wait for PropertiesChanged(Powered) instead of sleeping a fixed time
+  std::vector<std::string> pending;
+  {
+    std::unique_lock<std::mutex> lock(adapters_mutex_);
+    auto                         all_powered = [&]
+    {
+      pending.clear();
+      for (const auto& path : paths)
+      {
+        AdapterStats* adapter = find_adapter_locked(path);
+        if (adapter && !adapter->powered)
+        {
+          pending.push_back(path);
+        }
+      }
+      return pending.empty();
+    };
+    adapters_cv_.wait_for(
+      lock, std::chrono::milliseconds(POWER_ON_TIMEOUT_MS), all_powered);
+  }
+
+  // Signals only arrive while the context is iterated, so confirm the rest
+  // directly. A dead dongle should not take the others down with it.
+  for (const auto& path : pending)
+  {
+    bool powered = is_adapter_powered(path);
+
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    AdapterStats*               adapter = find_adapter_locked(path);
+    if (adapter)
+    {
+      adapter->powered = powered;
+    }
+  }
+
+  return any_adapter_powered();
+}
+
+bool BluetoothManager::power_off_adapter()
+{
+  if (!connection_ || default_adapter().empty())
+    return false;
+
+  // Stop discovery first
+  stop_discovery();
+
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    paths = adapter_paths_locked(false);
+  }
+
+  bool success = true;
+  for (const auto& path : paths)
+  {
+    success = set_adapter_powered(path, false) && success;
+  }
+  return success;
+}
+
+bool BluetoothManager::is_adapter_powered()
+{
+  std::string adapter_path = default_adapter();
+  if (!connection_ || adapter_path.empty())
+    return false;
+
+  return is_adapter_powered(adapter_path);
+}
+
+bool BluetoothManager::is_adapter_powered(const std::string& adapter_path)
+{
+  static const DBusCall::Method get_call{
+    "BluetoothManager", BlueZ::PROPERTIES_INTERFACE, "Get"};
+  GError*   error  = nullptr;
+  GVariant* result = DBusCall::call_sync(
+    connection_,
+    adapter_path.c_str(),
+    get_call,
+    g_variant_new("(ss)", BlueZ::ADAPTER_INTERFACE, "Powered"),
+    G_VARIANT_TYPE("(v)"),
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error);
+
+  if (!result)
+  {
+    if (error)
+    {
+      g_error_free(error);
+    }
+    return false;
+  }
+
+  GVariant* value;
+  g_variant_get(result, "(v)", &value);
+
+  gboolean powered = g_variant_get_boolean(value);
+
+  g_variant_unref(value);
+  g_variant_unref(result);
+
+  return powered;
+}
+
+bool BluetoothManager::start_discovery(
+  const std::vector<std::string>& service_uuids)
+{
+  if (!connection_ || default_adapter().empty())
+    return false;
+
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+
+  if (is_scanning_)
+  {
+    stop_discovery_locked();
+  }
+
+  target_service_uuids_ = service_uuids;
+
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> adapters_lock(adapters_mutex_);
+    paths = adapter_paths_locked(true);
+  }
+
+  // Not fatal: discovery still works without DuplicateData, just with
+  // advertisement updates deduplicated by bluetoothd. bluetoothd keeps the
+  // filter across the Start/StopDiscovery calls of later scan windows.
+  for (const auto& path : paths)
+  {
+    set_discovery_filter(path, service_uuids);
+  }
+
+  scan_sample_time_          = std::chrono::steady_clock::now();
+  scan_sample_notifications_ = NotificationHandler::get_total_received();
+  scan_window_open_          = false;
+  scan_suspended_            = false;
+  scan_next_window_          = scan_sample_time_;
+
+  // A connect already in progress defers the first window
+  const char* reason = scan_suspend_reason_locked();
+  if (reason)
+  {
+    LOG_INFO(std::string("Discovery deferred: ") + reason);
+    is_scanning_    = true;
+    scan_suspended_ = true;
+    ++scan_stats_.suspensions;
+    schedule_scan_check_locked(SCAN_RECHECK_MS);
+    return true;
+  }
+
+  // Scan on every powered adapter so each one builds its own candidate list
+  size_t started = 0;
+  for (const auto& path : paths)
+  {
+    static const DBusCall::Method start_discovery_call{
+      "BluetoothManager", BlueZ::ADAPTER_INTERFACE, "StartDiscovery"};
+    GError*   error  = nullptr;
+    GVariant* result =
+      DBusCall::call_sync(connection_,
+                          path.c_str(),
+                          start_discovery_call,
+                          nullptr,
+                          nullptr,
+                          DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                          &error);
+
+    if (!result)
+    {
+      if (error)
+      {
+        LOG_ERROR("Failed to start discovery on " + path + ": " +
+                  std::string(error->message));
+        g_error_free(error);
+      }
+      continue;
+    }
+
+    g_variant_unref(result);
+    ++started;
+  }
+
+  is_scanning_ = started > 0;
+  if (is_scanning_)
+  {
+    open_scan_window_locked();
+    run_scan_scheduler_locked();
+  }
+  return is_scanning_;
+}
+
+bool BluetoothManager::set_discovery_filter(
+  const std::string&              adapter_path,
+  const std::vector<std::string>& service_uuids)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+  // Report every advertisement rather than only the first one per device
+  g_variant_builder_add(
+    &builder, "{sv}", "DuplicateData", g_variant_new_boolean(TRUE));
+
+  if (!service_uuids.empty())
+  {
+    GVariantBuilder uuids_builder;
+    g_variant_builder_init(&uuids_builder, G_VARIANT_TYPE("as"));
+    for (const auto& uuid : service_uuids)
+    {
+      g_variant_builder_add(&uuids_builder, "s", uuid.c_str());
+    }
+    g_variant_builder_add(
+      &builder, "{sv}", "UUIDs", g_variant_builder_end(&uuids_builder));
+  }
+
+  static const DBusCall::Method set_discovery_filter_call{
+    "BluetoothManager", BlueZ::ADAPTER_INTERFACE, "SetDiscoveryFilter"};
+  GError*   error = nullptr;
+  GVariant* result = DBusCall::call_sync(
+    connection_,
+    adapter_path.c_str(),
+    set_discovery_filter_call,
+    g_variant_new("(@a{sv})", g_variant_builder_end(&builder)),
+    nullptr,
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error);
+
+  if (!result)
+  {
+    if (error)
+    {
+      LOG_ERROR("Failed to set discovery filter: " +
+                std::string(error->message));
+      g_error_free(error);
+    }
+    return false;
+  }
+
+  g_variant_unref(result);
+  return true;
+}
+
+bool BluetoothManager::stop_discovery()
+{
+  if (!connection_ || default_adapter().empty())
+    return false;
+
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  return stop_discovery_locked();
+}
+
+bool BluetoothManager::stop_discovery_locked()
+{
+  if (!is_scanning_)
+    return true;
+
+  if (scan_timer_)
+  {
+    g_source_destroy(scan_timer_);
+    g_source_unref(scan_timer_);
+    scan_timer_ = nullptr;
+  }
+  sample_notifications_locked();
+
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    paths = adapter_paths_locked(false);
+  }
+
+  for (const auto& path : paths)
+  {
+    static const DBusCall::Method stop_discovery_call{
+      "BluetoothManager", BlueZ::ADAPTER_INTERFACE, "StopDiscovery"};
+    GError*   error  = nullptr;
+    GVariant* result =
+      DBusCall::call_sync(connection_,
+                          path.c_str(),
+                          stop_discovery_call,
+                          nullptr,
+                          nullptr,
+                          DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                          &error);
+
+    if (!result)
+    {
+      if (error)
+      {
+        // Ignore errors - discovery might already be stopped
+        g_error_free(error);
+      }
+    }
+    else
+    {
+      g_variant_unref(result);
+    }
+  }
+
+  is_scanning_      = false;
+  scan_window_open_ = false;
+  return true;
+}
+
+bool BluetoothManager::is_discovering()
+{
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  return is_scanning_;
+}
+
+void BluetoothManager::set_scan_schedule(const ScanSchedule& schedule)
+{
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  scan_schedule_ = schedule;
+
+  // Apply the new schedule right away rather than at the next check
+  if (is_scanning_)
+  {
+    schedule_scan_check_locked(0);
+  }
+}
+
+ScanSchedule BluetoothManager::get_scan_schedule()
+{
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  return scan_schedule_;
+}
+
+ScanStats BluetoothManager::get_scan_stats()
+{
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  sample_notifications_locked();
+  return scan_stats_;
+}
+
+void BluetoothManager::print_scan_stats()
+{
+  ScanSchedule schedule = get_scan_schedule();
+  ScanStats    stats    = get_scan_stats();
+
+  char line[160];
+  if (schedule.window.count() > 0 && schedule.window < schedule.interval)
+  {
+    snprintf(line,
+             sizeof(line),
+             "Scan schedule: %lld ms every %lld ms",
+             static_cast<long long>(schedule.window.count()),
+             static_cast<long long>(schedule.interval.count()));
+  }
+  else
+  {
+    snprintf(line, sizeof(line), "Scan schedule: continuous");
+  }
+  Utils::print_with_timestamp(line);
+
+  snprintf(line,
+           sizeof(line),
+           "  windows: %llu started, %llu cut short, %llu suspensions",
+           static_cast<unsigned long long>(stats.windows_started),
+           static_cast<unsigned long long>(stats.windows_cut_short),
+           static_cast<unsigned long long>(stats.suspensions));
+  std::cout << line << std::endl;
+
+  snprintf(line,
+           sizeof(line),
+           "  notifications/s: %.1f while scanning (%.1f s), "
+           "%.1f while paused (%.1f s)",
+           stats.rate_while_scanning(),
+           stats.time_scanning.count(),
+           stats.rate_while_paused(),
+           stats.time_paused.count());
+  std::cout << line << std::endl;
+}
+
+void BluetoothManager::poke_scan_scheduler()
+{
+  std::lock_guard<std::mutex> lock(scan_mutex_);
+  if (is_scanning_)
+  {
+    schedule_scan_check_locked(0);
+  }
+}
+
+gboolean BluetoothManager::on_scan_timer(gpointer user_data)
+{
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+
+  std::lock_guard<std::mutex> lock(manager->scan_mutex_);
+
+  // The timer may have been replaced or stopped while this dispatch waited
+  // for the lock
+  if (g_main_current_source() != manager->scan_timer_)
+    return G_SOURCE_REMOVE;
+
+  g_source_unref(manager->scan_timer_);
+  manager->scan_timer_ = nullptr;
+
+  manager->run_scan_scheduler_locked();
+  return G_SOURCE_REMOVE;
+}
+
+void BluetoothManager::schedule_scan_check_locked(guint delay_ms)
+{
+  if (scan_timer_)
+  {
+    g_source_destroy(scan_timer_);
+    g_source_unref(scan_timer_);
+  }
+
+  scan_timer_ = g_timeout_source_new(delay_ms);
+  g_source_set_callback(scan_timer_, on_scan_timer, this, nullptr);
+  g_source_attach(scan_timer_, context_);
+}
+
+void BluetoothManager::run_scan_scheduler_locked()
+{
+  sample_notifications_locked();
+  if (!is_scanning_)
+    return;
+
+  using std::chrono::milliseconds;
+
+  auto now         = std::chrono::steady_clock::now();
+  bool duty_cycled = scan_schedule_.window.count() > 0 &&
+                     scan_schedule_.window < scan_schedule_.interval;
+  auto until = [&](std::chrono::steady_clock::time_point deadline)
+  {
+    auto remaining =
+      std::chrono::duration_cast<milliseconds>(deadline - now).count();
+    return static_cast<guint>(
+      std::clamp<long long>(remaining, 0, SCAN_RECHECK_MS));
+  };
+
+  // Re-checked at least every SCAN_RECHECK_MS, which is also the sampling
+  // period for the notification rate
+  const char* reason = scan_suspend_reason_locked();
+  if (reason && !scan_suspended_)
+  {
+    LOG_DEBUG(std::string("Pausing discovery: ") + reason);
+    scan_suspended_ = true;
+    ++scan_stats_.suspensions;
+  }
+
+  if (scan_window_open_)
+  {
+    if (reason || (duty_cycled && now >= scan_window_end_))
+    {
+      static const DBusCall::Method stop_discovery_call{
+        "BluetoothManager", BlueZ::ADAPTER_INTERFACE, "StopDiscovery"};
+      send_discovery_method_locked(stop_discovery_call);
+      scan_window_open_ = false;
+      if (reason)
+      {
+        ++scan_stats_.windows_cut_short;
+      }
+      schedule_scan_check_locked(reason ? SCAN_RECHECK_MS
+                                        : until(scan_next_window_));
+      return;
+    }
+
+    schedule_scan_check_locked(duty_cycled ? until(scan_window_end_)
+                                           : SCAN_RECHECK_MS);
+    return;
+  }
+
+  if (reason || (duty_cycled && now < scan_next_window_))
+  {
+    schedule_scan_check_locked(reason ? SCAN_RECHECK_MS
+                                      : until(scan_next_window_));
+    return;
+  }
+
+  static const DBusCall::Method start_discovery_call{
+    "BluetoothManager", BlueZ::ADAPTER_INTERFACE, "StartDiscovery"};
+  send_discovery_method_locked(start_discovery_call);
+  open_scan_window_locked();
+  schedule_scan_check_locked(duty_cycled ? until(scan_window_end_)
+                                         : SCAN_RECHECK_MS);
+}
+
+void BluetoothManager::open_scan_window_locked()
+{
+  auto now          = std::chrono::steady_clock::now();
+  scan_window_open_ = true;
+  scan_suspended_   = false;
+  scan_window_end_  = now + scan_schedule_.window;
+  scan_next_window_ = now + scan_schedule_.interval;
+  ++scan_stats_.windows_started;
+}
+
+void BluetoothManager::sample_notifications_locked()
+{
+  auto     now     = std::chrono::steady_clock::now();
+  uint64_t count   = NotificationHandler::get_total_received();
+  auto     elapsed = std::chrono::duration<double>(now - scan_sample_time_);
+  uint64_t delta   = count - scan_sample_notifications_;
+
+  // Attribute the interval to the state the radio was in during it
+  if (scan_window_open_)
+  {
+    scan_stats_.time_scanning += elapsed;
+    scan_stats_.notifications_scanning += delta;
+  }
+  else if (is_scanning_)
+  {
+    scan_stats_.time_paused += elapsed;
+    scan_stats_.notifications_paused += delta;
+  }
+
+  if (elapsed.count() > 0)
+  {
+    notification_rate_ = delta / elapsed.count();
+  }
+  scan_sample_time_          = now;
+  scan_sample_notifications_ = count;
+}
+
+const char* BluetoothManager::scan_suspend_reason_locked()
+{
+  if (scan_schedule_.pause_while_connecting)
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    for (const auto& adapter : adapters_)
+    {
+      if (adapter.pending_connects > 0)
+        return "connection in progress";
+    }
+  }
+
+  if (scan_schedule_.max_notification_rate > 0 &&
+      notification_rate_ > scan_schedule_.max_notification_rate)
+  {
+    return "notification rate above limit";
+  }
+
+  return nullptr;
+}
+
+void BluetoothManager::send_discovery_method_locked(
+  const DBusCall::Method& method)
+{
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    paths = adapter_paths_locked(true);
+  }
+
+  // Asynchronous so scan windows never block signal dispatch
+  for (const auto& path : paths)
+  {
+    DBusCall::call(connection_,
+                   path.c_str(),
+                   method,
+                   nullptr,
+                   nullptr,
+                   DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                   [method_name = method.method_name,
+                    path](GVariant* reply, GError* error)
+                   {
+                     (void)reply;
+                     if (error)
+                     {
+                       LOG_DEBUG(std::string(method_name) + " failed on " +
+                                 path + ": " + error->message);
+                     }
+                   },
+                   cancel_group_.current().get(),
+                   context_);
+  }
+}
+
+void BluetoothManager::on_interfaces_added(GDBusConnection* connection,
+                                           const gchar*     sender_name,
+                                           const gchar*     object_path,
+                                           const gchar*     interface_name,
+                                           const gchar*     signal_name,
+                                           GVariant*        parameters,
+                                           gpointer         user_data)
+{
+  (void)connection;
+  (void)sender_name;
+  (void)interface_name;
+  (void)signal_name;
+
+  TRACE_SPAN("signal", "InterfacesAdded", object_path);
+
+  static auto& dispatch_time = Metrics::signal_dispatch("InterfacesAdded");
+  auto         start         = std::chrono::steady_clock::now();
+
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+
+  GVariant* interfaces;
   g_variant_get(parameters, "(&o@a{sa{sv}})", &object_path, &interfaces);
 
-  manager->handle_interfaces_added(object_path, interfaces);
+  manager->handle_interfaces_added(object_path, interfaces);
+
+  g_variant_unref(interfaces);
+
+  dispatch_time.observe_since(start);
+}
+
+void BluetoothManager::on_interfaces_removed(GDBusConnection* connection,
+                                             const gchar*     sender_name,
+                                             const gchar*     object_path,
+                                             const gchar*     interface_name,
+                                             const gchar*     signal_name,
+                                             GVariant*        parameters,
+                                             gpointer         user_data)
+{
+  (void)connection;
+  (void)sender_name;
+  (void)interface_name;
+  (void)signal_name;
+
+  TRACE_SPAN("signal", "InterfacesRemoved", object_path);
+
+  static auto& dispatch_time = Metrics::signal_dispatch("InterfacesRemoved");
+  auto         start         = std::chrono::steady_clock::now();
+
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+
+  GVariant* interfaces_array;
+  g_variant_get(parameters, "(&o@as)", &object_path, &interfaces_array);
+
+  GVariantIter iter;
+  g_variant_iter_init(&iter, interfaces_array);
+  const gchar*             interface;
+  std::vector<std::string> interfaces;
+
+  while (g_variant_iter_loop(&iter, "&s", &interface))
+  {
+    interfaces.push_back(interface);
+  }
+
+  manager->handle_interfaces_removed(object_path, interfaces);
+
+  g_variant_unref(interfaces_array);
+
+  dispatch_time.observe_since(start);
+}
+
+void BluetoothManager::on_properties_changed(GDBusConnection* connection,
+                                             const gchar*     sender_name,
+                                             const gchar*     object_path,
+                                             const gchar*     interface_name,
+                                             const gchar*     signal_name,
+                                             GVariant*        parameters,
+                                             gpointer         user_data)
+{
+  (void)connection;
+  (void)sender_name;
+  (void)signal_name;
+
+  TRACE_SPAN("signal", "PropertiesChanged", object_path);
+
+  static auto& dispatch_time = Metrics::signal_dispatch("PropertiesChanged");
+  auto         start         = std::chrono::steady_clock::now();
+
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+
+  const gchar* changed_interface;
+  GVariant*    changed_properties;
+  GVariant*    invalidated_properties;
+
+  g_variant_get(parameters,
+                "(&s@a{sv}@as)",
+                &changed_interface,
+                &changed_properties,
+                &invalidated_properties);
+
+  if (g_strcmp0(changed_interface, BlueZ::DEVICE_INTERFACE) == 0)
+  {
+    manager->handle_advertisement(object_path, changed_properties);
+
+    // An RSSI update means the device is advertising right now
+    gint16 rssi;
+    if (g_variant_lookup(changed_properties, "RSSI", "n", &rssi))
+    {
+      manager->try_auto_connect(object_path, changed_properties);
+    }
+  }
+
+  manager->handle_properties_changed(
+    object_path, changed_interface, changed_properties);
+
+  g_variant_unref(changed_properties);
+  g_variant_unref(invalidated_properties);
+
+  dispatch_time.observe_since(start);
+}
+
+void BluetoothManager::handle_interfaces_added(const std::string& object_path,
+                                               GVariant*          interfaces)
+{
+  GVariantIter iter;
+  g_variant_iter_init(&iter, interfaces);
+
+  const gchar* interface_name;
+  GVariant*    properties;
+
+  bool is_device = false;
 
-  g_variant_unref(interfaces);
+  while (g_variant_iter_loop(&iter, "{&s@a{sv}}", &interface_name, &properties))
+  {
+    if (g_strcmp0(interface_name, BlueZ::ADAPTER_INTERFACE) == 0)
+    {
+      // Hot-plugged controller
+      add_adapter(object_path, properties);
+    }
+    else if (g_strcmp0(interface_name, BlueZ::DEVICE_INTERFACE) == 0)
+    {
+      // Breaking out of g_variant_iter_loop() leaves `properties` to us
+      is_device = true;
+      break;
+    }
+  }
+
+  if (!is_device)
+    return;
+
+  handle_advertisement(object_path.c_str(), properties);
+  add_device(object_path, properties);
+  try_auto_connect(object_path, properties);
+  g_variant_unref(properties);
 }
 
-void BluetoothManager::on_interfaces_removed(GDBusConnection* connection,
-                                             const gchar*     sender_name,
-                                             const gchar*     object_path,
-                                             const gchar*     interface_name,
-                                             const gchar*     signal_name,
-                                             GVariant*        parameters,
-                                             gpointer         user_data)
+void BluetoothManager::add_device(const std::string& object_path,
+                                  GVariant*          properties)
 {
-  (void)connection;
-  (void)sender_name;
-  (void)interface_name;
-  (void)signal_name;
+  char address[AdvertisementData::ADDRESS_LENGTH + 1];
+  if (!Advertisement::address_from_object_path(object_path.c_str(), address))
+    return;
 
-  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    auto& paths = device_paths_[address];
+    if (std::find(paths.begin(), paths.end(), object_path) == paths.end())
+    {
+      paths.push_back(object_path);
 
-  GVariant* interfaces_array;
-  g_variant_get(parameters, "(&o@as)", &object_path, &interfaces_array);
+      AdapterStats* adapter = find_adapter_locked(object_path);
+      if (adapter)
+      {
+        ++adapter->devices_seen;
+      }
+    }
+    update_device_record_locked(object_path, properties, true);
+  }
+
+  {
+    // Already known through another adapter
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    if (devices_.count(address))
+      return;
+  }
+
+  // Check if device matches target service UUIDs (if specified)
+  if (!device_has_target_service(properties))
+    return;
+
+  // Built from the signal's properties, no Get round trips
+  auto device = std::make_shared<BluetoothDevice>(
+    device_connection(object_path), object_path, properties, context_);
+  {
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    devices_.emplace(address, device);
+  }
+  LOG_INFO("Device discovered: " + device->get_name() + " (" + address + ")");
+}
+
+void BluetoothManager::handle_interfaces_removed(
+  const std::string&              object_path,
+  const std::vector<std::string>& interfaces)
+{
+  if (std::find(interfaces.begin(),
+                interfaces.end(),
+                BlueZ::ADAPTER_INTERFACE) != interfaces.end())
+  {
+    remove_adapter(object_path);
+    return;
+  }
+
+  char address[AdvertisementData::ADDRESS_LENGTH + 1];
+  if (!Advertisement::address_from_object_path(object_path.c_str(), address))
+    return;
+
+  release_device_connection(object_path);
+
+  // Another adapter may still see the device
+  std::string other_path;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    set_link_state_locked(object_path, false);
+    device_records_.erase(object_path);
+
+    auto it = device_paths_.find(address);
+    if (it != device_paths_.end())
+    {
+      auto& paths = it->second;
+      paths.erase(std::remove(paths.begin(), paths.end(), object_path),
+                  paths.end());
+      if (paths.empty())
+      {
+        device_paths_.erase(it);
+      }
+      else
+      {
+        other_path = paths.front();
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    auto                        it = devices_.find(address);
+    if (it == devices_.end() || it->second->get_object_path() != object_path)
+      return;
+
+    LOG_INFO("Device removed: " + it->second->get_name() + " (" + it->first +
+             ")");
+    devices_.erase(it);
+  }
+
+  if (other_path.empty())
+  {
+    std::lock_guard<std::mutex> lock(advertisement_mutex_);
+    advertisements_.erase(address);
+    return;
+  }
+
+  auto device = std::make_shared<BluetoothDevice>(
+    device_connection(other_path), other_path, context_);
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  devices_.emplace(address, device);
+}
+
+void BluetoothManager::handle_properties_changed(
+  const std::string& object_path,
+  const std::string& interface_name,
+  GVariant*          changed_properties)
+{
+  if (interface_name == BlueZ::ADAPTER_INTERFACE)
+  {
+    gboolean value;
+    bool     powered_on = false;
+    {
+      std::lock_guard<std::mutex> lock(adapters_mutex_);
+      AdapterStats*               adapter = find_adapter_locked(object_path);
+      if (!adapter)
+        return;
+
+      if (g_variant_lookup(changed_properties, "Powered", "b", &value))
+      {
+        powered_on       = value && !adapter->powered;
+        adapter->powered = value;
+        adapters_cv_.notify_all();
+      }
+      if (g_variant_lookup(changed_properties, "Discovering", "b", &value))
+      {
+        adapter->discovering = value;
+      }
+    }
+
+    check_startup_powered();
+
+    // Adapters powered after monitors were added still get them
+    if (powered_on)
+    {
+      register_advertisement_monitors();
+    }
+    return;
+  }
+
+  if (interface_name == BlueZ::GATT_CHARACTERISTIC_INTERFACE)
+  {
+    invalidate_cached_read(object_path, changed_properties);
+    return;
+  }
+
+  if (interface_name != BlueZ::DEVICE_INTERFACE)
+    return;
+
+  {
+    // Link counts and records cover every device, not only those in devices_
+    gboolean                    connected;
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    bool                        has_connected =
+      g_variant_lookup(changed_properties, "Connected", "b", &connected);
+    if (has_connected)
+    {
+      set_link_state_locked(object_path, connected);
+    }
+
+    // Advertisements and link changes both mean the device is around
+    update_device_record_locked(
+      object_path,
+      changed_properties,
+      has_connected || has_advertisement_property(changed_properties));
+  }
+
+  // Find the device and notify it of property changes
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  for (auto& pair : devices_)
+  {
+    if (pair.second->get_object_path() == object_path)
+    {
+      // Check for connection state changes
+      GVariantIter iter;
+      g_variant_iter_init(&iter, changed_properties);
+      const gchar* key;
+      GVariant*    value;
+
+      while (g_variant_iter_loop(&iter, "{&sv}", &key, &value))
+      {
+        if (g_strcmp0(key, "Connected") == 0)
+        {
+          pair.second->update_connection_state(g_variant_get_boolean(value));
+        }
+        else if (g_strcmp0(key, "ServicesResolved") == 0)
+        {
+          pair.second->update_services_resolved_state(
+            g_variant_get_boolean(value));
+        }
+      }
+      break;
+    }
+  }
+}
+
+void BluetoothManager::invalidate_cached_read(
+  const std::string& char_path,
+  GVariant*          changed_properties)
+{
+  // A notification, indication or another client's read replaced the value
+  GVariant* value =
+    g_variant_lookup_value(changed_properties, "Value", nullptr);
+  if (!value)
+    return;
+  g_variant_unref(value);
+
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  for (auto& pair : devices_)
+  {
+    const std::string& device_path = pair.second->get_object_path();
+    if (char_path.size() <= device_path.size() ||
+        char_path.compare(0, device_path.size(), device_path) != 0 ||
+        char_path[device_path.size()] != '/')
+    {
+      continue;
+    }
+
+    auto characteristic = pair.second->get_characteristic_by_path(char_path);
+    if (characteristic)
+    {
+      characteristic->invalidate_read_cache();
+    }
+    break;
+  }
+}
+
+void BluetoothManager::handle_advertisement(const gchar* object_path,
+                                            GVariant*    properties)
+{
+  char address[AdvertisementData::ADDRESS_LENGTH + 1];
+  if (!Advertisement::address_from_object_path(object_path, address))
+    return;
+
+  AdvertisementData                            snapshot;
+  std::shared_ptr<const AdvertisementCallback> callback;
+  {
+    std::lock_guard<std::mutex> lock(advertisement_mutex_);
+
+    auto it = advertisements_.find(std::string_view(address));
+    if (it == advertisements_.end())
+    {
+      AdvertisementData data;
+      if (!Advertisement::parse_properties(properties, data))
+        return;
+
+      std::memcpy(data.address, address, sizeof(address));
+      it = advertisements_.emplace(address, data).first;
+    }
+    else if (!Advertisement::parse_properties(properties, it->second))
+    {
+      return;
+    }
+
+    ++advertisement_count_;
+    if (!advertisement_callback_)
+      return;
+
+    snapshot = it->second;
+    callback = advertisement_callback_;
+  }
+
+  (*callback)(snapshot);
+}
+
+bool BluetoothManager::device_has_target_service(GVariant* properties)
+{
+  if (target_service_uuids_.empty())
+    return true;
+
+  GVariantIter* uuids_iter;
+  if (!g_variant_lookup(properties, "UUIDs", "as", &uuids_iter))
+    return false;
+
+  const gchar* uuid;
+
+  bool has_target_service = false;
+  while (!has_target_service && g_variant_iter_next(uuids_iter, "&s", &uuid))
+  {
+    for (const auto& target_uuid : target_service_uuids_)
+    {
+      if (g_ascii_strcasecmp(uuid, target_uuid.c_str()) == 0)
+      {
+        has_target_service = true;
+        break;
+      }
+    }
+  }
+
+  g_variant_iter_free(uuids_iter);
+
+  return has_target_service;
+}
+
+std::vector<std::shared_ptr<BluetoothDevice>>
+BluetoothManager::get_discovered_devices()
+{
+  std::vector<std::shared_ptr<BluetoothDevice>> device_list;
+
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  for (const auto& pair : devices_)
+  {
+    device_list.push_back(pair.second);
+  }
+
+  return device_list;
+}
+
+std::shared_ptr<BluetoothDevice> BluetoothManager::get_device(
+  const std::string& address)
+{
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  auto                        it = devices_.find(address);
+  if (it != devices_.end())
+  {
+    return it->second;
+  }
+  return nullptr;
+}
+
+bool BluetoothManager::remove_device(const std::string& address)
+{
+  std::shared_ptr<BluetoothDevice> device;
+  {
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    auto                        it = devices_.find(address);
+    if (it == devices_.end())
+      return false;
+
+    device = it->second;
+    devices_.erase(it);
+  }
+
+  // Disconnect if connected
+  if (device->is_connected())
+  {
+    device->disconnect();
+  }
+  return true;
+}
+
+std::shared_ptr<BluetoothDevice> BluetoothManager::connect_device(
+  const std::string& address)
+{
+  TRACE_SPAN("manager", "connect_device", address);
+
+  std::string   device_path;
+  bool          already_connected = false;
+  AdapterStats* selected          = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    auto                        it = device_paths_.find(address);
+    if (it == device_paths_.end())
+    {
+      LOG_ERROR("Device not seen by any adapter: " + address);
+      return nullptr;
+    }
+
+    for (const auto& path : it->second)
+    {
+      if (connected_paths_.count(path))
+      {
+        device_path       = path;
+        already_connected = true;
+        break;
+      }
+
+      AdapterStats* adapter = find_adapter_locked(path);
+      if (adapter && adapter->powered &&
+          (!selected || adapter->load() < selected->load()))
+      {
+        selected    = adapter;
+        device_path = path;
+      }
+    }
+
+    if (device_path.empty())
+    {
+      LOG_ERROR("No powered adapter can reach " + address);
+      return nullptr;
+    }
+    if (!already_connected)
+    {
+      ++selected->pending_connects;
+    }
+  }
+
+  // Rebind the device to the chosen adapter's object if it differs
+  std::shared_ptr<BluetoothDevice> device = get_device(address);
+  if (!device || device->get_object_path() != device_path)
+  {
+    device = std::make_shared<BluetoothDevice>(
+      device_connection(device_path), device_path, context_);
+
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    devices_[address] = device;
+  }
+
+  if (already_connected)
+    return device;
+
+  // Pause scanning so the connect gets the controller's airtime
+  poke_scan_scheduler();
+
+  LOG_INFO("Connecting to " + address + " via " +
+           device_path.substr(0, device_path.find("/dev_")));
+  bool connected = device->connect();
+
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    // The adapter may have been unplugged while connecting
+    AdapterStats* adapter = find_adapter_locked(device_path);
+    if (adapter)
+    {
+      if (adapter->pending_connects > 0)
+      {
+        --adapter->pending_connects;
+      }
+      if (connected)
+      {
+        ++adapter->connects_succeeded;
+      }
+      else
+      {
+        ++adapter->connects_failed;
+      }
+    }
+    if (connected)
+    {
+      set_link_state_locked(device_path, true);
+    }
+  }
 
-  GVariantIter iter;
-  g_variant_iter_init(&iter, interfaces_array);
-  const gchar*             interface;
-  std::vector<std::string> interfaces;
+  poke_scan_scheduler();
+  return connected ? device : nullptr;
+}
 
-  while (g_variant_iter_loop(&iter, "&s", &interface))
+void BluetoothManager::update_device_record_locked(
+  const std::string& device_path,
+  GVariant*          properties,
+  bool               seen)
+{
+  auto it = device_records_.find(device_path);
+  if (it == device_records_.end())
   {
-    interfaces.push_back(interface);
+    it = device_records_.emplace(device_path, DeviceRecord()).first;
+    seen = true;
   }
 
-  manager->handle_interfaces_removed(object_path, interfaces);
+  DeviceRecord& record = it->second;
+  if (seen)
+  {
+    record.last_seen = std::chrono::steady_clock::now();
+  }
 
-  g_variant_unref(interfaces_array);
+  gboolean value;
+  if (g_variant_lookup(properties, "Paired", "b", &value))
+  {
+    record.paired = value;
+  }
+  if (g_variant_lookup(properties, "Bonded", "b", &value))
+  {
+    record.bonded = value;
+  }
+  if (g_variant_lookup(properties, "Trusted", "b", &value))
+  {
+    record.trusted = value;
+  }
 }
 
-void BluetoothManager::on_properties_changed(GDBusConnection* connection,
-                                             const gchar*     sender_name,
-                                             const gchar*     object_path,
-                                             const gchar*     interface_name,
-                                             const gchar*     signal_name,
-                                             GVariant*        parameters,
-                                             gpointer         user_data)
+void BluetoothManager::set_device_gc_policy(const DeviceGcPolicy& policy)
 {
-  (void)connection;
-  (void)sender_name;
-  (void)signal_name;
+  std::lock_guard<std::mutex> lock(gc_mutex_);
+  gc_policy_ = policy;
 
-  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+  if (gc_timer_)
+  {
+    g_source_destroy(gc_timer_);
+    g_source_unref(gc_timer_);
+    gc_timer_ = nullptr;
+  }
 
-  const gchar* changed_interface;
-  GVariant*    changed_properties;
-  GVariant*    invalidated_properties;
+  if (policy.max_age.count() > 0 && policy.interval.count() > 0)
+  {
+    gc_timer_ = g_timeout_source_new(
+      std::chrono::duration_cast<std::chrono::milliseconds>(policy.interval)
+        .count());
+    g_source_set_callback(gc_timer_, on_gc_timer, this, nullptr);
+    g_source_attach(gc_timer_, context_);
+  }
+}
 
-  g_variant_get(parameters,
-                "(&s@a{sv}@as)",
-                &changed_interface,
-                &changed_properties,
-                &invalidated_properties);
+DeviceGcPolicy BluetoothManager::get_device_gc_policy()
+{
+  std::lock_guard<std::mutex> lock(gc_mutex_);
+  return gc_policy_;
+}
 
-  manager->handle_properties_changed(
-    object_path, changed_interface, changed_properties);
+DeviceGcStats BluetoothManager::get_device_gc_stats()
+{
+  DeviceGcStats stats;
+  {
+    std::lock_guard<std::mutex> lock(gc_mutex_);
+    stats = gc_stats_;
+  }
 
-  g_variant_unref(changed_properties);
-  g_variant_unref(invalidated_properties);
+  std::lock_guard<std::mutex> lock(adapters_mutex_);
+  stats.tracked = device_records_.size();
+  return stats;
 }
 
-void BluetoothManager::handle_interfaces_added(const std::string& object_path,
-                                               GVariant*          interfaces)
+gboolean BluetoothManager::on_gc_timer(gpointer user_data)
 {
-  GVariantIter iter;
-  g_variant_iter_init(&iter, interfaces);
-
-  const gchar* interface_name;
-  GVariant*    properties;
+  BluetoothManager* manager = static_cast<BluetoothManager*>(user_data);
+  {
+    // The policy may have been replaced while this dispatch waited
+    std::lock_guard<std::mutex> lock(manager->gc_mutex_);
+    if (g_main_current_source() != manager->gc_timer_)
+      return G_SOURCE_REMOVE;
+  }
 
-  bool is_device = false;
+  manager->collect_stale_devices();
+  return G_SOURCE_CONTINUE;
+}
 
-  while (g_variant_iter_loop(&iter, "{&s@a{sv}}", &interface_name, &properties))
+size_t BluetoothManager::collect_stale_devices()
+{
+  DeviceGcPolicy policy;
   {
-    if (g_strcmp0(interface_name, BlueZ::DEVICE_INTERFACE) == 0)
-    {
-      is_device = true;
-      break;
-    }
+    std::lock_guard<std::mutex> lock(gc_mutex_);
+    policy = gc_policy_;
+    ++gc_stats_.sweeps;
   }
 
-  if (is_device)
+  if (!connection_ || policy.max_age.count() <= 0)
+    return 0;
+
+  // Oldest first, so a backlog is worked off in age order across sweeps
+  std::vector<std::pair<std::chrono::steady_clock::time_point, std::string>>
+    stale;
+  std::map<std::string, std::string> adapter_of;
   {
-    // Check if device matches target service UUIDs (if specified)
-    if (!target_service_uuids_.empty() &&
-        !device_has_target_service(object_path))
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    auto cutoff = std::chrono::steady_clock::now() - policy.max_age;
+    for (const auto& pair : device_records_)
     {
-      return;
-    }
+      const DeviceRecord& record = pair.second;
+      if (record.paired || record.bonded || record.trusted ||
+          record.last_seen > cutoff || connected_paths_.count(pair.first))
+        continue;
 
-    auto device = std::make_shared<BluetoothDevice>(connection_, object_path);
+      AdapterStats* adapter = find_adapter_locked(pair.first);
+      if (!adapter)
+        continue;
 
-    // Extract address from device for indexing
-    std::string address = device->get_address();
-    if (!address.empty())
-    {
-      devices_[address] = device;
-      Utils::print_with_timestamp("Device discovered: " + device->get_name() +
-                                  " (" + address + ")");
+      stale.emplace_back(record.last_seen, pair.first);
+      adapter_of[pair.first] = adapter->path;
     }
   }
-}
 
-void BluetoothManager::handle_interfaces_removed(
-  const std::string&              object_path,
-  const std::vector<std::string>& interfaces)
-{
-  (void)interfaces;
-
-  // Find device by path and remove it
-  for (auto it = devices_.begin(); it != devices_.end(); ++it)
+  std::sort(stale.begin(), stale.end());
+  if (stale.size() > policy.max_removals_per_sweep)
   {
-    if (it->second->get_object_path() == object_path)
-    {
-      Utils::print_with_timestamp("Device removed: " + it->second->get_name() +
-                                  " (" + it->first + ")");
-      devices_.erase(it);
-      break;
-    }
+    stale.resize(policy.max_removals_per_sweep);
   }
-}
 
-void BluetoothManager::handle_properties_changed(
-  const std::string& object_path,
-  const std::string& interface_name,
-  GVariant*          changed_properties)
-{
-  // Find the device and notify it of property changes
-  for (auto& pair : devices_)
+  // InterfacesRemoved then drops the device from our own tables
+  for (const auto& entry : stale)
   {
-    if (pair.second->get_object_path() == object_path)
+    const std::string& device_path = entry.second;
+    auto on_reply = [this, device_path](GVariant* reply, GError* error)
     {
-      if (interface_name == BlueZ::DEVICE_INTERFACE)
+      (void)reply;
+      if (error)
       {
-        // Check for connection state changes
-        GVariantIter iter;
-        g_variant_iter_init(&iter, changed_properties);
-        const gchar* key;
-        GVariant*    value;
-
-        while (g_variant_iter_loop(&iter, "{&sv}", &key, &value))
+        LOG_DEBUG("RemoveDevice failed for " + device_path + ": " +
+                  error->message);
         {
-          if (g_strcmp0(key, "Connected") == 0)
-          {
-            pair.second->update_connection_state(g_variant_get_boolean(value));
-          }
-          else if (g_strcmp0(key, "ServicesResolved") == 0)
+          // Retry a full max_age later rather than keep it at the head of
+          // every sweep
+          std::lock_guard<std::mutex> lock(adapters_mutex_);
+          auto it = device_records_.find(device_path);
+          if (it != device_records_.end())
           {
-            pair.second->update_services_resolved_state(
-              g_variant_get_boolean(value));
+            it->second.last_seen = std::chrono::steady_clock::now();
           }
         }
+        std::lock_guard<std::mutex> lock(gc_mutex_);
+        ++gc_stats_.failed;
+        return;
       }
-      break;
-    }
+
+      std::lock_guard<std::mutex> lock(gc_mutex_);
+      ++gc_stats_.removed;
+    };
+    static const DBusCall::Method remove_device_call{
+      "BluetoothManager", BlueZ::ADAPTER_INTERFACE, "RemoveDevice"};
+    DBusCall::call(connection_,
+                   adapter_of[device_path].c_str(),
+                   remove_device_call,
+                   g_variant_new("(o)", device_path.c_str()),
+                   nullptr,
+                   DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                   guarded(std::move(on_reply)),
+                   cancel_group_.current().get(),
+                   context_);
+  }
+
+  if (!stale.empty())
+  {
+    LOG_INFO("Removing " + std::to_string(stale.size()) +
+             " stale device object(s)");
   }
+  return stale.size();
 }
 
-bool BluetoothManager::device_has_target_service(const std::string& device_path)
+void BluetoothManager::add_auto_connect(const std::string& address)
 {
-  if (target_service_uuids_.empty())
-    return true;
+  std::string key = address;
+  std::transform(key.begin(), key.end(), key.begin(), ::toupper);
 
-  GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(
-    connection_,
-    BlueZ::SERVICE_NAME,
-    device_path.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Get",
-    g_variant_new("(ss)", BlueZ::DEVICE_INTERFACE, "UUIDs"),
-    G_VARIANT_TYPE("(v)"),
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
+  std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+  auto&                       entry = auto_connect_[key];
+  entry.stats.address               = key;
+}
 
-  if (!result)
+bool BluetoothManager::remove_auto_connect(const std::string& address)
+{
+  std::string key = address;
+  std::transform(key.begin(), key.end(), key.begin(), ::toupper);
+
+  std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+  return auto_connect_.erase(key) > 0;
+}
+
+std::vector<AutoConnectStats> BluetoothManager::get_auto_connect_stats()
+{
+  std::vector<AutoConnectStats> stats;
+
+  std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+  for (const auto& pair : auto_connect_)
   {
-    if (error)
-    {
-      g_error_free(error);
-    }
-    return false;
+    stats.push_back(pair.second.stats);
   }
+  return stats;
+}
 
-  GVariant* value;
-  g_variant_get(result, "(v)", &value);
+void BluetoothManager::set_auto_connect_callback(AutoConnectCallback callback)
+{
+  std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+  auto_connect_callback_ = std::move(callback);
+}
+
+void BluetoothManager::try_auto_connect(const std::string& object_path,
+                                        GVariant*          properties)
+{
+  char address[AdvertisementData::ADDRESS_LENGTH + 1];
+  if (!Advertisement::address_from_object_path(object_path.c_str(), address))
+    return;
 
-  if (!g_variant_is_of_type(value, G_VARIANT_TYPE("as")))
+  auto seen = std::chrono::steady_clock::now();
   {
-    g_variant_unref(value);
-    g_variant_unref(result);
-    return false;
-  }
+    // Hot path for every RSSI update: one lookup, nothing else
+    std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+    auto it = auto_connect_.find(std::string_view(address));
+    if (it == auto_connect_.end() || it->second.in_flight ||
+        seen - it->second.last_attempt <
+          std::chrono::milliseconds(AUTO_CONNECT_RETRY_MS))
+      return;
 
-  GVariantIter iter;
-  g_variant_iter_init(&iter, value);
-  const gchar* uuid;
+    it->second.in_flight    = true;
+    it->second.last_attempt = seen;
+  }
 
-  bool has_target_service = false;
-  while (g_variant_iter_loop(&iter, "&s", &uuid))
+  bool usable = true;
   {
-    for (const auto& target_uuid : target_service_uuids_)
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    auto                        it = device_paths_.find(address);
+    if (it != device_paths_.end())
     {
-      if (g_ascii_strcasecmp(uuid, target_uuid.c_str()) == 0)
+      for (const auto& path : it->second)
       {
-        has_target_service = true;
-        break;
+        usable = usable && !connected_paths_.count(path);
       }
     }
-    if (has_target_service)
-      break;
+
+    // Use the adapter that just heard the device rather than the least
+    // loaded one: it is the one known to be in range
+    AdapterStats* adapter = find_adapter_locked(object_path);
+    usable                = usable && adapter && adapter->powered;
+    if (usable)
+    {
+      ++adapter->pending_connects;
+    }
   }
 
-  g_variant_unref(value);
-  g_variant_unref(result);
+  if (!usable)
+  {
+    std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+    auto it = auto_connect_.find(std::string_view(address));
+    if (it != auto_connect_.end())
+    {
+      it->second.in_flight = false;
+    }
+    return;
+  }
 
-  return has_target_service;
+  std::shared_ptr<BluetoothDevice> device = get_device(address);
+  if (!device || device->get_object_path() != object_path)
+  {
+    // Built from the signal's properties: no GetAll on the signal thread
+    device = std::make_shared<BluetoothDevice>(
+      device_connection(object_path), object_path, properties, context_);
+
+    std::lock_guard<std::mutex> lock(devices_mutex_);
+    devices_[address] = device;
+  }
+
+  LOG_INFO(std::string("Auto-connecting to ") + address);
+  poke_scan_scheduler();
+
+  std::string address_string = address;
+  device->connect_async(
+    [this, address_string, object_path, device, seen](bool connected) {
+      finish_auto_connect(address_string, object_path, device, seen, connected);
+    });
 }
 
-std::vector<std::shared_ptr<BluetoothDevice>>
-BluetoothManager::get_discovered_devices()
+void BluetoothManager::finish_auto_connect(
+  const std::string&                    address,
+  const std::string&                    device_path,
+  std::shared_ptr<BluetoothDevice>      device,
+  std::chrono::steady_clock::time_point seen,
+  bool                                  connected)
 {
-  std::vector<std::shared_ptr<BluetoothDevice>> device_list;
+  auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - seen);
 
-  for (const auto& pair : devices_)
   {
-    device_list.push_back(pair.second);
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    AdapterStats*               adapter = find_adapter_locked(device_path);
+    if (adapter)
+    {
+      if (adapter->pending_connects > 0)
+      {
+        --adapter->pending_connects;
+      }
+      if (connected)
+      {
+        ++adapter->connects_succeeded;
+      }
+      else
+      {
+        ++adapter->connects_failed;
+      }
+    }
+    if (connected)
+    {
+      set_link_state_locked(device_path, true);
+    }
   }
+  poke_scan_scheduler();
 
-  return device_list;
-}
+  AutoConnectCallback callback;
+  {
+    std::lock_guard<std::mutex> lock(auto_connect_mutex_);
+    auto                        it = auto_connect_.find(address);
+    if (it != auto_connect_.end())
+    {
+      it->second.in_flight = false;
+      ++it->second.stats.attempts;
+      if (connected)
+      {
+        ++it->second.stats.connected;
+        it->second.stats.last_latency = latency;
+      }
+    }
+    if (connected)
+    {
+      callback = auto_connect_callback_;
+    }
+  }
 
-std::shared_ptr<BluetoothDevice> BluetoothManager::get_device(
-  const std::string& address)
-{
-  auto it = devices_.find(address);
-  if (it != devices_.end())
+  if (!connected)
   {
-    return it->second;
+    LOG_WARNING("Auto-connect to " + address +
+                " failed; retrying on its next advertisement");
+    return;
+  }
+
+  Metrics::Registry::instance()
+    .histogram("bscm_auto_connect_latency_seconds",
+               "Time from a device's advertisement to the auto-connect "
+               "completing")
+    .observe(latency);
+  LOG_INFO("Auto-connected to " + address + " in " + format_ms(latency));
+
+  if (callback)
+  {
+    callback(device, latency);
   }
-  return nullptr;
 }
 
-bool BluetoothManager::remove_device(const std::string& address)
+std::vector<AdapterStats> BluetoothManager::get_adapter_stats()
 {
-  auto it = devices_.find(address);
-  if (it != devices_.end())
+  std::lock_guard<std::mutex> lock(adapters_mutex_);
+  return adapters_;
+}
+
+void BluetoothManager::print_adapter_stats()
+{
+  std::vector<AdapterStats> adapters;
+  std::string               default_path;
   {
-    // Disconnect if connected
-    if (it->second->is_connected())
-    {
-      it->second->disconnect();
-    }
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    adapters     = adapters_;
+    default_path = adapter_path_;
+  }
+  if (adapters.empty())
+  {
+    Utils::print_with_timestamp("No adapters found");
+    return;
+  }
 
-    devices_.erase(it);
-    return true;
+  Utils::print_with_timestamp("Adapters:");
+  for (const auto& adapter : adapters)
+  {
+    std::cout << "  " << adapter.path
+              << (adapter.path == default_path ? " (default)" : "") << " - "
+              << (adapter.powered ? "on" : "off")
+              << (adapter.discovering ? ", scanning" : "")
+              << ", links: " << adapter.active_links
+              << ", pending: " << adapter.pending_connects
+              << ", seen: " << adapter.devices_seen
+              << ", connects: " << adapter.connects_succeeded << " ok / "
+              << adapter.connects_failed << " failed" << std::endl;
   }
-  return false;
 }
 
 void BluetoothManager::print_discovered_devices()
 {
+  std::lock_guard<std::mutex> lock(devices_mutex_);
   if (devices_.empty())
   {
     Utils::print_with_timestamp("No devices discovered");
@@ -687,6 +2600,95 @@ void BluetoothManager::print_discovered_devices()
   }
 }
 
+void BluetoothManager::set_advertisement_callback(
+  AdvertisementCallback callback)
+{
+  std::lock_guard<std::mutex> lock(advertisement_mutex_);
+  if (callback)
+  {
+    advertisement_callback_ =
+      std::make_shared<const AdvertisementCallback>(std::move(callback));
+  }
+  else
+  {
+    advertisement_callback_.reset();
+  }
+}
+
+bool BluetoothManager::get_advertisement(const std::string& address,
+                                         AdvertisementData& data)
+{
+  std::lock_guard<std::mutex> lock(advertisement_mutex_);
+  auto                        it = advertisements_.find(address);
+  if (it == advertisements_.end())
+  {
+    return false;
+  }
+
+  data = it->second;
+  return true;
+}
+
+uint32_t BluetoothManager::add_advertisement_monitor(
+  const MonitorConfig& config,
+  MonitorCallback      on_found,
+  MonitorCallback      on_lost)
+{
+  if (!connection_)
+    return 0;
+
+  // Exported from the context's own thread, where bluetoothd's calls to the
+  // monitors are then dispatched
+  uint32_t id = 0;
+  Utils::invoke_sync(
+    context_,
+    [&]
+    {
+      {
+        std::lock_guard<std::mutex> lock(monitor_mutex_);
+        if (!advertisement_monitor_)
+        {
+          advertisement_monitor_ = std::make_unique<AdvertisementMonitor>(
+            connection_, MONITOR_ROOT_PATH, context_);
+        }
+        id = advertisement_monitor_->add_monitor(
+          config, std::move(on_found), std::move(on_lost));
+      }
+
+      if (id != 0)
+      {
+        register_advertisement_monitors();
+      }
+    });
+  return id;
+}
+
+bool BluetoothManager::remove_advertisement_monitor(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(monitor_mutex_);
+  return advertisement_monitor_ && advertisement_monitor_->remove_monitor(id);
+}
+
+void BluetoothManager::register_advertisement_monitors()
+{
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> lock(adapters_mutex_);
+    paths = adapter_paths_locked(true);
+  }
+
+  // The application is registered once per adapter; monitors added later
+  // are announced to it through InterfacesAdded
+  std::lock_guard<std::mutex> lock(monitor_mutex_);
+  if (!advertisement_monitor_)
+    return;
+
+  for (const auto& path : paths)
+  {
+    advertisement_monitor_->register_with_adapter(path);
+  }
+}
+
 void BluetoothManager::set_target_service_uuids(
   const std::vector<std::string>& uuids)
 {
@@ -0,0 +1,350 @@
+#include "BluezError.h"
+#include <algorithm>
+#include <cstring>
+#include "Logger.h"
+#include "Metrics.h"
+
+namespace
+{
+struct RemoteError
+{
+  const char*    name;
+  BluezErrorCode code;
+};
+
+constexpr RemoteError REMOTE_ERRORS[] = {
+  {"org.bluez.Error.InProgress", BluezErrorCode::InProgress},
+  {"org.bluez.Error.Failed", BluezErrorCode::Failed},
+  {"org.bluez.Error.NotReady", BluezErrorCode::NotReady},
+  {"org.bluez.Error.NotConnected", BluezErrorCode::NotConnected},
+  {"org.bluez.Error.AlreadyConnected", BluezErrorCode::AlreadyConnected},
+  {"org.bluez.Error.NotPermitted", BluezErrorCode::NotPermitted},
+  {"org.bluez.Error.NotAuthorized", BluezErrorCode::NotPermitted},
+  {"org.bluez.Error.NotSupported", BluezErrorCode::NotSupported},
+  {"org.bluez.Error.InvalidArguments", BluezErrorCode::InvalidArguments},
+  {"org.bluez.Error.InvalidOffset", BluezErrorCode::InvalidArguments},
+  {"org.bluez.Error.InvalidValueLength", BluezErrorCode::InvalidArguments},
+  {"org.bluez.Error.DoesNotExist", BluezErrorCode::DoesNotExist},
+  {"org.bluez.Error.AuthenticationFailed",
+   BluezErrorCode::AuthenticationFailed},
+  {"org.bluez.Error.AuthenticationCanceled",
+   BluezErrorCode::AuthenticationFailed},
+  {"org.bluez.Error.AuthenticationRejected",
+   BluezErrorCode::AuthenticationFailed},
+  {"org.bluez.Error.AuthenticationTimeout",
+   BluezErrorCode::AuthenticationFailed},
+  {"org.freedesktop.DBus.Error.UnknownObject", BluezErrorCode::DoesNotExist},
+};
+
+Metrics::Counter& retry_counter(const char* operation, const char* outcome)
+{
+  return Metrics::Registry::instance().counter(
+    "bscm_retries_total",
+    "Extra attempts of BlueZ operations (retried) and how failing "
+    "operations ended (recovered, exhausted, permanent)",
+    {{"operation", operation}, {"outcome", outcome}});
+}
+
+using Clock = std::chrono::steady_clock;
+
+// What is left of an overall timeout for the next attempt
+std::chrono::milliseconds remaining_time(std::chrono::milliseconds timeout,
+                                         Clock::time_point         deadline)
+{
+  if (timeout.count() < 0)
+    return timeout;
+  return std::max(
+    std::chrono::duration_cast<std::chrono::milliseconds>(deadline -
+                                                          Clock::now()),
+    std::chrono::milliseconds(1));
+}
+
+// Whether attempt `made`, having failed with `error`, is followed by
+// another one after `delay`. Counts the outcome either way.
+bool plan_retry(const RetryPolicy&         policy,
+                const char*                operation,
+                const GError*              error,
+                unsigned                   made,
+                std::chrono::milliseconds  timeout,
+                Clock::time_point          deadline,
+                std::chrono::milliseconds* delay)
+{
+  BluezErrorCode code = BluezError::classify(error);
+  if (!policy.should_retry(code))
+  {
+    // Retrying would only fail the same way again
+    retry_counter(operation, "permanent").increment();
+    return false;
+  }
+  *delay = policy.backoff(made);
+  if (made >= std::max(policy.max_attempts, 1u) ||
+      (timeout.count() >= 0 && Clock::now() + *delay >= deadline))
+  {
+    retry_counter(operation, "exhausted").increment();
+    return false;
+  }
+
+  LOG_DEBUG(std::string(operation) + " failed (" + error_code_name(code) +
+            "), retrying in " + std::to_string(delay->count()) + " ms");
+  retry_counter(operation, "retried").increment();
+  return true;
+}
+
+// One run_with_retry_async(), shared by its attempts and backoff timers
+struct AsyncRetry
+{
+  RetryPolicy                   policy;
+  std::string                   operation;
+  std::chrono::milliseconds     timeout;
+  Clock::time_point             deadline;
+  AsyncRetryAttempt             attempt;
+  AsyncRetryComplete            complete;
+  GMainContext*                 context;
+  std::shared_ptr<GCancellable> cancellable;
+  unsigned                      made = 0;
+
+  ~AsyncRetry() { g_main_context_unref(context); }
+};
+
+void start_async_attempt(const std::shared_ptr<AsyncRetry>& retry);
+
+void finish_async_attempt(const std::shared_ptr<AsyncRetry>& retry,
+                          GError*                            error)
+{
+  std::chrono::milliseconds delay{0};
+  if (!error)
+  {
+    if (retry->made > 1)
+    {
+      retry_counter(retry->operation.c_str(), "recovered").increment();
+    }
+    retry->complete(nullptr, retry->made);
+    return;
+  }
+  if (!plan_retry(retry->policy,
+                  retry->operation.c_str(),
+                  error,
+                  retry->made,
+                  retry->timeout,
+                  retry->deadline,
+                  &delay))
+  {
+    retry->complete(error, retry->made);
+    return;
+  }
+
+  // A timer on the context instead of a sleep: the context's thread keeps
+  // dispatching everything else in the meantime
+  GSource* source = g_timeout_source_new(static_cast<guint>(delay.count()));
+  g_source_set_callback(
+    source,
+    [](gpointer data) -> gboolean
+    {
+      start_async_attempt(*static_cast<std::shared_ptr<AsyncRetry>*>(data));
+      return G_SOURCE_REMOVE;
+    },
+    new std::shared_ptr<AsyncRetry>(retry),
+    [](gpointer data)
+    { delete static_cast<std::shared_ptr<AsyncRetry>*>(data); });
+  g_source_attach(source, retry->context);
+  g_source_unref(source);
+}
+
+void start_async_attempt(const std::shared_ptr<AsyncRetry>& retry)
+{
+  GError* error = nullptr;
+  if (retry->cancellable &&
+      g_cancellable_set_error_if_cancelled(retry->cancellable.get(), &error))
+  {
+    retry->complete(error, retry->made);
+    g_error_free(error);
+    return;
+  }
+
+  ++retry->made;
+  retry->attempt(remaining_time(retry->timeout, retry->deadline),
+                 [retry](GError* attempt_error)
+                 { finish_async_attempt(retry, attempt_error); });
+}
+}  // namespace
+
+BluezErrorCode BluezError::classify(const GError* error)
+{
+  if (!error)
+    return BluezErrorCode::None;
+
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return BluezErrorCode::Cancelled;
+
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+      g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_TIMEOUT) ||
+      g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY))
+  {
+    return BluezErrorCode::Timeout;
+  }
+
+  if (g_dbus_error_is_remote_error(error))
+  {
+    gchar*         name = g_dbus_error_get_remote_error(error);
+    BluezErrorCode code = BluezErrorCode::Unknown;
+    for (const auto& remote : REMOTE_ERRORS)
+    {
+      if (std::strcmp(name, remote.name) == 0)
+      {
+        code = remote.code;
+        break;
+      }
+    }
+    g_free(name);
+    return code;
+  }
+
+  if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED))
+    return BluezErrorCode::NotSupported;
+  if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS))
+    return BluezErrorCode::InvalidArguments;
+  if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT))
+    return BluezErrorCode::DoesNotExist;
+
+  return BluezErrorCode::Unknown;
+}
+
+BluezError BluezError::from(const GError* error, unsigned attempts)
+{
+  BluezError result;
+  result.code     = classify(error);
+  result.attempts = attempts;
+  if (error)
+  {
+    // Drop the "GDBus.Error:org.bluez.Error.Failed: " prefix
+    GError* copy = g_error_copy(error);
+    g_dbus_error_strip_remote_error(copy);
+    result.message = copy->message;
+    g_error_free(copy);
+  }
+  return result;
+}
+
+const char* error_code_name(BluezErrorCode code)
+{
+  switch (code)
+  {
+    case BluezErrorCode::None:
+      return "none";
+    case BluezErrorCode::InProgress:
+      return "in-progress";
+    case BluezErrorCode::Failed:
+      return "failed";
+    case BluezErrorCode::NotReady:
+      return "not-ready";
+    case BluezErrorCode::NotConnected:
+      return "not-connected";
+    case BluezErrorCode::AlreadyConnected:
+      return "already-connected";
+    case BluezErrorCode::NotPermitted:
+      return "not-permitted";
+    case BluezErrorCode::NotSupported:
+      return "not-supported";
+    case BluezErrorCode::InvalidArguments:
+      return "invalid-arguments";
+    case BluezErrorCode::DoesNotExist:
+      return "does-not-exist";
+    case BluezErrorCode::AuthenticationFailed:
+      return "authentication-failed";
+    case BluezErrorCode::Timeout:
+      return "timeout";
+    case BluezErrorCode::Cancelled:
+      return "cancelled";
+    case BluezErrorCode::Unknown:
+      return "unknown";
+  }
+  return "unknown";
+}
+
+bool RetryPolicy::should_retry(BluezErrorCode code) const
+{
+  return std::find(retryable.begin(), retryable.end(), code) !=
+         retryable.end();
+}
+
+std::chrono::milliseconds RetryPolicy::backoff(unsigned attempt) const
+{
+  double delay = static_cast<double>(initial_backoff.count());
+  for (unsigned i = 1; i < attempt; ++i)
+  {
+    delay *= backoff_multiplier;
+  }
+  return std::min(std::chrono::milliseconds(static_cast<int64_t>(delay)),
+                  max_backoff);
+}
+
+bool run_with_retry(const RetryPolicy&        policy,
+                    const char*               operation,
+                    std::chrono::milliseconds timeout,
+                    const RetryAttempt&       attempt,
+                    GError**                  error,
+                    unsigned*                 attempts)
+{
+  GError*  last_error = nullptr;
+  unsigned made       = 0;
+  bool     success    = false;
+  auto     deadline   = Clock::now() + timeout;
+
+  while (true)
+  {
+    if (last_error)
+    {
+      g_error_free(last_error);
+      last_error = nullptr;
+    }
+
+    ++made;
+    if (attempt(remaining_time(timeout, deadline), &last_error))
+    {
+      success = true;
+      break;
+    }
+
+    std::chrono::milliseconds delay{0};
+    if (!plan_retry(
+          policy, operation, last_error, made, timeout, deadline, &delay))
+      break;
+    std::this_thread::sleep_for(delay);
+  }
+
+  if (success && made > 1)
+  {
+    retry_counter(operation, "recovered").increment();
+  }
+
+  if (attempts)
+  {
+    *attempts = made;
+  }
+  if (last_error)
+  {
+    g_propagate_error(error, last_error);
+  }
+  return success;
+}
+
+void run_with_retry_async(const RetryPolicy&            policy,
+                          const char*                   operation,
+                          std::chrono::milliseconds     timeout,
+                          AsyncRetryAttempt             attempt,
+                          AsyncRetryComplete            complete,
+                          GMainContext*                 context,
+                          std::shared_ptr<GCancellable> cancellable)
+{
+  auto retry         = std::make_shared<AsyncRetry>();
+  retry->policy      = policy;
+  retry->operation   = operation;
+  retry->timeout     = timeout;
+  retry->deadline    = Clock::now() + timeout;
+  retry->attempt     = std::move(attempt);
+  retry->complete    = std::move(complete);
+  retry->context     = context ? g_main_context_ref(context)
+                               : g_main_context_ref_thread_default();
+  retry->cancellable = std::move(cancellable);
+  start_async_attempt(retry);
+}
\ No newline at end of file
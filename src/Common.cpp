@@ -1,49 +1,227 @@
 #include "Common.h"
 #include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BSCM_HEX_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define BSCM_HEX_NEON
+#endif
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
 
-namespace Utils
+namespace
 {
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
 
-std::string bytes_to_hex_string(const std::vector<uint8_t>& data)
+// Two ASCII digits per byte value, indexed by the byte
+struct HexPairTable
+{
+  char pairs[256][2];
+
+  constexpr HexPairTable() : pairs()
+  {
+    for (int i = 0; i < 256; ++i)
+    {
+      pairs[i][0] = HEX_DIGITS[i >> 4];
+      pairs[i][1] = HEX_DIGITS[i & 0x0f];
+    }
+  }
+};
+
+// Nibble value per ASCII character, -1 for anything that is not a hex digit
+struct HexValueTable
 {
-  std::stringstream ss;
-  ss << std::hex << std::setfill('0');
-  for (const auto& byte : data)
+  int8_t values[256];
+
+  constexpr HexValueTable() : values()
   {
-    ss << std::setw(2) << static_cast<int>(byte);
-    if (&byte != &data.back())
+    for (int i = 0; i < 256; ++i)
+    {
+      values[i] = -1;
+    }
+    for (int i = 0; i < 10; ++i)
+    {
+      values['0' + i] = static_cast<int8_t>(i);
+    }
+    for (int i = 0; i < 6; ++i)
     {
-      ss << " ";
+      values['a' + i] = static_cast<int8_t>(10 + i);
+      values['A' + i] = static_cast<int8_t>(10 + i);
     }
   }
-  return ss.str();
+};
+
+constexpr HexPairTable  HEX_PAIRS;
+constexpr HexValueTable HEX_VALUES;
+
+// Encode 16 bytes into 32 contiguous digits; returns bytes consumed
+size_t hex_encode_block(const uint8_t* data, size_t length, char* out)
+{
+  size_t i = 0;
+#if defined(BSCM_HEX_SSE2)
+  const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+  const __m128i ascii_zero  = _mm_set1_epi8('0');
+  const __m128i nine        = _mm_set1_epi8(9);
+  const __m128i alpha_gap   = _mm_set1_epi8('a' - '0' - 10);
+
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), nibble_mask);
+    __m128i lo = _mm_and_si128(in, nibble_mask);
+
+    __m128i first  = _mm_unpacklo_epi8(hi, lo);
+    __m128i second = _mm_unpackhi_epi8(hi, lo);
+
+    first = _mm_add_epi8(
+      _mm_add_epi8(first, ascii_zero),
+      _mm_and_si128(_mm_cmpgt_epi8(first, nine), alpha_gap));
+    second = _mm_add_epi8(
+      _mm_add_epi8(second, ascii_zero),
+      _mm_and_si128(_mm_cmpgt_epi8(second, nine), alpha_gap));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), first);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), second);
+  }
+#elif defined(BSCM_HEX_NEON)
+  const uint8x16_t digits =
+    vld1q_u8(reinterpret_cast<const uint8_t*>(HEX_DIGITS));
+
+  for (; i + 16 <= length; i += 16)
+  {
+    uint8x16_t   in = vld1q_u8(data + i);
+    uint8x16x2_t pair;
+    pair.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(in, 4));
+    pair.val[1] = vqtbl1q_u8(digits, vandq_u8(in, vdupq_n_u8(0x0f)));
+    // vst2q interleaves the two registers: hi, lo, hi, lo, ...
+    vst2q_u8(reinterpret_cast<uint8_t*>(out + 2 * i), pair);
+  }
+#else
+  (void)data;
+  (void)length;
+  (void)out;
+#endif
+  return i;
 }
+}  // namespace
 
-std::vector<uint8_t> hex_string_to_bytes(const std::string& hex_str)
+namespace Utils
 {
-  std::vector<uint8_t> bytes;
-  std::string          clean_hex = hex_str;
 
-  // Remove spaces and make uppercase
-  clean_hex.erase(std::remove(clean_hex.begin(), clean_hex.end(), ' '),
-                  clean_hex.end());
-  std::transform(
-    clean_hex.begin(), clean_hex.end(), clean_hex.begin(), ::toupper);
+size_t hex_encoded_length(size_t length, char separator)
+{
+  if (length == 0)
+    return 0;
+  return separator ? length * 3 - 1 : length * 2;
+}
+
+size_t hex_encode(const uint8_t* data,
+                  size_t         length,
+                  char*          out,
+                  size_t         out_size,
+                  char           separator)
+{
+  size_t needed = hex_encoded_length(length, separator);
+  if (needed > out_size)
+    return 0;
 
-  // Convert hex pairs to bytes
-  for (size_t i = 0; i < clean_hex.length(); i += 2)
+  if (!separator)
   {
-    if (i + 1 < clean_hex.length())
+    size_t done = hex_encode_block(data, length, out);
+    for (size_t i = done; i < length; ++i)
+    {
+      out[2 * i]     = HEX_PAIRS.pairs[data[i]][0];
+      out[2 * i + 1] = HEX_PAIRS.pairs[data[i]][1];
+    }
+    return needed;
+  }
+
+  if (length == 0)
+    return 0;
+
+  // One 4-byte store per byte, 3 bytes apart: the spare byte is overwritten
+  // by the next pair, and the last pair has no separator
+  char*  pos  = out;
+  size_t last = length - 1;
+  for (size_t i = 0; i < last; ++i, pos += 3)
+  {
+    const char group[4] = {
+      HEX_PAIRS.pairs[data[i]][0], HEX_PAIRS.pairs[data[i]][1], separator, 0};
+    memcpy(pos, group, sizeof(group));
+  }
+  pos[0] = HEX_PAIRS.pairs[data[last]][0];
+  pos[1] = HEX_PAIRS.pairs[data[last]][1];
+  return needed;
+}
+
+bool hex_decode(const char* hex,
+                size_t      length,
+                uint8_t*    out,
+                size_t      out_size,
+                size_t&     out_length)
+{
+  out_length  = 0;
+  int pending = -1;
+
+  for (size_t i = 0; i < length; ++i)
+  {
+    unsigned char c = static_cast<unsigned char>(hex[i]);
+    if (c == ' ')
+      continue;
+
+    int8_t value = HEX_VALUES.values[c];
+    if (value < 0)
+      return false;
+
+    if (pending < 0)
     {
-      std::string byte_str = clean_hex.substr(i, 2);
-      uint8_t byte = static_cast<uint8_t>(std::stoul(byte_str, nullptr, 16));
-      bytes.push_back(byte);
+      pending = value;
+      continue;
     }
+
+    if (out_length >= out_size)
+      return false;
+
+    out[out_length++] = static_cast<uint8_t>((pending << 4) | value);
+    pending           = -1;
+  }
+
+  return pending < 0;
+}
+
+std::string bytes_to_hex_string(const std::vector<uint8_t>& data)
+{
+  std::string hex(hex_encoded_length(data.size(), ' '), '\0');
+  hex_encode(data.data(), data.size(), &hex[0], hex.size(), ' ');
+  return hex;
+}
+
+bool hex_string_to_bytes(const std::string&    hex_str,
+                         std::vector<uint8_t>& bytes)
+{
+  bytes.resize(hex_str.size() / 2);
+
+  size_t length;
+  if (!hex_decode(
+        hex_str.data(), hex_str.size(), bytes.data(), bytes.size(), length))
+  {
+    bytes.clear();
+    return false;
   }
 
+  bytes.resize(length);
+  return true;
+}
+
+std::vector<uint8_t> hex_string_to_bytes(const std::string& hex_str)
+{
+  std::vector<uint8_t> bytes;
+  hex_string_to_bytes(hex_str, bytes);
   return bytes;
 }
 
@@ -114,20 +292,110 @@ std::vector<uint8_t> variant_to_bytes(GVariant* variant)
   return bytes;
 }
 
-void print_with_timestamp(const std::string& message)
+size_t format_timestamp(std::chrono::system_clock::time_point time,
+                        char*                                 buffer,
+                        size_t                                size)
 {
-  auto now    = std::chrono::system_clock::now();
-  auto time_t = std::chrono::system_clock::to_time_t(now);
+  thread_local time_t cached_second = -1;
+  thread_local char   cached_text[20];
+
+  auto time_t = std::chrono::system_clock::to_time_t(time);
   auto ms     = std::chrono::duration_cast<std::chrono::milliseconds>(
-              now.time_since_epoch()) %
+              time.time_since_epoch()) %
             1000;
 
-  struct tm* tm_info = localtime(&time_t);
-  char       timestamp[100];
-  strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+  if (time_t != cached_second)
+  {
+    struct tm tm_info;
+    localtime_r(&time_t, &tm_info);
+    strftime(cached_text, sizeof(cached_text), "%Y-%m-%d %H:%M:%S", &tm_info);
+    cached_second = time_t;
+  }
+
+  int written = snprintf(
+    buffer, size, "%s.%03d", cached_text, static_cast<int>(ms.count()));
+  return written > 0 ? std::min(static_cast<size_t>(written), size - 1) : 0;
+}
+
+void print_with_timestamp(const std::string& message)
+{
+  char timestamp[32];
+  format_timestamp(
+    std::chrono::system_clock::now(), timestamp, sizeof(timestamp));
+
+  std::string line;
+  line.reserve(message.size() + 32);
+  line += '[';
+  line += timestamp;
+  line += "] ";
+  line += message;
+  line += '\n';
+
+  // One write per line keeps output from concurrent threads from interleaving
+  std::cout.write(line.data(), static_cast<std::streamsize>(line.size()));
+  std::cout.flush();
+}
+
+namespace
+{
+bool run_if_acquired(GMainContext*                context,
+                     const std::function<void()>& function)
+{
+  if (!g_main_context_acquire(context))
+    return false;
+  {
+    ScopedMainContext scope(context);
+    function();
+  }
+  g_main_context_release(context);
+  return true;
+}
+
+struct Invocation
+{
+  GMainContext*         context;
+  std::function<void()> function;
+};
+}  // namespace
+
+void invoke(GMainContext* context, std::function<void()> function)
+{
+  if (run_if_acquired(context, function))
+    return;
+
+  // Dispatched by the owner, which can always acquire it again
+  g_main_context_invoke_full(
+    context,
+    G_PRIORITY_HIGH,
+    [](gpointer data) -> gboolean
+    {
+      auto* invocation = static_cast<Invocation*>(data);
+      run_if_acquired(invocation->context, invocation->function);
+      return G_SOURCE_REMOVE;
+    },
+    new Invocation{context, std::move(function)},
+    [](gpointer data) { delete static_cast<Invocation*>(data); });
+}
+
+void invoke_sync(GMainContext* context, const std::function<void()>& function)
+{
+  if (run_if_acquired(context, function))
+    return;
+
+  std::mutex              mutex;
+  std::condition_variable done_cv;
+  bool                    done = false;
+  invoke(context,
+         [&]
+         {
+           function();
+           std::lock_guard<std::mutex> lock(mutex);
+           done = true;
+           done_cv.notify_all();
+         });
 
-  std::cout << "[" << timestamp << "." << std::setfill('0') << std::setw(3)
-            << ms.count() << "] " << message << std::endl;
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&] { return done; });
 }
 
 }  // namespace Utils
\ No newline at end of file
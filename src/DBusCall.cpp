@@ -0,0 +1,196 @@
+#include "DBusCall.h"
+#include "Metrics.h"
+#include "Tracing.h"
+
+namespace DBusCall
+{
+
+namespace
+{
+struct PendingCall
+{
+  Metrics::CallMetrics*                 metrics;
+  std::chrono::steady_clock::time_point start;
+  ReplyHandler                          handler;
+};
+
+void on_call_ready(GObject* source_object, GAsyncResult* result, gpointer data)
+{
+  std::unique_ptr<PendingCall> pending(static_cast<PendingCall*>(data));
+
+  GError*   error = nullptr;
+  GVariant* reply = g_dbus_connection_call_finish(
+    G_DBUS_CONNECTION(source_object), result, &error);
+
+  pending->metrics->record(reply != nullptr, pending->start, error);
+  if (pending->handler)
+  {
+    pending->handler(reply, error);
+  }
+
+  if (reply)
+  {
+    g_variant_unref(reply);
+  }
+  if (error)
+  {
+    g_error_free(error);
+  }
+}
+}  // namespace
+
+Method::Method(const char* component,
+               const char* interface_name,
+               const char* method_name)
+  : interface_name(interface_name),
+    method_name(method_name),
+    metrics(Metrics::dbus_call(component, interface_name, method_name))
+{
+}
+
+GVariant* call_sync(GDBusConnection*    connection,
+                    const gchar*        object_path,
+                    const Method&       method,
+                    GVariant*           parameters,
+                    const GVariantType* reply_type,
+                    gint                timeout_msec,
+                    GError**            error,
+                    GCancellable*       cancellable)
+{
+  TRACE_SPAN("dbus", method.method_name, object_path);
+
+  auto start = std::chrono::steady_clock::now();
+
+  GVariant* result = g_dbus_connection_call_sync(connection,
+                                                 BlueZ::SERVICE_NAME,
+                                                 object_path,
+                                                 method.interface_name,
+                                                 method.method_name,
+                                                 parameters,
+                                                 reply_type,
+                                                 G_DBUS_CALL_FLAGS_NONE,
+                                                 timeout_msec,
+                                                 cancellable,
+                                                 error);
+
+  method.metrics.record(result != nullptr, start, error ? *error : nullptr);
+  return result;
+}
+
+void call(GDBusConnection*    connection,
+          const gchar*        object_path,
+          const Method&       method,
+          GVariant*           parameters,
+          const GVariantType* reply_type,
+          gint                timeout_msec,
+          ReplyHandler        handler,
+          GCancellable*       cancellable,
+          GMainContext*       context)
+{
+  auto* pending = new PendingCall{
+    &method.metrics, std::chrono::steady_clock::now(), std::move(handler)};
+
+  if (!context)
+  {
+    g_dbus_connection_call(connection,
+                           BlueZ::SERVICE_NAME,
+                           object_path,
+                           method.interface_name,
+                           method.method_name,
+                           parameters,
+                           reply_type,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           timeout_msec,
+                           cancellable,
+                           on_call_ready,
+                           pending);
+    return;
+  }
+
+  // Everything the call needs is owned by the closure, which may run on
+  // another thread after the caller's arguments are gone
+  auto owned = [](gpointer object)
+  {
+    return std::shared_ptr<void>(object ? g_object_ref(object) : nullptr,
+                                 [](void* object)
+                                 {
+                                   if (object)
+                                   {
+                                     g_object_unref(object);
+                                   }
+                                 });
+  };
+  std::shared_ptr<GVariant> owned_parameters(
+    parameters ? g_variant_ref_sink(parameters) : nullptr,
+    [](GVariant* variant)
+    {
+      if (variant)
+      {
+        g_variant_unref(variant);
+      }
+    });
+  Utils::invoke(
+    context,
+    [connection_ref  = owned(connection),
+     cancellable_ref = owned(cancellable),
+     parameters      = std::move(owned_parameters),
+     object_path     = std::string(object_path),
+     method          = &method,
+     reply_type,
+     timeout_msec,
+     pending]
+    {
+      g_dbus_connection_call(
+        static_cast<GDBusConnection*>(connection_ref.get()),
+        BlueZ::SERVICE_NAME,
+        object_path.c_str(),
+        method->interface_name,
+        method->method_name,
+        parameters.get(),
+        reply_type,
+        G_DBUS_CALL_FLAGS_NONE,
+        timeout_msec,
+        static_cast<GCancellable*>(cancellable_ref.get()),
+        on_call_ready,
+        pending);
+    });
+}
+
+namespace
+{
+std::shared_ptr<GCancellable> new_cancellable()
+{
+  return std::shared_ptr<GCancellable>(g_cancellable_new(), g_object_unref);
+}
+}  // namespace
+
+CancelGroup::CancelGroup()
+  : cancellable_(new_cancellable())
+{
+}
+
+CancelGroup::~CancelGroup()
+{
+  cancel();
+}
+
+std::shared_ptr<GCancellable> CancelGroup::current()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cancellable_;
+}
+
+void CancelGroup::cancel()
+{
+  std::shared_ptr<GCancellable> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled    = std::move(cancellable_);
+    cancellable_ = new_cancellable();
+  }
+
+  // Outside the lock: cancelling runs the cancelled handlers of sync calls
+  g_cancellable_cancel(cancelled.get());
+}
+
+}  // namespace DBusCall
\ No newline at end of file
@@ -1,17 +1,124 @@
 #include "GattCharacteristic.h"
+#include "DBusCall.h"
+#include "Logger.h"
+#include "Tracing.h"
 #include <algorithm>
+#include <cstring>
 
-GattCharacteristic::GattCharacteristic(GDBusConnection*   connection,
-                                       const std::string& object_path)
+namespace
+{
+// Option dicts never change, so each is built once and shared by every call;
+// the outgoing message just takes another reference while it is serialized
+GVariant* build_options(const char* type)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+  if (type)
+  {
+    g_variant_builder_add(&builder, "{sv}", "type", g_variant_new_string(type));
+  }
+  return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+GVariant* empty_options()
+{
+  static GVariant* const options = build_options(nullptr);
+  return options;
+}
+
+GVariant* write_type_options(bool reliable)
+{
+  static GVariant* const request  = build_options("request");
+  static GVariant* const prepared = build_options("reliable");
+  return reliable ? prepared : request;
+}
+
+void report_error(BluezError* error, BluezErrorCode code, const char* message)
+{
+  if (error)
+  {
+    error->code     = code;
+    error->message  = message;
+    error->attempts = 0;
+  }
+}
+}  // namespace
+
+GattCharacteristic::GattCharacteristic(
+  GDBusConnection*                       connection,
+  const std::string&                     object_path,
+  GMainContext*                          context,
+  std::shared_ptr<DBusCall::CancelGroup> cancel_group)
   : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
   , object_path_(object_path)
+  , flags_(0)
   , notifications_enabled_(false)
+  , mtu_(ATT_DEFAULT_MTU)
+  , cancel_group_(cancel_group ? std::move(cancel_group)
+                               : std::make_shared<DBusCall::CancelGroup>())
 {
   if (connection_)
   {
     g_object_ref(connection_);
   }
   update_properties();
+  create_read_cache();
+  create_write_queue();
+}
+
+GattCharacteristic::GattCharacteristic(
+  GDBusConnection*                       connection,
+  const std::string&                     object_path,
+  GVariant*                              properties,
+  GMainContext*                          context,
+  std::shared_ptr<DBusCall::CancelGroup> cancel_group)
+  : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
+  , object_path_(object_path)
+  , flags_(0)
+  , notifications_enabled_(false)
+  , mtu_(ATT_DEFAULT_MTU)
+  , cancel_group_(cancel_group ? std::move(cancel_group)
+                               : std::make_shared<DBusCall::CancelGroup>())
+{
+  if (connection_)
+  {
+    g_object_ref(connection_);
+  }
+  load_properties(properties);
+  create_read_cache();
+  create_write_queue();
+}
+
+GattCharacteristic::GattCharacteristic(
+  GDBusConnection*                       connection,
+  const GattDatabase&                    database,
+  GattDatabase::Index                    index,
+  GMainContext*                          context,
+  std::shared_ptr<DBusCall::CancelGroup> cancel_group)
+  : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
+  , object_path_(database.string(database.characteristics()[index].path))
+  , service_path_(
+      database.string(database.characteristics()[index].service_path))
+  , uuid_(database.string(database.characteristics()[index].uuid))
+  , flags_(0)
+  , notifications_enabled_(false)
+  , mtu_(ATT_DEFAULT_MTU)
+  , cancel_group_(cancel_group ? std::move(cancel_group)
+                               : std::make_shared<DBusCall::CancelGroup>())
+{
+  if (connection_)
+  {
+    g_object_ref(connection_);
+  }
+  load_record(database, index);
+  create_read_cache();
+  create_write_queue();
 }
 
 GattCharacteristic::~GattCharacteristic()
@@ -25,64 +132,127 @@ GattCharacteristic::~GattCharacteristic()
   {
     g_object_unref(connection_);
   }
+  g_main_context_unref(context_);
 }
 
 void GattCharacteristic::update_properties()
 {
-  // Get UUID
-  auto uuid_var = get_property("UUID");
-  if (uuid_var)
+  // One GetAll instead of a Get per property
+  GVariant* properties = get_all_properties();
+  if (properties)
+  {
+    load_properties(properties);
+    g_variant_unref(properties);
+  }
+}
+
+void GattCharacteristic::load_properties(GVariant* properties)
+{
+  const gchar* value;
+  if (g_variant_lookup(properties, "UUID", "&s", &value))
   {
-    uuid_ = g_variant_get_string(uuid_var, nullptr);
-    g_variant_unref(uuid_var);
+    uuid_ = value;
   }
 
-  // Get Service path
-  auto service_var = get_property("Service");
-  if (service_var)
+  if (g_variant_lookup(properties, "Service", "&o", &value))
   {
-    service_path_ = g_variant_get_string(service_var, nullptr);
-    g_variant_unref(service_var);
+    service_path_ = value;
   }
 
-  // Get Flags
-  auto flags_var = get_property("Flags");
-  if (flags_var)
+  // Only exported by newer BlueZ versions
+  guint16 mtu;
+  if (g_variant_lookup(properties, "MTU", "q", &mtu) && mtu >= ATT_DEFAULT_MTU)
   {
-    flags_.clear();
+    mtu_ = mtu;
+  }
 
-    GVariantIter iter;
-    g_variant_iter_init(&iter, flags_var);
-    const gchar* flag;
+  GVariant* flags =
+    g_variant_lookup_value(properties, "Flags", G_VARIANT_TYPE_STRING_ARRAY);
+  if (flags)
+  {
+    flags_ = GattFlags::parse(flags);
+    g_variant_unref(flags);
+  }
+}
 
-    while (g_variant_iter_loop(&iter, "&s", &flag))
+bool GattCharacteristic::matches_record(const GattDatabase& database,
+                                        GattDatabase::Index index) const
+{
+  const GattDatabase::Characteristic& record =
+    database.characteristics()[index];
+  return database.string(record.uuid) == uuid_ &&
+         database.string(record.service_path) == service_path_;
+}
+
+void GattCharacteristic::load_record(const GattDatabase& database,
+                                     GattDatabase::Index index)
+{
+  const GattDatabase::Characteristic& record =
+    database.characteristics()[index];
+
+  flags_ = record.flags;
+  if (record.mtu >= ATT_DEFAULT_MTU)
+  {
+    mtu_ = record.mtu;
+  }
+}
+
+GVariant* GattCharacteristic::get_all_properties()
+{
+  TRACE_SPAN("gatt", "get_all_properties", object_path_);
+
+  if (!connection_)
+    return nullptr;
+
+  static const DBusCall::Method get_all_call{
+    "GattCharacteristic", BlueZ::PROPERTIES_INTERFACE, "GetAll"};
+  GError*   error  = nullptr;
+  GVariant* result = DBusCall::call_sync(
+    connection_,
+    object_path_.c_str(),
+    get_all_call,
+    g_variant_new("(s)", BlueZ::GATT_CHARACTERISTIC_INTERFACE),
+    G_VARIANT_TYPE("(a{sv})"),
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error,
+    cancel_group_->current().get());
+
+  if (!result)
+  {
+    if (error)
     {
-      flags_.push_back(flag);
+      g_error_free(error);
     }
-
-    g_variant_unref(flags_var);
+    return nullptr;
   }
+
+  GVariant* properties;
+  g_variant_get(result, "(@a{sv})", &properties);
+  g_variant_unref(result);
+
+  return properties;
 }
 
 GVariant* GattCharacteristic::get_property(const std::string& property)
 {
+  TRACE_SPAN("gatt", "get_property", property);
+
   if (!connection_)
     return nullptr;
 
+  static const DBusCall::Method get_call{
+    "GattCharacteristic", BlueZ::PROPERTIES_INTERFACE, "Get"};
   GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(
+  GVariant* result = DBusCall::call_sync(
     connection_,
-    BlueZ::SERVICE_NAME,
     object_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Get",
+    get_call,
     g_variant_new(
       "(ss)", BlueZ::GATT_CHARACTERISTIC_INTERFACE, property.c_str()),
     G_VARIANT_TYPE("(v)"),
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
-    nullptr,
-    &error);
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error,
+    cancel_group_->current().get());
 
   if (!result)
   {
@@ -106,27 +276,28 @@ bool GattCharacteristic::set_property(const std::string& property,
   if (!connection_)
     return false;
 
+  static const DBusCall::Method set_call{
+    "GattCharacteristic", BlueZ::PROPERTIES_INTERFACE, "Set"};
   GError*   error  = nullptr;
-  GVariant* result = g_dbus_connection_call_sync(
+  GVariant* result = DBusCall::call_sync(
     connection_,
-    BlueZ::SERVICE_NAME,
     object_path_.c_str(),
-    BlueZ::PROPERTIES_INTERFACE,
-    "Set",
-    g_variant_new(
-      "(ssv)", BlueZ::GATT_CHARACTERISTIC_INTERFACE, property.c_str(), value),
-    nullptr,
-    G_DBUS_CALL_FLAGS_NONE,
-    -1,
+    set_call,
+    g_variant_new("(ssv)",
+                  BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+                  property.c_str(),
+                  value),
     nullptr,
-    &error);
+    DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+    &error,
+    cancel_group_->current().get());
 
   if (!result)
   {
     if (error)
     {
-      std::cerr << "Failed to set characteristic property " << property << ": "
-                << error->message << std::endl;
+      LOG_ERROR("Failed to set characteristic property " + property + ": " +
+                error->message);
       g_error_free(error);
     }
     return false;
@@ -136,45 +307,212 @@ bool GattCharacteristic::set_property(const std::string& property,
   return true;
 }
 
-bool GattCharacteristic::read_value(std::vector<uint8_t>& data)
+void GattCharacteristic::create_read_cache()
 {
+  auto&           registry = Metrics::Registry::instance();
+  const char*     help     = "Characteristic reads by cache outcome";
+  Metrics::Labels labels   = {{"uuid", uuid_}};
+  auto            counter  = [&](const char* result)
+  {
+    Metrics::Labels result_labels = labels;
+    result_labels.push_back({"result", result});
+    return &registry.counter("bscm_read_cache_total", help, result_labels);
+  };
+
+  read_cache_            = std::make_shared<ReadCache>();
+  read_cache_->hits      = counter("hit");
+  read_cache_->misses    = counter("miss");
+  read_cache_->coalesced = counter("coalesced");
+}
+
+void GattCharacteristic::create_write_queue()
+{
+  auto&           registry = Metrics::Registry::instance();
+  const char*     help     = "Last-value-wins writes by outcome";
+  Metrics::Labels labels   = {{"uuid", uuid_}};
+  auto            counter  = [&](const char* outcome)
+  {
+    Metrics::Labels outcome_labels = labels;
+    outcome_labels.push_back({"outcome", outcome});
+    return &registry.counter(
+      "bscm_coalesced_writes_total", help, outcome_labels);
+  };
+
+  write_queue_               = std::make_shared<WriteQueue>();
+  write_queue_->connection   = connection_;
+  write_queue_->context      = g_main_context_ref(context_);
+  write_queue_->object_path  = object_path_;
+  write_queue_->cancel_group = cancel_group_;
+  write_queue_->sent         = counter("sent");
+  write_queue_->collapsed    = counter("collapsed");
+  write_queue_->failed       = counter("failed");
+
+  // Replies can outlive the characteristic
+  if (connection_)
+  {
+    g_object_ref(connection_);
+  }
+}
+
+void GattCharacteristic::set_read_cache_ttl(std::chrono::milliseconds ttl)
+{
+  std::lock_guard<std::mutex> lock(read_cache_->mutex);
+  read_cache_->ttl = ttl;
+  if (ttl.count() <= 0)
+  {
+    read_cache_->valid = false;
+    read_cache_->value.clear();
+  }
+}
+
+std::chrono::milliseconds GattCharacteristic::get_read_cache_ttl()
+{
+  std::lock_guard<std::mutex> lock(read_cache_->mutex);
+  return read_cache_->ttl;
+}
+
+void GattCharacteristic::invalidate_read_cache()
+{
+  std::lock_guard<std::mutex> lock(read_cache_->mutex);
+  read_cache_->valid = false;
+  read_cache_->value.clear();
+
+  // A read already in flight may have been answered with the old value:
+  // later reads start a new one, and its reply is not cached
+  ++read_cache_->generation;
+  read_cache_->flight.reset();
+}
+
+void GattCharacteristic::set_retry_policy(const RetryPolicy& policy)
+{
+  std::lock_guard<std::mutex> lock(retry_mutex_);
+  retry_policy_ = policy;
+}
+
+RetryPolicy GattCharacteristic::get_retry_policy()
+{
+  std::lock_guard<std::mutex> lock(retry_mutex_);
+  return retry_policy_;
+}
+
+bool GattCharacteristic::read_value(std::vector<uint8_t>&     data,
+                                    std::chrono::milliseconds timeout,
+                                    BluezError*               error)
+{
+  TRACE_SPAN("gatt", "read_value", object_path_);
+
   if (!connection_ || !can_read())
   {
-    Utils::print_with_timestamp("Characteristic does not support reading");
+    LOG_WARNING("Characteristic does not support reading");
+    report_error(error,
+                 BluezErrorCode::NotSupported,
+                 "Characteristic does not support reading");
     return false;
   }
 
-  GError* error = nullptr;
+  std::shared_ptr<ReadCache>  cache = read_cache_;
+  std::shared_ptr<ReadFlight> flight;
+  uint64_t                    generation;
+  {
+    std::unique_lock<std::mutex> lock(cache->mutex);
+    auto                         now = std::chrono::steady_clock::now();
+    if (cache->valid && now - cache->stored < cache->ttl)
+    {
+      cache->hits->increment();
+      data = cache->value;
+      report_error(error, BluezErrorCode::None, "");
+      return true;
+    }
 
-  // Create empty options dict
-  GVariantBuilder builder;
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
-  GVariant* options = g_variant_builder_end(&builder);
-
-  GVariant* result =
-    g_dbus_connection_call_sync(connection_,
-                                BlueZ::SERVICE_NAME,
-                                object_path_.c_str(),
-                                BlueZ::GATT_CHARACTERISTIC_INTERFACE,
-                                "ReadValue",
-                                g_variant_new_tuple(&options, 1),
-                                G_VARIANT_TYPE("(ay)"),
-                                G_DBUS_CALL_FLAGS_NONE,
-                                10000,
-                                nullptr,
-                                &error);
+    // Wait for the read in flight; its initiator logs any failure. An async
+    // read completes on the context, so its owner reads on its own instead.
+    if (cache->flight &&
+        !(cache->flight->async && g_main_context_is_owner(context_)))
+    {
+      cache->coalesced->increment();
+      std::shared_ptr<ReadFlight> joined = cache->flight;
+      if (!cache->done_cv.wait_until(
+            lock, now + timeout, [&] { return joined->done; }))
+      {
+        report_error(error,
+                     BluezErrorCode::Timeout,
+                     "Timed out waiting for the read in flight");
+        return false;
+      }
+      if (error)
+      {
+        *error = BluezError::from(joined->error, 0);
+      }
+      if (joined->error)
+        return false;
+      data = joined->value;
+      return true;
+    }
 
-  if (!result)
+    cache->misses->increment();
+    generation = cache->generation;
+    if (!cache->flight)
+    {
+      flight        = std::make_shared<ReadFlight>();
+      cache->flight = flight;
+    }
+  }
+
+  GError*  read_error = nullptr;
+  unsigned attempts   = 0;
+  bool     success    = run_with_retry(
+    get_retry_policy(),
+    "ReadValue",
+    timeout,
+    [&](std::chrono::milliseconds remaining, GError** attempt_error)
+    { return fetch_value(data, remaining, attempt_error); },
+    &read_error,
+    &attempts);
+  if (!success)
   {
-    if (error)
+    if (!read_error)
     {
-      std::cerr << "Failed to read characteristic: " << error->message
-                << std::endl;
-      g_error_free(error);
+      read_error = g_error_new_literal(
+        G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "ReadValue failed");
     }
-    return false;
+    LOG_ERROR("Failed to read characteristic: " +
+              std::string(read_error->message));
+  }
+  if (error)
+  {
+    *error = BluezError::from(read_error, attempts);
   }
 
+  if (flight)
+  {
+    finish_read(cache, flight, generation, data, read_error);
+  }
+  else if (read_error)
+  {
+    g_error_free(read_error);
+  }
+  return success;
+}
+
+bool GattCharacteristic::fetch_value(std::vector<uint8_t>&     data,
+                                     std::chrono::milliseconds timeout,
+                                     GError**                  error)
+{
+  GVariant* options = empty_options();
+  static const DBusCall::Method read_value_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "ReadValue"};
+  GVariant* result  = DBusCall::call_sync(connection_,
+                                          object_path_.c_str(),
+                                          read_value_call,
+                                          g_variant_new_tuple(&options, 1),
+                                          G_VARIANT_TYPE("(ay)"),
+                                          DBusCall::timeout_ms(timeout),
+                                          error,
+                                          cancel_group_->current().get());
+
+  if (!result)
+    return false;
+
   GVariant* value_array;
   g_variant_get(result, "(@ay)", &value_array);
 
@@ -186,143 +524,793 @@ bool GattCharacteristic::read_value(std::vector<uint8_t>& data)
   return true;
 }
 
-bool GattCharacteristic::write_value(const std::vector<uint8_t>& data)
+void GattCharacteristic::finish_read(const std::shared_ptr<ReadCache>&  cache,
+                                     const std::shared_ptr<ReadFlight>& flight,
+                                     uint64_t             generation,
+                                     std::vector<uint8_t> value,
+                                     GError*              error)
 {
-  if (!connection_ || (!can_write() && !can_write_without_response()))
+  std::vector<ReadCallback> waiters;
+  {
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    // Not cached if the cache was invalidated while the read was in flight
+    if (!error && cache->ttl.count() > 0 && generation == cache->generation)
+    {
+      cache->valid  = true;
+      cache->value  = value;
+      cache->stored = std::chrono::steady_clock::now();
+    }
+
+    flight->done  = true;
+    flight->value = std::move(value);
+    flight->error = error;
+    if (cache->flight == flight)
+    {
+      cache->flight.reset();
+    }
+    waiters.swap(flight->waiters);
+  }
+  cache->done_cv.notify_all();
+
+  for (const auto& waiter : waiters)
+  {
+    waiter(flight->value, flight->error);
+  }
+}
+
+void GattCharacteristic::read_value_async(ReadCallback              callback,
+                                          std::chrono::milliseconds timeout)
+{
+  if (!connection_ || !can_read())
+  {
+    GError* error = g_error_new_literal(G_DBUS_ERROR,
+                                        G_DBUS_ERROR_NOT_SUPPORTED,
+                                        "Characteristic does not support "
+                                        "reading");
+    callback({}, error);
+    g_error_free(error);
+    return;
+  }
+
+  // Until the read's reply, or until the cache answers or the read joins
+  // one already in flight
+  Tracing::AsyncSpan span("gatt", "read_value_async", object_path_);
+
+  std::shared_ptr<ReadCache>  cache = read_cache_;
+  std::shared_ptr<ReadFlight> flight;
+  uint64_t                    generation;
   {
-    Utils::print_with_timestamp("Characteristic does not support writing");
+    std::unique_lock<std::mutex> lock(cache->mutex);
+    auto                         now = std::chrono::steady_clock::now();
+    if (cache->valid && now - cache->stored < cache->ttl)
+    {
+      cache->hits->increment();
+      std::vector<uint8_t> data = cache->value;
+      lock.unlock();
+      span.end();
+      callback(data, nullptr);
+      return;
+    }
+
+    if (cache->flight)
+    {
+      cache->coalesced->increment();
+      cache->flight->waiters.push_back(std::move(callback));
+      span.end();
+      return;
+    }
+
+    cache->misses->increment();
+    flight        = std::make_shared<ReadFlight>();
+    cache->flight = flight;
+    generation    = cache->generation;
+    flight->async = true;
+    flight->waiters.push_back(std::move(callback));
+  }
+
+  GVariant* options = empty_options();
+  static const DBusCall::Method read_value_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "ReadValue"};
+  DBusCall::call(connection_,
+                 object_path_.c_str(),
+                 read_value_call,
+                 g_variant_new_tuple(&options, 1),
+                 G_VARIANT_TYPE("(ay)"),
+                 DBusCall::timeout_ms(timeout),
+                 [cache, flight, generation, span](GVariant* reply,
+                                                   GError*   error) mutable
+                 {
+                   span.end();
+                   if (!reply)
+                   {
+                     finish_read(
+                       cache, flight, generation, {}, g_error_copy(error));
+                     return;
+                   }
+
+                   GVariant* value_array;
+                   g_variant_get(reply, "(@ay)", &value_array);
+                   std::vector<uint8_t> data =
+                     Utils::variant_to_bytes(value_array);
+                   g_variant_unref(value_array);
+
+                   finish_read(
+                     cache, flight, generation, std::move(data), nullptr);
+                 },
+                 cancel_group_->current().get(),
+                 context_);
+}
+
+bool GattCharacteristic::read_value_into(uint8_t*                   buffer,
+                                         size_t                     capacity,
+                                         size_t&                    length,
+                                         const LongTransferOptions& options)
+{
+  TRACE_SPAN("gatt", "read_value_into", object_path_);
+
+  length = 0;
+  if (!connection_ || !can_read())
+  {
+    LOG_WARNING("Characteristic does not support reading");
     return false;
   }
 
-  GError* error = nullptr;
+  auto timeout =
+    options.timeout.count() > 0 ? options.timeout : DEFAULT_TIMEOUT;
+  auto cancellable = cancel_group_->current();
 
-  // Create byte array from data
-  GVariant* data_variant = g_variant_new_fixed_array(
-    G_VARIANT_TYPE_BYTE, data.data(), data.size(), sizeof(uint8_t));
+  // bluetoothd runs the Read Blob sequence itself and normally returns the
+  // rest of the value at once, so this loop rarely goes round more than
+  // twice. A reply shorter than one ATT payload, or an empty one, is the end.
+  size_t offset = options.offset;
+  while (length < capacity && offset < ATT_MAX_VALUE_LENGTH)
+  {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(
+      &builder, "{sv}", "offset", g_variant_new_uint16(offset));
 
-  // Create empty options dict
-  GVariantBuilder builder;
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
-  GVariant* options = g_variant_builder_end(&builder);
+    static const DBusCall::Method read_value_call{
+      "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "ReadValue"};
+    GError*   error  = nullptr;
+    GVariant* result = DBusCall::call_sync(
+      connection_,
+      object_path_.c_str(),
+      read_value_call,
+      g_variant_new("(@a{sv})", g_variant_builder_end(&builder)),
+      G_VARIANT_TYPE("(ay)"),
+      DBusCall::timeout_ms(timeout),
+      &error,
+      cancellable.get());
+
+    if (!result)
+    {
+      // Some servers reject a read positioned exactly at the end
+      gchar* remote = error ? g_dbus_error_get_remote_error(error) : nullptr;
+      bool   at_end =
+        length > 0 && g_strcmp0(remote, "org.bluez.Error.InvalidOffset") == 0;
+      g_free(remote);
+
+      if (error)
+      {
+        if (!at_end)
+        {
+          LOG_ERROR("Failed to read characteristic at offset " +
+                    std::to_string(offset) + ": " +
+                    std::string(error->message));
+        }
+        g_error_free(error);
+      }
+      return at_end;
+    }
+
+    // Copied once, from the reply straight into the caller's buffer
+    GVariant*      value = g_variant_get_child_value(result, 0);
+    gsize          size  = 0;
+    const uint8_t* bytes = static_cast<const uint8_t*>(
+      g_variant_get_fixed_array(value, &size, sizeof(uint8_t)));
+    size_t copied = std::min<size_t>(size, capacity - length);
+    if (copied > 0)
+    {
+      std::memcpy(buffer + length, bytes, copied);
+    }
+    g_variant_unref(value);
+    g_variant_unref(result);
+
+    length += copied;
+    offset += size;
+    if (options.progress)
+    {
+      options.progress(length, 0);
+    }
+
+    if (copied < size)
+    {
+      LOG_WARNING("Characteristic value truncated to " +
+                  std::to_string(capacity) + " bytes");
+      break;
+    }
+    if (size == 0 || size < static_cast<size_t>(mtu_ - 1))
+      break;
+  }
+
+  return true;
+}
+
+bool GattCharacteristic::write_value_long(const uint8_t*             data,
+                                          size_t                     length,
+                                          const LongTransferOptions& options)
+{
+  TRACE_SPAN("gatt", "write_value_long", object_path_);
+
+  if (!connection_ || !can_write())
+  {
+    LOG_WARNING("Characteristic does not support writing");
+    return false;
+  }
+  if (options.reliable && !can_write_reliable())
+  {
+    LOG_WARNING("Characteristic does not support reliable writes");
+    return false;
+  }
+  if (options.offset + length > ATT_MAX_VALUE_LENGTH)
+  {
+    LOG_ERROR("Write beyond the maximum attribute length");
+    return false;
+  }
+
+  // A reliable write must go out as a single prepared-write sequence to be
+  // executed atomically; splitting it would commit each piece separately
+  size_t chunk_size =
+    options.reliable || options.chunk_size == 0 ? length : options.chunk_size;
+
+  auto timeout =
+    options.timeout.count() > 0 ? options.timeout : LONG_WRITE_TIMEOUT;
+  auto   cancellable = cancel_group_->current();
+  size_t written     = 0;
+  do
+  {
+    size_t chunk = std::min(chunk_size, length - written);
+
+    // Only chunks past the start need a dict of their own
+    GVariant* write_options = write_type_options(options.reliable);
+    if (options.offset + written > 0)
+    {
+      GVariantBuilder builder;
+      g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+      g_variant_builder_add(
+        &builder,
+        "{sv}",
+        "type",
+        g_variant_new_string(options.reliable ? "reliable" : "request"));
+      g_variant_builder_add(
+        &builder,
+        "{sv}",
+        "offset",
+        g_variant_new_uint16(static_cast<uint16_t>(options.offset + written)));
+      write_options = g_variant_builder_end(&builder);
+    }
+
+    // Wraps the caller's bytes without copying; the message is serialized
+    // before call_sync() returns, while `data` is still valid
+    GVariant* value = g_variant_new_from_data(
+      G_VARIANT_TYPE_BYTESTRING, data + written, chunk, TRUE, nullptr, nullptr);
+
+    static const DBusCall::Method write_value_call{
+      "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "WriteValue"};
+    GError*   error  = nullptr;
+    GVariant* result = DBusCall::call_sync(
+      connection_,
+      object_path_.c_str(),
+      write_value_call,
+      g_variant_new("(@ay@a{sv})", value, write_options),
+      nullptr,
+      DBusCall::timeout_ms(timeout),
+      &error,
+      cancellable.get());
+
+    if (!result)
+    {
+      if (error)
+      {
+        LOG_ERROR("Failed to write characteristic at offset " +
+                  std::to_string(options.offset + written) + ": " +
+                  std::string(error->message));
+        g_error_free(error);
+      }
+      return false;
+    }
+    g_variant_unref(result);
+
+    written += chunk;
+    if (options.progress)
+    {
+      options.progress(written, length);
+    }
+  } while (written < length);
+
+  return true;
+}
+
+bool GattCharacteristic::write_value(const std::vector<uint8_t>& data,
+                                     std::chrono::milliseconds   timeout,
+                                     BluezError*                 error)
+{
+  return write_value(data.data(), data.size(), timeout, error);
+}
+
+bool GattCharacteristic::write_value(const uint8_t*            data,
+                                     size_t                    length,
+                                     std::chrono::milliseconds timeout,
+                                     BluezError*               error)
+{
+  TRACE_SPAN("gatt", "write_value", object_path_);
+
+  if (!check_writable())
+  {
+    report_error(error,
+                 BluezErrorCode::NotSupported,
+                 "Characteristic does not support writing");
+    return false;
+  }
 
-  GVariant* result = g_dbus_connection_call_sync(
+  // Wraps the caller's bytes without copying; the message is serialized
+  // before call_sync() returns, while `data` is still valid
+  return write_variant(g_variant_new_from_data(G_VARIANT_TYPE_BYTESTRING,
+                                               data,
+                                               length,
+                                               TRUE,
+                                               nullptr,
+                                               nullptr),
+                       timeout,
+                       error);
+}
+
+bool GattCharacteristic::write_value(GBytes*                   bytes,
+                                     std::chrono::milliseconds timeout,
+                                     BluezError*               error)
+{
+  TRACE_SPAN("gatt", "write_value", object_path_);
+
+  if (!check_writable())
+  {
+    report_error(error,
+                 BluezErrorCode::NotSupported,
+                 "Characteristic does not support writing");
+    return false;
+  }
+
+  return write_variant(
+    g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING, bytes, TRUE),
+    timeout,
+    error);
+}
+
+void GattCharacteristic::write_value_async(GBytes*                   bytes,
+                                           WriteCallback             callback,
+                                           std::chrono::milliseconds timeout)
+{
+  if (!check_writable())
+  {
+    GError* error = g_error_new_literal(G_DBUS_ERROR,
+                                        G_DBUS_ERROR_NOT_SUPPORTED,
+                                        "Characteristic does not support "
+                                        "writing");
+    callback(error);
+    g_error_free(error);
+    return;
+  }
+
+  Tracing::AsyncSpan span("gatt", "write_value_async", object_path_);
+
+  // The variant holds a reference to `bytes` until the message is sent
+  static const DBusCall::Method write_value_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "WriteValue"};
+  DBusCall::call(
     connection_,
-    BlueZ::SERVICE_NAME,
     object_path_.c_str(),
-    BlueZ::GATT_CHARACTERISTIC_INTERFACE,
-    "WriteValue",
-    g_variant_new("(@aya{sv})", data_variant, options),
-    nullptr,
-    G_DBUS_CALL_FLAGS_NONE,
-    10000,
+    write_value_call,
+    g_variant_new(
+      "(@ay@a{sv})",
+      g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING, bytes, TRUE),
+      empty_options()),
     nullptr,
-    &error);
+    DBusCall::timeout_ms(timeout),
+    [span, callback](GVariant* reply, GError* error) mutable
+    {
+      (void)reply;
+      span.end();
+      callback(error);
+    },
+    cancel_group_->current().get(),
+    context_);
+}
 
-  if (!result)
+bool GattCharacteristic::write_value_latest(const std::vector<uint8_t>& data,
+                                            std::chrono::milliseconds   timeout)
+{
+  TRACE_SPAN("gatt", "write_value_latest", object_path_);
+
+  if (!check_writable())
+    return false;
+
+  std::shared_ptr<WriteQueue> queue = write_queue_;
   {
-    if (error)
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->in_flight)
     {
-      std::cerr << "Failed to write characteristic: " << error->message
-                << std::endl;
-      g_error_free(error);
+      // Replace rather than append: only the newest value matters
+      if (queue->queued)
+      {
+        queue->collapsed->increment();
+      }
+      queue->value   = data;
+      queue->timeout = timeout;
+      queue->queued  = true;
+      return true;
     }
-    return false;
+    queue->in_flight = true;
   }
 
-  g_variant_unref(result);
+  send_queued_write(queue, data, timeout);
   return true;
 }
 
-bool GattCharacteristic::start_notifications(NotificationCallback callback)
+void GattCharacteristic::send_queued_write(
+  const std::shared_ptr<WriteQueue>& queue,
+  const std::vector<uint8_t>&        data,
+  std::chrono::milliseconds          timeout)
 {
-  if (!connection_ || !can_notify())
+  queue->sent->increment();
+
+  GBytes* bytes = g_bytes_new(data.data(), data.size());
+
+  static const DBusCall::Method write_value_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "WriteValue"};
+  DBusCall::call(
+    queue->connection,
+    queue->object_path.c_str(),
+    write_value_call,
+    g_variant_new(
+      "(@ay@a{sv})",
+      g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING, bytes, TRUE),
+      empty_options()),
+    nullptr,
+    DBusCall::timeout_ms(timeout),
+    [queue](GVariant* reply, GError* error)
+    {
+      (void)reply;
+      if (error)
+      {
+        queue->failed->increment();
+        LOG_WARNING("Coalesced write to " + queue->object_path +
+                    " failed: " + error->message);
+      }
+
+      // Send whatever arrived meanwhile; later values keep replacing it
+      // until this reply has been handled
+      std::vector<uint8_t>      next;
+      std::chrono::milliseconds next_timeout;
+      {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->queued)
+        {
+          queue->in_flight = false;
+          return;
+        }
+        next.swap(queue->value);
+        next_timeout  = queue->timeout;
+        queue->queued = false;
+      }
+      send_queued_write(queue, next, next_timeout);
+    },
+    queue->cancel_group->current().get(),
+    queue->context);
+
+  g_bytes_unref(bytes);
+}
+
+bool GattCharacteristic::check_writable()
+{
+  if (!connection_ || (!can_write() && !can_write_without_response()))
   {
-    Utils::print_with_timestamp(
-      "Characteristic does not support notifications");
+    LOG_WARNING("Characteristic does not support writing");
     return false;
   }
+  return true;
+}
 
-  if (notifications_enabled_)
+bool GattCharacteristic::write_variant(GVariant*                 value,
+                                       std::chrono::milliseconds timeout,
+                                       BluezError*               error)
+{
+  // Kept alive across attempts; each message takes its own reference
+  g_variant_ref_sink(value);
+
+  // Empty options let bluetoothd pick the write type from the flags
+  GError*  write_error = nullptr;
+  unsigned attempts    = 0;
+  bool     success     = run_with_retry(
+    get_retry_policy(),
+    "WriteValue",
+    timeout,
+    [&](std::chrono::milliseconds remaining, GError** attempt_error)
+    {
+      static const DBusCall::Method write_value_call{
+        "GattCharacteristic",
+        BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+        "WriteValue"};
+      GVariant* result = DBusCall::call_sync(
+        connection_,
+        object_path_.c_str(),
+        write_value_call,
+        g_variant_new("(@ay@a{sv})", value, empty_options()),
+        nullptr,
+        DBusCall::timeout_ms(remaining),
+        attempt_error,
+        cancel_group_->current().get());
+      if (!result)
+        return false;
+      g_variant_unref(result);
+      return true;
+    },
+    &write_error,
+    &attempts);
+  g_variant_unref(value);
+
+  if (error)
   {
-    stop_notifications();
+    *error = BluezError::from(write_error, attempts);
+  }
+  if (write_error)
+  {
+    LOG_ERROR("Failed to write characteristic: " +
+              std::string(write_error->message));
+    g_error_free(write_error);
+  }
+  return success;
+}
+
+uint32_t GattCharacteristic::start_notifications(NotificationCallback callback,
+                                                 BluezError*          error)
+{
+  TRACE_SPAN("gatt", "start_notifications", object_path_);
+
+  if (!connection_ || !can_notify())
+  {
+    LOG_WARNING("Characteristic does not support notifications");
+    report_error(error,
+                 BluezErrorCode::NotSupported,
+                 "Characteristic does not support notifications");
+    return 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    if (notifications_enabled_)
+      return attach_subscriber_locked(std::move(callback), error);
+  }
+
+  // Subscribed without the lock: that waits for the context's thread, whose
+  // notification callbacks may take it
+  auto handler = std::make_shared<NotificationHandler>(
+    connection_, object_path_, uuid_, context_);
+  if (!handler->enable_notifications())
+  {
+    report_error(error,
+                 BluezErrorCode::Unknown,
+                 "Failed to subscribe to PropertiesChanged");
+    return 0;
   }
 
-  // Create notification handler
-  notification_handler_ =
-    std::make_shared<NotificationHandler>(connection_, object_path_);
+  std::unique_lock<std::mutex> lock(notify_mutex_);
+  if (notifications_enabled_)
+  {
+    // Another thread got there first
+    uint32_t id = attach_subscriber_locked(std::move(callback), error);
+    lock.unlock();
+    handler->disable_notifications();
+    return id;
+  }
 
-  if (!notification_handler_->enable_notifications(
-        [this, callback](const std::string&          char_path,
-                         const std::vector<uint8_t>& data) {
-          if (callback)
-          {
-            callback(char_path, data);
-          }
-        }))
+  notification_handler_ = handler;
+  uint32_t id = notification_handler_->add_subscriber(std::move(callback));
+  if (!send_start_notify(error))
   {
     notification_handler_.reset();
-    return false;
+    lock.unlock();
+    handler->disable_notifications();
+    return 0;
   }
 
-  // Call StartNotify on the characteristic
-  GError*   error = nullptr;
-  GVariant* result =
-    g_dbus_connection_call_sync(connection_,
-                                BlueZ::SERVICE_NAME,
-                                object_path_.c_str(),
-                                BlueZ::GATT_CHARACTERISTIC_INTERFACE,
-                                "StartNotify",
-                                nullptr,
-                                nullptr,
-                                G_DBUS_CALL_FLAGS_NONE,
-                                10000,
-                                nullptr,
-                                &error);
+  notifications_enabled_ = true;
 
-  if (!result)
+  return id;
+}
+
+uint32_t GattCharacteristic::attach_subscriber_locked(
+  NotificationCallback callback,
+  BluezError*          error)
+{
+  // Later subscribers share the running subscription and its match rule. If
+  // the link dropped since, bluetoothd forgot the subscription: send
+  // StartNotify again before anyone attaches to it.
+  if (!notification_handler_->is_active() && !send_start_notify(error))
+    return 0;
+  report_error(error, BluezErrorCode::None, "");
+  return notification_handler_->add_subscriber(std::move(callback));
+}
+
+bool GattCharacteristic::send_start_notify(BluezError* error)
+{
+  GError*  notify_error = nullptr;
+  unsigned attempts     = 0;
+  bool     success      = run_with_retry(
+    get_retry_policy(),
+    "StartNotify",
+    DEFAULT_TIMEOUT,
+    [&](std::chrono::milliseconds remaining, GError** attempt_error)
+    {
+      static const DBusCall::Method start_notify_call{
+        "GattCharacteristic",
+        BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+        "StartNotify"};
+      GVariant* result =
+        DBusCall::call_sync(connection_,
+                            object_path_.c_str(),
+                            start_notify_call,
+                            nullptr,
+                            nullptr,
+                            DBusCall::timeout_ms(remaining),
+                            attempt_error,
+                            cancel_group_->current().get());
+      if (!result)
+        return false;
+      g_variant_unref(result);
+      return true;
+    },
+    &notify_error,
+    &attempts);
+
+  if (error)
   {
-    if (error)
+    *error = BluezError::from(notify_error, attempts);
+  }
+  if (!success)
+  {
+    if (notify_error)
     {
-      std::cerr << "Failed to start notifications: " << error->message
-                << std::endl;
-      g_error_free(error);
+      LOG_ERROR("Failed to start notifications: " +
+                std::string(notify_error->message));
+      g_error_free(notify_error);
     }
-    notification_handler_.reset();
     return false;
   }
 
-  g_variant_unref(result);
-  notifications_enabled_ = true;
+  notification_handler_->set_active(true);
+  return true;
+}
+
+void GattCharacteristic::suspend_notifications()
+{
+  std::lock_guard<std::mutex> lock(notify_mutex_);
+  if (notifications_enabled_)
+  {
+    notification_handler_->set_active(false);
+  }
+}
 
+void GattCharacteristic::resume_notifications()
+{
+  std::lock_guard<std::mutex> lock(notify_mutex_);
+  if (!notifications_enabled_ || notification_handler_->is_active())
+    return;
+
+  // Asynchronous: this runs from signal dispatch. On failure the
+  // subscription stays inactive and the next start_notifications() retries.
+  static const DBusCall::Method start_notify_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "StartNotify"};
+  std::weak_ptr<NotificationHandler> handler = notification_handler_;
+  DBusCall::call(connection_,
+                 object_path_.c_str(),
+                 start_notify_call,
+                 nullptr,
+                 nullptr,
+                 DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                 [handler](GVariant* reply, GError* error)
+                 {
+                   if (error)
+                   {
+                     LOG_WARNING("Failed to resume notifications: " +
+                                 std::string(error->message));
+                     return;
+                   }
+                   (void)reply;
+                   if (auto resumed = handler.lock())
+                   {
+                     resumed->set_active(true);
+                   }
+                 },
+                 cancel_group_->current().get(),
+                 context_);
+}
+
+bool GattCharacteristic::stop_notifications(uint32_t subscription_id)
+{
+  std::shared_ptr<NotificationHandler> stopped;
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+
+    if (!notifications_enabled_ ||
+        !notification_handler_->remove_subscriber(subscription_id))
+    {
+      return false;
+    }
+
+    if (notification_handler_->get_subscriber_count() == 0)
+    {
+      stopped = stop_notifications_locked();
+    }
+  }
+
+  // Unsubscribing waits for the context's thread; not under the lock
+  if (stopped)
+  {
+    stopped->disable_notifications();
+  }
   return true;
 }
 
 bool GattCharacteristic::stop_notifications()
 {
-  if (!connection_ || !notifications_enabled_)
-    return true;
+  std::shared_ptr<NotificationHandler> stopped;
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+
+    if (notifications_enabled_)
+    {
+      stopped = stop_notifications_locked();
+    }
+  }
+
+  if (stopped)
+  {
+    stopped->disable_notifications();
+  }
+  return true;
+}
+
+size_t GattCharacteristic::get_subscriber_count()
+{
+  std::lock_guard<std::mutex> lock(notify_mutex_);
+  return notifications_enabled_ ? notification_handler_->get_subscriber_count()
+                                : 0;
+}
+
+std::shared_ptr<NotificationHandler>
+GattCharacteristic::stop_notifications_locked()
+{
+  TRACE_SPAN("gatt", "stop_notifications", object_path_);
 
   // Call StopNotify on the characteristic
+  static const DBusCall::Method stop_notify_call{
+    "GattCharacteristic", BlueZ::GATT_CHARACTERISTIC_INTERFACE, "StopNotify"};
   GError*   error = nullptr;
-  GVariant* result =
-    g_dbus_connection_call_sync(connection_,
-                                BlueZ::SERVICE_NAME,
-                                object_path_.c_str(),
-                                BlueZ::GATT_CHARACTERISTIC_INTERFACE,
-                                "StopNotify",
-                                nullptr,
-                                nullptr,
-                                G_DBUS_CALL_FLAGS_NONE,
-                                10000,
-                                nullptr,
-                                &error);
+  GVariant* result = DBusCall::call_sync(connection_,
+                                         object_path_.c_str(),
+                                         stop_notify_call,
+                                         nullptr,
+                                         nullptr,
+                                         DBusCall::timeout_ms(DEFAULT_TIMEOUT),
+                                         &error,
+                                         cancel_group_->current().get());
 
   if (!result)
   {
     if (error)
     {
-      std::cerr << "Failed to stop notifications: " << error->message
-                << std::endl;
+      LOG_ERROR("Failed to stop notifications: " + std::string(error->message));
       g_error_free(error);
     }
     // Continue with cleanup even if the call failed
@@ -332,41 +1320,38 @@ bool GattCharacteristic::stop_notifications()
     g_variant_unref(result);
   }
 
-  // Disable notification handler
-  if (notification_handler_)
-  {
-    notification_handler_->disable_notifications();
-    notification_handler_.reset();
-  }
-
   notifications_enabled_ = false;
-  return true;
+  return std::move(notification_handler_);
 }
 
 bool GattCharacteristic::can_read() const
 {
-  return std::find(flags_.begin(), flags_.end(), "read") != flags_.end();
+  return flags_ & GattFlags::Read;
 }
 
 bool GattCharacteristic::can_write() const
 {
-  return std::find(flags_.begin(), flags_.end(), "write") != flags_.end();
+  return flags_ & GattFlags::Write;
 }
 
 bool GattCharacteristic::can_write_without_response() const
 {
-  return std::find(flags_.begin(), flags_.end(), "write-without-response") !=
-         flags_.end();
+  return flags_ & GattFlags::WriteWithoutResponse;
+}
+
+bool GattCharacteristic::can_write_reliable() const
+{
+  return flags_ & GattFlags::ReliableWrite;
 }
 
 bool GattCharacteristic::can_notify() const
 {
-  return std::find(flags_.begin(), flags_.end(), "notify") != flags_.end();
+  return flags_ & GattFlags::Notify;
 }
 
 bool GattCharacteristic::can_indicate() const
 {
-  return std::find(flags_.begin(), flags_.end(), "indicate") != flags_.end();
+  return flags_ & GattFlags::Indicate;
 }
 
 void GattCharacteristic::print_characteristic_info()
@@ -383,26 +1368,11 @@ void GattCharacteristic::print_characteristic_info()
 
 std::string GattCharacteristic::flags_to_string() const
 {
-  if (flags_.empty())
-  {
-    return "None";
-  }
-
-  std::string result;
-  for (size_t i = 0; i < flags_.size(); ++i)
-  {
-    result += flags_[i];
-    if (i < flags_.size() - 1)
-    {
-      result += ", ";
-    }
-  }
-
-  return result;
+  return GattFlags::to_string(flags_);
 }
 
 void GattCharacteristic::handle_notification(const std::vector<uint8_t>& data)
 {
-  Utils::print_with_timestamp("Notification received for " + uuid_ + ": " +
-                              Utils::bytes_to_hex_string(data));
+  LOG_DEBUG("Notification received for " + uuid_ + ": " +
+            Utils::bytes_to_hex_string(data));
 }
\ No newline at end of file
@@ -0,0 +1,530 @@
+#include "GattDatabase.h"
+#include "ManagedObjects.h"
+#include <algorithm>
+#include <cstring>
+
+namespace GattFlags
+{
+
+namespace
+{
+// In bit order
+constexpr const char* FLAG_NAMES[] = {
+  "broadcast",
+  "read",
+  "write-without-response",
+  "write",
+  "notify",
+  "indicate",
+  "authenticated-signed-writes",
+  "extended-properties",
+  "reliable-write",
+  "writable-auxiliaries",
+  "encrypt-read",
+  "encrypt-write",
+  "encrypt-notify",
+  "encrypt-indicate",
+  "encrypt-authenticated-read",
+  "encrypt-authenticated-write",
+  "encrypt-authenticated-notify",
+  "encrypt-authenticated-indicate",
+  "secure-read",
+  "secure-write",
+  "secure-notify",
+  "secure-indicate",
+  "authorize",
+};
+}  // namespace
+
+uint32_t parse(GVariant* flags)
+{
+  uint32_t     bits = 0;
+  GVariantIter iter;
+  const gchar* flag;
+
+  g_variant_iter_init(&iter, flags);
+  while (g_variant_iter_next(&iter, "&s", &flag))
+  {
+    for (size_t i = 0; i < G_N_ELEMENTS(FLAG_NAMES); ++i)
+    {
+      if (strcmp(flag, FLAG_NAMES[i]) == 0)
+      {
+        bits |= 1u << i;
+        break;
+      }
+    }
+  }
+  return bits;
+}
+
+std::vector<std::string> names(uint32_t flags)
+{
+  std::vector<std::string> result;
+  for (size_t i = 0; i < G_N_ELEMENTS(FLAG_NAMES); ++i)
+  {
+    if (flags & (1u << i))
+    {
+      result.push_back(FLAG_NAMES[i]);
+    }
+  }
+  return result;
+}
+
+std::string to_string(uint32_t flags)
+{
+  std::string result;
+  for (size_t i = 0; i < G_N_ELEMENTS(FLAG_NAMES); ++i)
+  {
+    if (flags & (1u << i))
+    {
+      if (!result.empty())
+      {
+        result += ", ";
+      }
+      result += FLAG_NAMES[i];
+    }
+  }
+  return result.empty() ? "None" : result;
+}
+}  // namespace GattFlags
+
+void GattDatabase::begin_update()
+{
+  // The last update's records stay readable for add_object() to copy from
+  services_.swap(previous_services_);
+  characteristics_.swap(previous_characteristics_);
+  descriptors_.swap(previous_descriptors_);
+  services_.clear();
+  characteristics_.clear();
+  descriptors_.clear();
+
+  ++generation_;
+  updating_ = true;
+}
+
+void GattDatabase::add_object(const char* object_path, GVariant* interfaces)
+{
+  StringId         path = intern(object_path);
+  std::string_view bytes(
+    static_cast<const char*>(g_variant_get_data(interfaces)),
+    g_variant_get_size(interfaces));
+
+  // Compared in full: a matching hash alone would reuse a changed record
+  auto known = known_.find(path);
+  if (known != known_.end() && known->second.bytes == bytes &&
+      reuse(known->second))
+  {
+    known->second.generation = generation_;
+    return;
+  }
+
+  // Only the GATT interfaces are unpacked; every object also carries
+  // Introspectable and Properties
+  Kind kind = Kind::None;
+  ManagedObjects::for_each_interface(
+    interfaces,
+    "org.bluez.Gatt",
+    [&](const char* interface_name, GVariant* properties)
+    {
+      if (strcmp(interface_name, BlueZ::GATT_SERVICE_INTERFACE) == 0)
+      {
+        record_service(path, properties);
+        kind = Kind::Service;
+      }
+      else if (strcmp(interface_name,
+                      BlueZ::GATT_CHARACTERISTIC_INTERFACE) == 0)
+      {
+        record_characteristic(path, properties);
+        kind = Kind::Characteristic;
+      }
+      else if (strcmp(interface_name, BlueZ::GATT_DESCRIPTOR_INTERFACE) == 0)
+      {
+        record_descriptor(path, properties);
+        kind = Kind::Descriptor;
+      }
+    });
+
+  KnownObject& entry = known_[path];
+  entry.bytes.assign(bytes.data(), bytes.size());
+  entry.generation = generation_;
+  entry.kind       = kind;
+  entry.index      = NONE;
+}
+
+bool GattDatabase::reuse(const KnownObject& known)
+{
+  if (known.kind == Kind::None)
+    return true;
+
+  // Indices only hold for the arrays of the update right before this one
+  if (!updating_ || known.generation != generation_ - 1 || known.index == NONE)
+    return false;
+
+  switch (known.kind)
+  {
+    case Kind::Service:
+      services_.push_back(previous_services_[known.index]);
+      break;
+    case Kind::Characteristic:
+      characteristics_.push_back(previous_characteristics_[known.index]);
+      break;
+    case Kind::Descriptor:
+      descriptors_.push_back(previous_descriptors_[known.index]);
+      break;
+    case Kind::None:
+      break;
+  }
+  return true;
+}
+
+void GattDatabase::add_service(const char* object_path, GVariant* properties)
+{
+  // Not from add_object(), so the next rebuild has to unpack it again
+  StringId path = intern(object_path);
+  known_.erase(path);
+  record_service(path, properties);
+}
+
+void GattDatabase::add_characteristic(const char* object_path,
+                                      GVariant*   properties)
+{
+  StringId path = intern(object_path);
+  known_.erase(path);
+  record_characteristic(path, properties);
+}
+
+void GattDatabase::add_descriptor(const char* object_path, GVariant* properties)
+{
+  StringId path = intern(object_path);
+  known_.erase(path);
+  record_descriptor(path, properties);
+}
+
+void GattDatabase::record_service(StringId path, GVariant* properties)
+{
+  Service service = {path, intern(""), false, NONE, 0};
+
+  GVariantIter iter;
+  const gchar* key;
+  GVariant*    value;
+  g_variant_iter_init(&iter, properties);
+  while (g_variant_iter_next(&iter, "{&sv}", &key, &value))
+  {
+    if (strcmp(key, "UUID") == 0 &&
+        g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+    {
+      service.uuid = intern(g_variant_get_string(value, nullptr));
+    }
+    else if (strcmp(key, "Primary") == 0 &&
+             g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN))
+    {
+      service.primary = g_variant_get_boolean(value) != FALSE;
+    }
+    g_variant_unref(value);
+  }
+
+  auto it = std::find_if(services_.begin(),
+                         services_.end(),
+                         [&](const Service& existing)
+                         { return existing.path == service.path; });
+  if (it != services_.end())
+  {
+    *it = service;
+  }
+  else
+  {
+    services_.push_back(service);
+  }
+}
+
+void GattDatabase::record_characteristic(StringId path, GVariant* properties)
+{
+  Characteristic characteristic = {
+    path, intern(""), intern(""), NONE, 0, 0, NONE, 0};
+
+  // One pass instead of a lookup, and a scan from the start, per property
+  GVariantIter iter;
+  const gchar* key;
+  GVariant*    value;
+  g_variant_iter_init(&iter, properties);
+  while (g_variant_iter_next(&iter, "{&sv}", &key, &value))
+  {
+    if (strcmp(key, "UUID") == 0 &&
+        g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+    {
+      characteristic.uuid = intern(g_variant_get_string(value, nullptr));
+    }
+    else if (strcmp(key, "Service") == 0 &&
+             g_variant_is_of_type(value, G_VARIANT_TYPE_OBJECT_PATH))
+    {
+      characteristic.service_path =
+        intern(g_variant_get_string(value, nullptr));
+    }
+    else if (strcmp(key, "Flags") == 0 &&
+             g_variant_is_of_type(value, G_VARIANT_TYPE_STRING_ARRAY))
+    {
+      characteristic.flags = GattFlags::parse(value);
+    }
+    else if (strcmp(key, "MTU") == 0 &&
+             g_variant_is_of_type(value, G_VARIANT_TYPE_UINT16))
+    {
+      characteristic.mtu = g_variant_get_uint16(value);
+    }
+    g_variant_unref(value);
+  }
+
+  auto it = std::find_if(characteristics_.begin(),
+                         characteristics_.end(),
+                         [&](const Characteristic& existing)
+                         { return existing.path == characteristic.path; });
+  if (it != characteristics_.end())
+  {
+    *it = characteristic;
+  }
+  else
+  {
+    characteristics_.push_back(characteristic);
+  }
+}
+
+void GattDatabase::record_descriptor(StringId path, GVariant* properties)
+{
+  Descriptor descriptor = {path, intern(""), intern(""), NONE};
+
+  GVariantIter iter;
+  const gchar* key;
+  GVariant*    value;
+  g_variant_iter_init(&iter, properties);
+  while (g_variant_iter_next(&iter, "{&sv}", &key, &value))
+  {
+    if (strcmp(key, "UUID") == 0 &&
+        g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+    {
+      descriptor.uuid = intern(g_variant_get_string(value, nullptr));
+    }
+    else if (strcmp(key, "Characteristic") == 0 &&
+             g_variant_is_of_type(value, G_VARIANT_TYPE_OBJECT_PATH))
+    {
+      descriptor.characteristic_path =
+        intern(g_variant_get_string(value, nullptr));
+    }
+    g_variant_unref(value);
+  }
+
+  auto it = std::find_if(descriptors_.begin(),
+                         descriptors_.end(),
+                         [&](const Descriptor& existing)
+                         { return existing.path == descriptor.path; });
+  if (it != descriptors_.end())
+  {
+    *it = descriptor;
+  }
+  else
+  {
+    descriptors_.push_back(descriptor);
+  }
+}
+
+void GattDatabase::end_update()
+{
+  // Children are ordered by parent first, which makes each parent's
+  // children one contiguous range
+  std::sort(services_.begin(),
+            services_.end(),
+            [this](const Service& a, const Service& b)
+            { return less(a.path, b.path); });
+  std::sort(characteristics_.begin(),
+            characteristics_.end(),
+            [this](const Characteristic& a, const Characteristic& b)
+            {
+              if (a.service_path != b.service_path)
+                return less(a.service_path, b.service_path);
+              return less(a.path, b.path);
+            });
+  std::sort(descriptors_.begin(),
+            descriptors_.end(),
+            [this](const Descriptor& a, const Descriptor& b)
+            {
+              if (a.characteristic_path != b.characteristic_path)
+                return less(a.characteristic_path, b.characteristic_path);
+              return less(a.path, b.path);
+            });
+
+  for (auto& service : services_)
+  {
+    service.first_characteristic = NONE;
+    service.characteristic_count = 0;
+  }
+  for (Index i = 0; i < characteristics_.size(); ++i)
+  {
+    Characteristic& characteristic  = characteristics_[i];
+    characteristic.first_descriptor = NONE;
+    characteristic.descriptor_count = 0;
+
+    // Services are sorted by path
+    auto it = std::lower_bound(services_.begin(),
+                               services_.end(),
+                               characteristic.service_path,
+                               [this](const Service& service, StringId path)
+                               { return less(service.path, path); });
+    if (it == services_.end() || it->path != characteristic.service_path)
+    {
+      characteristic.service = NONE;
+      continue;
+    }
+
+    characteristic.service = static_cast<Index>(it - services_.begin());
+    if (it->characteristic_count++ == 0)
+    {
+      it->first_characteristic = i;
+    }
+  }
+
+  // Descriptors of one characteristic are adjacent, so the characteristic
+  // is only searched for when the parent changes
+  Index parent = NONE;
+  for (Index i = 0; i < descriptors_.size(); ++i)
+  {
+    Descriptor& descriptor = descriptors_[i];
+    if (parent == NONE ||
+        characteristics_[parent].path != descriptor.characteristic_path)
+    {
+      parent = NONE;
+      for (Index c = 0; c < characteristics_.size(); ++c)
+      {
+        if (characteristics_[c].path == descriptor.characteristic_path)
+        {
+          parent = c;
+          break;
+        }
+      }
+    }
+
+    descriptor.characteristic = parent;
+    if (parent != NONE && characteristics_[parent].descriptor_count++ == 0)
+    {
+      characteristics_[parent].first_descriptor = i;
+    }
+  }
+
+  // Where the next rebuild finds each record
+  for (Index i = 0; i < services_.size(); ++i)
+  {
+    set_index(services_[i].path, i);
+  }
+  for (Index i = 0; i < characteristics_.size(); ++i)
+  {
+    set_index(characteristics_[i].path, i);
+  }
+  for (Index i = 0; i < descriptors_.size(); ++i)
+  {
+    set_index(descriptors_[i].path, i);
+  }
+  updating_ = false;
+}
+
+void GattDatabase::set_index(StringId path, Index index)
+{
+  auto known = known_.find(path);
+  if (known != known_.end() && known->second.generation == generation_)
+  {
+    known->second.index = index;
+  }
+}
+
+GattDatabase::Index GattDatabase::find_characteristic(
+  std::string_view object_path) const
+{
+  StringId path = lookup(object_path);
+  if (path == NONE)
+    return NONE;
+
+  for (Index i = 0; i < characteristics_.size(); ++i)
+  {
+    if (characteristics_[i].path == path)
+      return i;
+  }
+  return NONE;
+}
+
+GattDatabase::Index GattDatabase::find_characteristic(
+  std::string_view service_uuid,
+  std::string_view char_uuid) const
+{
+  Index service = service_uuid.empty() ? NONE : find_service(service_uuid);
+  if (service != NONE)
+  {
+    const Service& record = services_[service];
+    Index          found  = find_uuid(characteristics_,
+                                      record.first_characteristic,
+                                      record.first_characteristic +
+                                        record.characteristic_count,
+                                      char_uuid);
+    if (found != NONE)
+      return found;
+  }
+
+  return find_uuid(characteristics_, 0, characteristics_.size(), char_uuid);
+}
+
+GattDatabase::Index GattDatabase::find_service(std::string_view uuid) const
+{
+  return find_uuid(services_, 0, services_.size(), uuid);
+}
+
+template <typename Record>
+GattDatabase::Index GattDatabase::find_uuid(const std::vector<Record>& records,
+                                            Index                      begin,
+                                            Index                      end,
+                                            std::string_view uuid) const
+{
+  // UUIDs are usually asked for as BlueZ spells them, which is one integer
+  // comparison per record once the string is found in the pool
+  StringId id = lookup(uuid);
+  if (id != NONE)
+  {
+    for (Index i = begin; i < end; ++i)
+    {
+      if (records[i].uuid == id)
+        return i;
+    }
+  }
+
+  for (Index i = begin; i < end; ++i)
+  {
+    if (uuid_matches(records[i].uuid, uuid))
+      return i;
+  }
+  return NONE;
+}
+
+GattDatabase::StringId GattDatabase::intern(std::string_view value)
+{
+  auto it = ids_.find(value);
+  if (it != ids_.end())
+    return it->second;
+
+  // Deque elements never move, so the key can view the stored string
+  StringId id = static_cast<StringId>(strings_.size());
+  strings_.emplace_back(value);
+  ids_.emplace(strings_.back(), id);
+  return id;
+}
+
+GattDatabase::StringId GattDatabase::lookup(std::string_view value) const
+{
+  auto it = ids_.find(value);
+  return it != ids_.end() ? it->second : NONE;
+}
+
+bool GattDatabase::uuid_matches(StringId uuid, std::string_view value) const
+{
+  const std::string& stored = strings_[uuid];
+  return stored.size() == value.size() &&
+         g_ascii_strncasecmp(stored.data(), value.data(), value.size()) == 0;
+}
+
+bool GattDatabase::less(StringId a, StringId b) const
+{
+  return strings_[a] < strings_[b];
+}
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+Logger& Logger::instance()
+{
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger()
+  : enqueue_pos_(0)
+  , dequeue_pos_(0)
+  , level_(LogLevel::Info)
+  , has_sink_(false)
+  , sink_idle_(false)
+  , running_(false)
+  , dropped_(0)
+{
+  for (size_t i = 0; i < QUEUE_CAPACITY; ++i)
+  {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+Logger::~Logger()
+{
+  stop_sink_thread();
+}
+
+void Logger::set_level(LogLevel level)
+{
+  level_.store(level, std::memory_order_relaxed);
+}
+
+void Logger::set_sink(LogSink sink)
+{
+  stop_sink_thread();
+
+  {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    sink_ = std::move(sink);
+  }
+
+  if (sink_)
+  {
+    running_     = true;
+    sink_thread_ = std::thread(&Logger::sink_thread_main, this);
+    has_sink_    = true;
+  }
+}
+
+void Logger::log(LogLevel level, const std::string& message)
+{
+  log(level, message.data(), message.size());
+}
+
+void Logger::log(LogLevel level, const char* message, size_t length)
+{
+  if (!is_enabled(level))
+    return;
+
+  // Bounded MPMC ring (Vyukov): claim a slot whose sequence equals our
+  // position, fill it, then publish by advancing its sequence.
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot*  slot;
+  for (;;)
+  {
+    slot          = &slots_[pos & (QUEUE_CAPACITY - 1)];
+    size_t   seq  = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+    if (diff == 0)
+    {
+      if (enqueue_pos_.compare_exchange_weak(
+            pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // Queue full: never block the caller
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  length       = std::min(length, MAX_MESSAGE_LENGTH);
+  slot->level  = level;
+  slot->time   = std::chrono::system_clock::now();
+  slot->length = static_cast<uint16_t>(length);
+  std::memcpy(slot->text, message, length);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+
+  if (sink_idle_.load(std::memory_order_relaxed))
+  {
+    wake_cv_.notify_one();
+  }
+}
+
+void Logger::flush()
+{
+  size_t target = enqueue_pos_.load(std::memory_order_acquire);
+  while (running_ && dequeue_pos_.load(std::memory_order_acquire) < target)
+  {
+    wake_cv_.notify_one();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+bool Logger::drain()
+{
+  bool drained_any = false;
+  char timestamp[32];
+
+  std::lock_guard<std::mutex> lock(sink_mutex_);
+  for (;;)
+  {
+    size_t pos  = dequeue_pos_.load(std::memory_order_relaxed);
+    Slot&  slot = slots_[pos & (QUEUE_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+      break;
+
+    Utils::format_timestamp(slot.time, timestamp, sizeof(timestamp));
+    if (sink_)
+    {
+      sink_(LogRecord{slot.level, timestamp, slot.text, slot.length});
+    }
+
+    slot.sequence.store(pos + QUEUE_CAPACITY, std::memory_order_release);
+    dequeue_pos_.store(pos + 1, std::memory_order_release);
+    drained_any = true;
+  }
+
+  return drained_any;
+}
+
+void Logger::sink_thread_main()
+{
+  while (running_)
+  {
+    if (drain())
+      continue;
+
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    sink_idle_ = true;
+    // Producers only signal when they see the idle flag, so a wakeup can be
+    // missed in the window above; the timeout bounds the resulting delay.
+    wake_cv_.wait_for(lock, std::chrono::milliseconds(20));
+    sink_idle_ = false;
+  }
+
+  drain();
+}
+
+void Logger::stop_sink_thread()
+{
+  has_sink_ = false;
+  if (!sink_thread_.joinable())
+    return;
+
+  running_ = false;
+  wake_cv_.notify_one();
+  sink_thread_.join();
+}
+
+LogSink Logger::stream_sink(FILE* stream)
+{
+  return [stream](const LogRecord& record) {
+    std::fprintf(stream,
+                 "[%s] %-5s %.*s\n",
+                 record.timestamp,
+                 level_to_string(record.level),
+                 static_cast<int>(record.length),
+                 record.message);
+    std::fflush(stream);
+  };
+}
+
+const char* Logger::level_to_string(LogLevel level)
+{
+  switch (level)
+  {
+    case LogLevel::Debug:
+      return "DEBUG";
+    case LogLevel::Info:
+      return "INFO";
+    case LogLevel::Warning:
+      return "WARN";
+    case LogLevel::Error:
+      return "ERROR";
+    default:
+      return "";
+  }
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "ManagedObjects.h"
+#include <cstring>
+
+namespace ManagedObjects
+{
+
+namespace
+{
+// {oa{sa{sv}}} entries, and the interface dicts inside them, are 8-byte
+// aligned because the innermost values are variants
+constexpr size_t ENTRY_ALIGNMENT = 8;
+
+size_t align_up(size_t offset)
+{
+  return (offset + ENTRY_ALIGNMENT - 1) & ~(ENTRY_ALIGNMENT - 1);
+}
+
+// Width of the framing offsets of a container of `size` bytes
+size_t offset_width(size_t size)
+{
+  if (size > G_MAXUINT32)
+    return 8;
+  if (size > G_MAXUINT16)
+    return 4;
+  if (size > G_MAXUINT8)
+    return 2;
+  return size > 0 ? 1 : 0;
+}
+
+// Framing offsets are little-endian regardless of the value's byte order
+size_t read_offset(const uint8_t* data, size_t width)
+{
+  size_t value = 0;
+  for (size_t i = 0; i < width; ++i)
+  {
+    value |= static_cast<size_t>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+// Locates the key and the value of one dict entry: the key with its nul,
+// padding, the value, then one framing offset holding where the key ends.
+// False if the framing does not add up.
+bool split_entry(const uint8_t* entry,
+                 size_t         size,
+                 size_t&        key_end,
+                 size_t&        value_start,
+                 size_t&        value_end)
+{
+  size_t width = offset_width(size);
+  if (size <= width)
+    return false;
+
+  key_end     = read_offset(entry + size - width, width);
+  value_start = align_up(key_end);
+  value_end   = size - width;
+  return key_end > 0 && value_start <= value_end && entry[key_end - 1] == '\0';
+}
+
+// Regular accessors for entry `index`, used when its framing is unusable
+void visit_child(GVariant*            dict,
+                 size_t               index,
+                 const char*          key_prefix,
+                 const ObjectVisitor& visit)
+{
+  GVariant*    entry = g_variant_get_child_value(dict, index);
+  GVariant*    key   = g_variant_get_child_value(entry, 0);
+  const gchar* name  = g_variant_get_string(key, nullptr);
+
+  if (g_str_has_prefix(name, key_prefix))
+  {
+    GVariant* value = g_variant_get_child_value(entry, 1);
+    visit(name, value);
+    g_variant_unref(value);
+  }
+
+  g_variant_unref(key);
+  g_variant_unref(entry);
+}
+
+// Calls `visit` for the entries of `dict`, an a{sX} or a{oX} whose values are
+// of type `value_type` and 8-byte aligned, with a key starting with
+// `key_prefix`
+void walk(GVariant*            dict,
+          const GVariantType*  value_type,
+          const char*          key_prefix,
+          const ObjectVisitor& visit)
+{
+  auto*  data          = static_cast<const uint8_t*>(g_variant_get_data(dict));
+  size_t size          = g_variant_get_size(dict);
+  size_t prefix_length = std::strlen(key_prefix);
+
+  if (size == 0)
+    return;
+
+  // Array of variable-sized entries: the entries, then one framing offset
+  // per entry holding where it ends
+  size_t width = offset_width(size);
+  size_t table = read_offset(data + size - width, width);
+  if (table > size - width || (size - table) % width != 0)
+  {
+    size_t count = g_variant_n_children(dict);
+    for (size_t i = 0; i < count; ++i)
+    {
+      visit_child(dict, i, key_prefix, visit);
+    }
+    return;
+  }
+
+  size_t count = (size - table) / width;
+  size_t start = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    size_t end = read_offset(data + table + i * width, width);
+    size_t key_end, value_start, value_end;
+
+    if (end <= start || end > table ||
+        !split_entry(
+          data + start, end - start, key_end, value_start, value_end))
+    {
+      visit_child(dict, i, key_prefix, visit);
+    }
+    else
+    {
+      const uint8_t* entry = data + start;
+      const char*    key   = reinterpret_cast<const char*>(entry);
+      if (key_end - 1 >= prefix_length &&
+          std::memcmp(key, key_prefix, prefix_length) == 0)
+      {
+        GVariant* value = g_variant_new_from_data(
+          value_type,
+          entry + value_start,
+          value_end - value_start,
+          FALSE,
+          reinterpret_cast<GDestroyNotify>(g_variant_unref),
+          g_variant_ref(dict));
+        g_variant_ref_sink(value);
+        visit(key, value);
+        g_variant_unref(value);
+      }
+    }
+
+    start = align_up(end);
+  }
+}
+}  // namespace
+
+void for_each_object(GVariant*            reply,
+                     const char*          path_prefix,
+                     const ObjectVisitor& visit)
+{
+  // The array is the tuple's only member, so it shares the tuple's data
+  GVariant* objects = g_variant_get_child_value(reply, 0);
+  walk(objects, G_VARIANT_TYPE("a{sa{sv}}"), path_prefix, visit);
+  g_variant_unref(objects);
+}
+
+void for_each_interface(GVariant*            interfaces,
+                        const char*          name_prefix,
+                        const ObjectVisitor& visit)
+{
+  walk(interfaces, G_VARIANT_TYPE_VARDICT, name_prefix, visit);
+}
+}  // namespace ManagedObjects
\ No newline at end of file
@@ -0,0 +1,452 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Metrics
+{
+
+namespace
+{
+std::string format_labels(const Labels& labels)
+{
+  if (labels.empty())
+    return "";
+
+  std::string result = "{";
+  for (size_t i = 0; i < labels.size(); ++i)
+  {
+    if (i > 0)
+    {
+      result += ",";
+    }
+    result += labels[i].first + "=\"";
+    // The exposition format's escapes: \\, \" and \n
+    for (char c : labels[i].second)
+    {
+      if (c == '\n')
+      {
+        result += "\\n";
+        continue;
+      }
+      if (c == '"' || c == '\\')
+      {
+        result += '\\';
+      }
+      result += c;
+    }
+    result += "\"";
+  }
+  result += "}";
+  return result;
+}
+
+// Insert an extra label (e.g. "le") into an already formatted label set
+std::string with_label(const std::string& labels,
+                       const std::string& name,
+                       const std::string& value)
+{
+  std::string extra = name + "=\"" + value + "\"";
+  if (labels.empty())
+    return "{" + extra + "}";
+  return labels.substr(0, labels.size() - 1) + "," + extra + "}";
+}
+
+std::string format_double(double value)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  return buffer;
+}
+}  // namespace
+
+size_t shard_index()
+{
+  static std::atomic<size_t> next_index{0};
+  thread_local size_t        index =
+    next_index.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+  return index;
+}
+
+uint64_t Counter::value() const
+{
+  uint64_t total = 0;
+  for (const auto& shard : shards_)
+  {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+Histogram::Histogram(const std::vector<double>& bounds) : bounds_(bounds)
+{
+  if (bounds_.size() > MAX_BUCKETS)
+  {
+    bounds_.resize(MAX_BUCKETS);
+  }
+
+  for (auto& shard : shards_)
+  {
+    for (auto& bucket : shard.buckets)
+    {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    shard.count.store(0, std::memory_order_relaxed);
+    shard.sum_ns.store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::observe(double seconds)
+{
+  size_t bucket =
+    std::lower_bound(bounds_.begin(), bounds_.end(), seconds) - bounds_.begin();
+
+  Shard& shard = shards_[shard_index()];
+  shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.count.fetch_add(1, std::memory_order_relaxed);
+  shard.sum_ns.fetch_add(static_cast<uint64_t>(std::max(seconds, 0.0) * 1e9),
+                         std::memory_order_relaxed);
+}
+
+void Histogram::snapshot(std::vector<uint64_t>& buckets,
+                         uint64_t&              count,
+                         double&                sum) const
+{
+  buckets.assign(bounds_.size() + 1, 0);
+  count           = 0;
+  uint64_t sum_ns = 0;
+
+  for (const auto& shard : shards_)
+  {
+    for (size_t i = 0; i <= bounds_.size(); ++i)
+    {
+      buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+    }
+    count += shard.count.load(std::memory_order_relaxed);
+    sum_ns += shard.sum_ns.load(std::memory_order_relaxed);
+  }
+
+  for (size_t i = 1; i < buckets.size(); ++i)
+  {
+    buckets[i] += buckets[i - 1];
+  }
+  sum = static_cast<double>(sum_ns) / 1e9;
+}
+
+const std::vector<double>& latency_buckets()
+{
+  static const std::vector<double> buckets = {0.0001,
+                                              0.0005,
+                                              0.001,
+                                              0.0025,
+                                              0.005,
+                                              0.01,
+                                              0.025,
+                                              0.05,
+                                              0.1,
+                                              0.25,
+                                              0.5,
+                                              1.0,
+                                              2.5,
+                                              5.0,
+                                              10.0,
+                                              30.0};
+  return buckets;
+}
+
+Registry& Registry::instance()
+{
+  static Registry registry;
+  return registry;
+}
+
+Registry::Registry() : socket_fd_(-1), exporter_running_(false) {}
+
+Registry::~Registry()
+{
+  stop_socket_exporter();
+}
+
+Registry::Family& Registry::family(const std::string& name,
+                                   const std::string& help,
+                                   Type               type)
+{
+  auto it = families_.find(name);
+  if (it == families_.end())
+  {
+    it = families_.emplace(name, Family{help, type, {}, {}, {}}).first;
+  }
+  return it->second;
+}
+
+Counter& Registry::counter(const std::string& name,
+                           const std::string& help,
+                           const Labels&      labels)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto&                       metric =
+    family(name, help, Type::Counter).counters[format_labels(labels)];
+  if (!metric)
+  {
+    metric = std::make_unique<Counter>();
+  }
+  return *metric;
+}
+
+Gauge& Registry::gauge(const std::string& name,
+                       const std::string& help,
+                       const Labels&      labels)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto&                       metric =
+    family(name, help, Type::Gauge).gauges[format_labels(labels)];
+  if (!metric)
+  {
+    metric = std::make_unique<Gauge>();
+  }
+  return *metric;
+}
+
+Histogram& Registry::histogram(const std::string&         name,
+                               const std::string&         help,
+                               const Labels&              labels,
+                               const std::vector<double>& bounds)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto&                       metric =
+    family(name, help, Type::Histogram).histograms[format_labels(labels)];
+  if (!metric)
+  {
+    metric = std::make_unique<Histogram>(bounds);
+  }
+  return *metric;
+}
+
+std::string Registry::render()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream          out;
+
+  for (const auto& pair : families_)
+  {
+    const std::string& name   = pair.first;
+    const Family&      family = pair.second;
+
+    out << "# HELP " << name << " " << family.help << "\n";
+    switch (family.type)
+    {
+      case Type::Counter:
+        out << "# TYPE " << name << " counter\n";
+        for (const auto& metric : family.counters)
+        {
+          out << name << metric.first << " " << metric.second->value()
+              << "\n";
+        }
+        break;
+
+      case Type::Gauge:
+        out << "# TYPE " << name << " gauge\n";
+        for (const auto& metric : family.gauges)
+        {
+          out << name << metric.first << " " << metric.second->value()
+              << "\n";
+        }
+        break;
+
+      case Type::Histogram:
+        out << "# TYPE " << name << " histogram\n";
+        for (const auto& metric : family.histograms)
+        {
+          std::vector<uint64_t> buckets;
+          uint64_t              count;
+          double                sum;
+          metric.second->snapshot(buckets, count, sum);
+
+          const auto& bounds = metric.second->bounds();
+          for (size_t i = 0; i < buckets.size(); ++i)
+          {
+            std::string le =
+              i < bounds.size() ? format_double(bounds[i]) : "+Inf";
+            out << name << "_bucket" << with_label(metric.first, "le", le)
+                << " " << buckets[i] << "\n";
+          }
+          out << name << "_sum" << metric.first << " " << format_double(sum)
+              << "\n";
+          out << name << "_count" << metric.first << " " << count << "\n";
+        }
+        break;
+    }
+  }
+
+  return out.str();
+}
+
+bool Registry::write_to_file(const std::string& path)
+{
+  std::string text = render();
+
+  // Write to a temporary file and rename so scrapers never see a partial file
+  std::string tmp_path = path + ".tmp";
+  FILE*       file     = fopen(tmp_path.c_str(), "w");
+  if (!file)
+    return false;
+
+  bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+  ok      = (fclose(file) == 0) && ok;
+
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+  {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Registry::start_socket_exporter(const std::string& socket_path)
+{
+  stop_socket_exporter();
+
+  sockaddr_un address = {};
+  if (socket_path.size() >= sizeof(address.sun_path))
+    return false;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+
+  address.sun_family = AF_UNIX;
+  socket_path.copy(address.sun_path, socket_path.size());
+  unlink(socket_path.c_str());
+
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(fd, 4) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  socket_fd_        = fd;
+  socket_path_      = socket_path;
+  exporter_running_ = true;
+  exporter_thread_  = std::thread(&Registry::exporter_thread_main, this);
+  return true;
+}
+
+void Registry::stop_socket_exporter()
+{
+  if (!exporter_thread_.joinable())
+    return;
+
+  exporter_running_ = false;
+  exporter_thread_.join();
+
+  close(socket_fd_);
+  unlink(socket_path_.c_str());
+  socket_fd_ = -1;
+  socket_path_.clear();
+}
+
+void Registry::exporter_thread_main()
+{
+  while (exporter_running_)
+  {
+    pollfd pfd = {socket_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+
+    int client = accept4(socket_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0)
+      continue;
+
+    std::string text    = render();
+    size_t      written = 0;
+    while (written < text.size())
+    {
+      ssize_t n = send(
+        client, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      written += static_cast<size_t>(n);
+    }
+    close(client);
+  }
+}
+
+void CallMetrics::record(bool                                  success,
+                         std::chrono::steady_clock::time_point start,
+                         const GError*                         error)
+{
+  if (success)
+  {
+    succeeded->increment();
+  }
+  else if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+  {
+    cancelled->increment();
+  }
+  else if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+           g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_TIMEOUT) ||
+           g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY))
+  {
+    timed_out->increment();
+  }
+  else
+  {
+    failed->increment();
+  }
+  latency->observe_since(start);
+}
+
+CallMetrics& dbus_call(const char* component,
+                       const char* interface_name,
+                       const char* method_name)
+{
+  static std::mutex                         mutex;
+  static std::map<std::string, CallMetrics> calls;
+
+  std::string key = std::string(component) + "/" + interface_name + "." +
+                    method_name;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto                        it = calls.find(key);
+  if (it != calls.end())
+    return it->second;
+
+  auto&  registry = Registry::instance();
+  Labels labels   = {{"component", component},
+                     {"interface", interface_name},
+                     {"method", method_name}};
+
+  auto outcome = [&](const char* name)
+  {
+    Labels outcome_labels = labels;
+    outcome_labels.push_back({"outcome", name});
+    return &registry.counter(
+      "bscm_dbus_calls_total", "D-Bus method calls issued", outcome_labels);
+  };
+
+  CallMetrics metrics;
+  metrics.succeeded = outcome("ok");
+  metrics.failed    = outcome("error");
+  metrics.cancelled = outcome("cancelled");
+  metrics.timed_out = outcome("timeout");
+  metrics.latency = &registry.histogram("bscm_dbus_call_duration_seconds",
+                                        "D-Bus method call round-trip time",
+                                        labels);
+
+  return calls.emplace(key, metrics).first->second;
+}
+
+Histogram& signal_dispatch(const char* signal_name)
+{
+  return Registry::instance().histogram(
+    "bscm_signal_dispatch_duration_seconds",
+    "Time spent handling a D-Bus signal",
+    {{"signal", signal_name}});
+}
+
+}  // namespace Metrics
\ No newline at end of file
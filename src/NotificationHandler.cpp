@@ -1,11 +1,40 @@
 #include "NotificationHandler.h"
+#include "Tracing.h"
+#include <algorithm>
+
+namespace
+{
+std::atomic<uint64_t> total_received{0};
+}  // namespace
+
+uint64_t NotificationHandler::get_total_received()
+{
+  return total_received.load(std::memory_order_relaxed);
+}
 
 NotificationHandler::NotificationHandler(GDBusConnection*   connection,
-                                         const std::string& characteristic_path)
+                                         const std::string& characteristic_path,
+                                         const std::string& uuid,
+                                         GMainContext*      context)
   : connection_(connection)
+  , context_(context ? g_main_context_ref(context)
+                     : g_main_context_ref_thread_default())
   , characteristic_path_(characteristic_path)
   , properties_changed_subscription_(0)
+  , subscribers_(std::make_shared<const SubscriberList>())
+  , next_subscriber_id_(1)
+  , active_(false)
 {
+  auto&           registry = Metrics::Registry::instance();
+  Metrics::Labels labels   = {{"uuid", uuid}};
+
+  notifications_received_ = &registry.counter(
+    "bscm_notifications_received_total", "GATT notifications received", labels);
+  notifications_dropped_ = &registry.counter(
+    "bscm_notifications_dropped_total",
+    "GATT notifications discarded without reaching a callback",
+    labels);
+
   if (connection_)
   {
     g_object_ref(connection_);
@@ -20,29 +49,34 @@ NotificationHandler::~NotificationHandler()
   {
     g_object_unref(connection_);
   }
+  g_main_context_unref(context_);
 }
 
-bool NotificationHandler::enable_notifications(NotificationCallback callback)
+bool NotificationHandler::enable_notifications()
 {
   if (!connection_ || properties_changed_subscription_ != 0)
   {
     return false;
   }
 
-  callback_ = callback;
-
-  // Subscribe to PropertiesChanged signals for this characteristic
-  properties_changed_subscription_ =
-    g_dbus_connection_signal_subscribe(connection_,
-                                       BlueZ::SERVICE_NAME,
-                                       BlueZ::PROPERTIES_INTERFACE,
-                                       "PropertiesChanged",
-                                       characteristic_path_.c_str(),
-                                       BlueZ::GATT_CHARACTERISTIC_INTERFACE,
-                                       G_DBUS_SIGNAL_FLAGS_NONE,
-                                       on_properties_changed,
-                                       this,
-                                       nullptr);
+  // Subscribe to PropertiesChanged signals for this characteristic, from the
+  // context's own thread so that they are dispatched there
+  Utils::invoke_sync(
+    context_,
+    [this]
+    {
+      properties_changed_subscription_ =
+        g_dbus_connection_signal_subscribe(connection_,
+                                           BlueZ::SERVICE_NAME,
+                                           BlueZ::PROPERTIES_INTERFACE,
+                                           "PropertiesChanged",
+                                           characteristic_path_.c_str(),
+                                           BlueZ::GATT_CHARACTERISTIC_INTERFACE,
+                                           G_DBUS_SIGNAL_FLAGS_NONE,
+                                           on_properties_changed,
+                                           this,
+                                           nullptr);
+    });
 
   return properties_changed_subscription_ != 0;
 }
@@ -54,14 +88,58 @@ bool NotificationHandler::disable_notifications()
     return true;
   }
 
-  g_dbus_connection_signal_unsubscribe(connection_,
-                                       properties_changed_subscription_);
+  // On the context's thread too: no handler can be running there meanwhile,
+  // and GDBus drops signals already queued for a dead subscription, so none
+  // reaches `this` once this returns
+  Utils::invoke_sync(context_,
+                     [this]
+                     {
+                       g_dbus_connection_signal_unsubscribe(
+                         connection_, properties_changed_subscription_);
+                     });
   properties_changed_subscription_ = 0;
-  callback_                        = nullptr;
 
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  subscribers_ = std::make_shared<const SubscriberList>();
+
+  return true;
+}
+
+uint32_t NotificationHandler::add_subscriber(NotificationCallback callback)
+{
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+
+  auto     subscribers = std::make_shared<SubscriberList>(*subscribers_);
+  uint32_t id          = next_subscriber_id_++;
+  subscribers->push_back({id, std::move(callback)});
+  subscribers_ = std::move(subscribers);
+
+  return id;
+}
+
+bool NotificationHandler::remove_subscriber(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+
+  auto subscribers = std::make_shared<SubscriberList>(*subscribers_);
+  auto it          = std::find_if(
+    subscribers->begin(),
+    subscribers->end(),
+    [id](const Subscriber& subscriber) { return subscriber.id == id; });
+  if (it == subscribers->end())
+    return false;
+
+  subscribers->erase(it);
+  subscribers_ = std::move(subscribers);
   return true;
 }
 
+size_t NotificationHandler::get_subscriber_count()
+{
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  return subscribers_->size();
+}
+
 void NotificationHandler::on_properties_changed(GDBusConnection* connection,
                                                 const gchar*     sender_name,
                                                 const gchar*     object_path,
@@ -72,10 +150,14 @@ void NotificationHandler::on_properties_changed(GDBusConnection* connection,
 {
   (void)connection;
   (void)sender_name;
-  (void)object_path;
   (void)interface_name;
   (void)signal_name;
 
+  TRACE_SPAN("signal", "GattNotification", object_path);
+
+  static auto& dispatch_time = Metrics::signal_dispatch("GattNotification");
+  auto         start         = std::chrono::steady_clock::now();
+
   NotificationHandler* handler = static_cast<NotificationHandler*>(user_data);
 
   const gchar* changed_interface;
@@ -96,6 +178,8 @@ void NotificationHandler::on_properties_changed(GDBusConnection* connection,
 
   g_variant_unref(changed_properties);
   g_variant_unref(invalidated_properties);
+
+  dispatch_time.observe_since(start);
 }
 
 void NotificationHandler::handle_properties_changed(
@@ -114,9 +198,25 @@ void NotificationHandler::handle_properties_changed(
       // This is a notification with new data
       std::vector<uint8_t> data = Utils::variant_to_bytes(value);
 
-      if (callback_)
+      notifications_received_->increment();
+      total_received.fetch_add(1, std::memory_order_relaxed);
+
+      std::shared_ptr<const SubscriberList> subscribers;
+      {
+        std::lock_guard<std::mutex> lock(subscribers_mutex_);
+        subscribers = subscribers_;
+      }
+
+      if (subscribers->empty())
+      {
+        notifications_dropped_->increment();
+      }
+      for (const auto& subscriber : *subscribers)
       {
-        callback_(characteristic_path_, data);
+        if (subscriber.callback)
+        {
+          subscriber.callback(characteristic_path_, data);
+        }
       }
     }
   }
@@ -0,0 +1,233 @@
+#include "OperationScheduler.h"
+#include <algorithm>
+
+OperationScheduler::OperationScheduler(const std::string& label,
+                                       GMainContext*      context)
+  : context_(g_main_context_ref(context))
+  , in_flight_(0)
+  , shut_down_(false)
+{
+  auto& registry = Metrics::Registry::instance();
+  for (size_t i = 0; i < CLASS_COUNT; ++i)
+  {
+    Metrics::Labels labels = {
+      {"adapter", label},
+      {"class", priority_name(static_cast<OperationPriority>(i))}};
+
+    queues_[i].depth = &registry.gauge(
+      "bscm_gatt_queue_depth", "GATT operations waiting for a slot", labels);
+    queues_[i].wait_time = &registry.histogram(
+      "bscm_gatt_queue_wait_seconds",
+      "Time GATT operations waited for a slot",
+      labels);
+  }
+}
+
+OperationScheduler::~OperationScheduler()
+{
+  shutdown();
+  g_main_context_unref(context_);
+}
+
+void OperationScheduler::set_config(const SchedulerConfig& config)
+{
+  std::vector<Start> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_               = config;
+    config_.max_in_flight = std::max<size_t>(config.max_in_flight, 1);
+
+    // A larger depth may let queued operations start right away
+    dispatch_locked(ready);
+  }
+
+  for (auto& start : ready)
+  {
+    start(true);
+  }
+}
+
+SchedulerConfig OperationScheduler::get_config()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return config_;
+}
+
+void OperationScheduler::submit(OperationPriority priority, Start start)
+{
+  std::vector<Start> ready;
+  bool               granted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    granted = !shut_down_;
+    if (!granted)
+    {
+      ready.push_back(std::move(start));
+    }
+    else
+    {
+      ClassQueue& queue = queues_[static_cast<size_t>(priority)];
+      queue.waiters.push_back(
+        {std::move(start), std::chrono::steady_clock::now()});
+      queue.depth->add(1);
+      dispatch_locked(ready);
+    }
+  }
+
+  // After shutdown `ready` only holds the refused operation
+  for (auto& ready_start : ready)
+  {
+    ready_start(granted);
+  }
+}
+
+bool OperationScheduler::acquire(OperationPriority priority)
+{
+  if (g_main_context_is_owner(context_))
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shut_down_ || in_flight_ >= config_.max_in_flight)
+      return false;
+    ++in_flight_;
+    return true;
+  }
+
+  std::atomic<bool> granted{false};
+  bool              success = false;
+  submit(priority,
+         [this, &granted, &success](bool ok)
+         {
+           {
+             std::lock_guard<std::mutex> lock(mutex_);
+             success = ok;
+             granted = true;
+           }
+           granted_cv_.notify_all();
+           g_main_context_wakeup(context_);
+         });
+
+  // The slot may be freed by a reply that only arrives if someone iterates
+  // the context; do it here if no one else is
+  if (!granted && g_main_context_acquire(context_))
+  {
+    Utils::ScopedMainContext scope(context_);
+    while (!granted)
+    {
+      g_main_context_iteration(context_, TRUE);
+    }
+    g_main_context_release(context_);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  granted_cv_.wait(lock, [&] { return granted.load(); });
+  return success;
+}
+
+void OperationScheduler::release()
+{
+  std::vector<Start> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_flight_ > 0)
+    {
+      --in_flight_;
+    }
+    dispatch_locked(ready);
+  }
+
+  for (auto& start : ready)
+  {
+    start(true);
+  }
+}
+
+void OperationScheduler::shutdown()
+{
+  std::vector<Start> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shut_down_ = true;
+    for (auto& queue : queues_)
+    {
+      queue.depth->add(-static_cast<int64_t>(queue.waiters.size()));
+      for (auto& waiter : queue.waiters)
+      {
+        cancelled.push_back(std::move(waiter.start));
+      }
+      queue.waiters.clear();
+    }
+  }
+
+  for (auto& start : cancelled)
+  {
+    start(false);
+  }
+}
+
+size_t OperationScheduler::get_queue_depth(OperationPriority priority)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queues_[static_cast<size_t>(priority)].waiters.size();
+}
+
+size_t OperationScheduler::get_in_flight()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_flight_;
+}
+
+const char* OperationScheduler::priority_name(OperationPriority priority)
+{
+  switch (priority)
+  {
+    case OperationPriority::Interactive:
+      return "interactive";
+    case OperationPriority::Control:
+      return "control";
+    case OperationPriority::Bulk:
+      return "bulk";
+    case OperationPriority::Background:
+      return "background";
+  }
+  return "unknown";
+}
+
+void OperationScheduler::dispatch_locked(std::vector<Start>& ready)
+{
+  auto now = std::chrono::steady_clock::now();
+
+  while (in_flight_ < config_.max_in_flight)
+  {
+    // Effective class: the queued class minus one per aging period waited.
+    // Ties go to the more urgent class, so aging only ever catches up.
+    ClassQueue* best      = nullptr;
+    long long   best_rank = 0;
+    for (size_t i = 0; i < CLASS_COUNT; ++i)
+    {
+      ClassQueue& queue = queues_[i];
+      if (queue.waiters.empty())
+        continue;
+
+      long long rank = static_cast<long long>(i);
+      if (config_.aging_period.count() > 0)
+      {
+        rank -= (now - queue.waiters.front().queued) / config_.aging_period;
+      }
+      if (!best || rank < best_rank)
+      {
+        best      = &queue;
+        best_rank = rank;
+      }
+    }
+
+    if (!best)
+      return;
+
+    Waiter& waiter = best->waiters.front();
+    best->wait_time->observe(now - waiter.queued);
+    ready.push_back(std::move(waiter.start));
+    best->waiters.pop_front();
+    best->depth->add(-1);
+    ++in_flight_;
+  }
+}
\ No newline at end of file
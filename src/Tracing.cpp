@@ -0,0 +1,180 @@
+#include "Tracing.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Tracing
+{
+
+std::atomic<bool> enabled_flag{false};
+
+namespace
+{
+// A ring entry with a sequence lock: odd while event number n is being
+// written into it (2n + 1), 2n + 2 once it holds that event. A reader copies
+// the event and keeps the copy only if the sequence was the expected even
+// value before and after.
+struct Slot
+{
+  std::atomic<uint64_t> sequence{0};
+  Event                 event;
+};
+
+// Single-writer ring owned by one thread; kept alive by the registry after
+// the thread exits so its spans can still be dumped.
+struct ThreadBuffer
+{
+  long                  tid;
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> cleared{0};  // events before this one were dropped
+  Slot                  slots[EVENTS_PER_THREAD];
+};
+
+std::mutex                                 buffers_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+ThreadBuffer& thread_buffer()
+{
+  thread_local std::shared_ptr<ThreadBuffer> buffer;
+  if (!buffer)
+  {
+    buffer      = std::make_shared<ThreadBuffer>();
+    buffer->tid = syscall(SYS_gettid);
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.push_back(buffer);
+  }
+  return *buffer;
+}
+
+void write_json_string(FILE* file, const char* text)
+{
+  fputc('"', file);
+  for (const char* c = text; *c; ++c)
+  {
+    if (*c == '"' || *c == '\\')
+    {
+      fputc('\\', file);
+      fputc(*c, file);
+    }
+    else if (static_cast<unsigned char>(*c) < 0x20)
+    {
+      fprintf(file, "\\u%04x", *c);
+    }
+    else
+    {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+}  // namespace
+
+void set_enabled(bool enabled)
+{
+  enabled_flag.store(enabled, std::memory_order_relaxed);
+}
+
+void clear()
+{
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  // The owning thread keeps writing; only where dumps start moves
+  for (auto& buffer : buffers)
+  {
+    buffer->cleared.store(buffer->written.load(std::memory_order_acquire),
+                          std::memory_order_release);
+  }
+}
+
+void Span::record(const char* category,
+                  const char* name,
+                  const char* detail,
+                  int64_t     begin_us,
+                  int64_t     end_us)
+{
+  ThreadBuffer& buffer = thread_buffer();
+  uint64_t      index  = buffer.written.load(std::memory_order_relaxed);
+  Slot&         slot   = buffer.slots[index & (EVENTS_PER_THREAD - 1)];
+  Event&        event  = slot.event;
+
+  slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  event.category = category;
+  event.name     = name;
+  event.begin_us = begin_us;
+  event.end_us   = end_us;
+  if (detail)
+  {
+    g_strlcpy(event.detail, detail, sizeof(event.detail));
+  }
+  else
+  {
+    event.detail[0] = '\0';
+  }
+
+  slot.sequence.store(2 * index + 2, std::memory_order_release);
+  buffer.written.store(index + 1, std::memory_order_release);
+}
+
+bool write_chrome_trace(const std::string& path)
+{
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  long pid   = getpid();
+  bool first = true;
+
+  fputs("{\"traceEvents\":[\n", file);
+
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  for (const auto& buffer : buffers)
+  {
+    uint64_t written = buffer->written.load(std::memory_order_acquire);
+    uint64_t begin =
+      written > EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+    begin = std::max(begin, buffer->cleared.load(std::memory_order_acquire));
+
+    for (uint64_t i = begin; i < written; ++i)
+    {
+      // The owner may be overwriting the slot with a newer event meanwhile
+      const Slot& slot     = buffer->slots[i & (EVENTS_PER_THREAD - 1)];
+      uint64_t    expected = 2 * i + 2;
+      if (slot.sequence.load(std::memory_order_acquire) != expected)
+        continue;
+      Event event = slot.event;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != expected)
+        continue;
+
+      fputs(first ? "" : ",\n", file);
+      first = false;
+
+      fputs("{\"name\":", file);
+      write_json_string(file, event.name);
+      fputs(",\"cat\":", file);
+      write_json_string(file, event.category);
+      fprintf(file,
+              ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%ld,\"tid\":%ld",
+              static_cast<long long>(event.begin_us),
+              static_cast<long long>(event.end_us - event.begin_us),
+              pid,
+              buffer->tid);
+      if (event.detail[0])
+      {
+        fputs(",\"args\":{\"detail\":", file);
+        write_json_string(file, event.detail);
+        fputc('}', file);
+      }
+      fputc('}', file);
+    }
+  }
+
+  fputs("\n]}\n", file);
+  return fclose(file) == 0;
+}
+
+}  // namespace Tracing
\ No newline at end of file
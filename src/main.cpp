@@ -1,17 +1,23 @@
 #include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include "BluetoothManager.h"
 #include "Common.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Tracing.h"
 
 class BluetoothCLI
 {
 private:
   BluetoothManager                 manager_;
   std::shared_ptr<BluetoothDevice> current_device_;
-  GMainLoop*                       main_loop_;
+  // The CLI's own notification subscriptions on current_device_, by
+  // characteristic UUID
+  std::map<std::string, uint32_t> notify_subscriptions_;
 
   void print_help()
   {
@@ -21,31 +27,60 @@ private:
       << "  help                        - Show this help message" << std::endl
       << "  quit/exit                   - Exit the application" << std::endl
 
-      << "  power on/off                - Power on/off the Bluetooth adapter"
+      << "  power on/off                - Power on/off the Bluetooth adapters"
       << std::endl
       << "  scan [service_uuid]         - Start scanning for devices"
       << std::endl
       << "                                (optionally filter by service UUID)"
       << std::endl
       << "  stop                        - Stop scanning" << std::endl
+      << "  duty [off|<window_ms> <interval_ms> [max_rate]]  - Scan duty cycle"
+      << std::endl
+      << "                                and notification throughput stats"
+      << std::endl
+      << "  monitor <ad_type> <hex> [high_dbm low_dbm]  - Watch for devices"
+      << std::endl
+      << "                                without scanning (or remove <id>)"
+      << std::endl
       << "  list                        - List discovered devices" << std::endl
+      << "  adapters                    - Show per-adapter link statistics"
+      << std::endl
+      << "  gc [off|now|<max_age_s> [interval_s]]  - Remove stale devices"
+      << std::endl
+      << "                                from BlueZ" << std::endl
       << "  connect <address>           - Connect to device by MAC address"
       << std::endl
 
+      << "  autoconnect [<address>|remove <address>]  - Connect as soon as"
+      << std::endl
+      << "                                the device advertises" << std::endl
       << "  disconnect                  - Disconnect from current device"
       << std::endl
       << "  services                    - List services and characteristics"
          " of connected device"
       << std::endl
-      << "  read <service_uuid> <char_uuid>  - Read characteristic value"
+      << "  read <service_uuid> <char_uuid> [offset]  - Read characteristic"
+      << std::endl
+      << "  readall                     - Read every readable characteristic"
+      << std::endl
+      << "  cache <char_uuid> <ttl_ms>  - Cache reads of a characteristic"
+         " (0: off)"
+      << std::endl
+      << "  retry <attempts> [backoff_ms]  - Retry transient failures"
       << std::endl
-      << "  write <service_uuid> <char_uuid> <hex_data>  - Write to "
-         "characteristic"
+      << "  write <service_uuid> <char_uuid> <hex_data> [reliable|latest]"
+         "  - Write"
       << std::endl
       << "  notify <service_uuid> <char_uuid> [on/off]   - "
          "Enable/disable notifications"
       << std::endl
       << "  device                      - Show current device info" << std::endl
+      << "  log <debug|info|warning|error|off>  - Set library log level"
+      << std::endl
+      << "  metrics [file <path>|socket <path>]  - Show or export metrics"
+      << std::endl
+      << "  trace on|off|dump <file>    - Record spans / write Chrome trace"
+      << std::endl
       << std::endl;
   }
 
@@ -104,18 +139,12 @@ private:
       return;
     }
 
-    auto device = manager_.get_device(args[1]);
-    if (!device)
-    {
-      Utils::print_with_timestamp("Device not found: " + args[1]);
-      return;
-    }
-
-    Utils::print_with_timestamp("Connecting to " + device->get_name() + " (" +
-                                args[1] + ")...");
-    if (device->connect())
+    Utils::print_with_timestamp("Connecting to " + args[1] + "...");
+    auto device = manager_.connect_device(args[1]);
+    if (device)
     {
       current_device_ = device;
+      notify_subscriptions_.clear();
       Utils::print_with_timestamp("Connected successfully!");
 
       // Wait a moment for services to be resolved
@@ -142,13 +171,50 @@ private:
 
     if (args.size() < 3)
     {
-      std::cout << "Usage: read <service_uuid> <characteristic_uuid>"
+      std::cout << "Usage: read <service_uuid> <characteristic_uuid> [offset]"
                 << std::endl;
       return;
     }
 
+    auto characteristic = current_device_->get_characteristic(args[1], args[2]);
+    if (!characteristic)
+    {
+      Utils::print_with_timestamp("Characteristic not found");
+      return;
+    }
+
+    LongTransferOptions options;
+    try
+    {
+      options.offset =
+        args.size() > 3 ? static_cast<uint16_t>(std::stoul(args[3])) : 0;
+    }
+    catch (const std::exception&)
+    {
+      std::cout << "Invalid number" << std::endl;
+      return;
+    }
+
+    // Cached characteristics go through the cache unless an offset is given
     std::vector<uint8_t> data;
-    if (current_device_->read_characteristic(args[1], args[2], data))
+    bool                 success;
+    BluezError           error;
+    if (options.offset == 0 && characteristic->get_read_cache_ttl().count() > 0)
+    {
+      success = characteristic->read_value(
+        data, GattCharacteristic::DEFAULT_TIMEOUT, &error);
+    }
+    else
+    {
+      // Large enough for any attribute value
+      uint8_t buffer[512];
+      size_t  length = 0;
+      success        = characteristic->read_value_into(
+        buffer, sizeof(buffer), length, options);
+      data.assign(buffer, buffer + length);
+    }
+
+    if (success)
     {
       Utils::print_with_timestamp(
         "Read " + std::to_string(data.size()) +
@@ -156,8 +222,119 @@ private:
     }
     else
     {
-      Utils::print_with_timestamp("Failed to read characteristic");
+      Utils::print_with_timestamp("Failed to read characteristic" +
+                                  describe_error(error));
+    }
+  }
+
+  // " (code after N attempts): message", or nothing if `error` is unset
+  static std::string describe_error(const BluezError& error)
+  {
+    if (error.ok())
+      return "";
+
+    std::string text = std::string(" (") + error_code_name(error.code);
+    if (error.attempts > 1)
+    {
+      text += " after " + std::to_string(error.attempts) + " attempts";
     }
+    return text + "): " + error.message;
+  }
+
+  void handle_retry_command(const std::vector<std::string>& args)
+  {
+    if (!current_device_)
+    {
+      Utils::print_with_timestamp("No device connected");
+      return;
+    }
+
+    if (args.size() < 2)
+    {
+      const RetryPolicy& policy = current_device_->get_retry_policy();
+      std::cout << "Attempts: " << policy.max_attempts
+                << ", initial backoff: " << policy.initial_backoff.count()
+                << " ms" << std::endl;
+      return;
+    }
+
+    RetryPolicy policy = current_device_->get_retry_policy();
+    try
+    {
+      policy.max_attempts = static_cast<unsigned>(std::stoul(args[1]));
+      if (args.size() > 2)
+      {
+        policy.initial_backoff = std::chrono::milliseconds(std::stoll(args[2]));
+      }
+    }
+    catch (const std::exception&)
+    {
+      std::cout << "Invalid number" << std::endl;
+      return;
+    }
+
+    current_device_->set_retry_policy(policy);
+    Utils::print_with_timestamp(
+      "Up to " + std::to_string(policy.max_attempts) + " attempts per call");
+  }
+
+  void handle_cache_command(const std::vector<std::string>& args)
+  {
+    if (!current_device_)
+    {
+      Utils::print_with_timestamp("No device connected");
+      return;
+    }
+
+    if (args.size() < 3)
+    {
+      std::cout << "Usage: cache <characteristic_uuid> <ttl_ms>" << std::endl;
+      return;
+    }
+
+    long long ttl_ms;
+    try
+    {
+      ttl_ms = std::stoll(args[2]);
+    }
+    catch (const std::exception&)
+    {
+      std::cout << "Invalid number" << std::endl;
+      return;
+    }
+
+    current_device_->set_read_cache_ttl(args[1],
+                                        std::chrono::milliseconds(ttl_ms));
+    Utils::print_with_timestamp(
+      ttl_ms > 0 ? "Caching reads of " + args[1] + " for " + args[2] + " ms"
+                 : "Read cache disabled for " + args[1]);
+  }
+
+  void handle_readall_command()
+  {
+    if (!current_device_ || !current_device_->is_connected())
+    {
+      Utils::print_with_timestamp("No device connected");
+      return;
+    }
+
+    DeviceSnapshot snapshot = current_device_->read_all();
+    for (const auto& reading : snapshot.readings)
+    {
+      std::cout << "  " << reading.uuid << ": "
+                << (reading.success ? Utils::bytes_to_hex_string(reading.value)
+                                    : "error: " + reading.error)
+                << std::endl;
+    }
+
+    char line[96];
+    snprintf(line,
+             sizeof(line),
+             "Read %zu of %zu characteristics in %.1f ms",
+             snapshot.succeeded,
+             snapshot.readings.size(),
+             snapshot.wall_time.count() / 1000.0);
+    Utils::print_with_timestamp(line);
   }
 
   void handle_write_command(const std::vector<std::string>& args)
@@ -170,21 +347,336 @@ private:
 
     if (args.size() < 4)
     {
-      std::cout
-        << "Usage: write <service_uuid> <characteristic_uuid> <hex_data>"
-        << std::endl;
+      std::cout << "Usage: write <service_uuid> <characteristic_uuid> "
+                   "<hex_data> [reliable|latest]"
+                << std::endl;
       return;
     }
 
-    auto data = Utils::hex_string_to_bytes(args[3]);
-    if (current_device_->write_characteristic(args[1], args[2], data))
+    std::vector<uint8_t> data;
+    if (!Utils::hex_string_to_bytes(args[3], data))
+    {
+      Utils::print_with_timestamp("Invalid hex data: " + args[3]);
+      return;
+    }
+
+    bool       written;
+    BluezError error;
+    if (args.size() > 4 && args[4] == "reliable")
+    {
+      auto characteristic =
+        current_device_->get_characteristic(args[1], args[2]);
+
+      LongTransferOptions options;
+      options.reliable = true;
+      written          = characteristic && characteristic->write_value_long(
+                                     data.data(), data.size(), options);
+    }
+    else if (args.size() > 4 && args[4] == "latest")
+    {
+      auto characteristic =
+        current_device_->get_characteristic(args[1], args[2]);
+      if (characteristic && characteristic->write_value_latest(data))
+      {
+        Utils::print_with_timestamp("Write queued: " +
+                                    Utils::bytes_to_hex_string(data));
+        return;
+      }
+      written = false;
+    }
+    else
+    {
+      written = current_device_->write_characteristic(
+        args[1],
+        args[2],
+        data,
+        OperationPriority::Interactive,
+        GattCharacteristic::DEFAULT_TIMEOUT,
+        &error);
+    }
+
+    if (written)
     {
       Utils::print_with_timestamp("Write successful: " +
                                   Utils::bytes_to_hex_string(data));
     }
     else
     {
-      Utils::print_with_timestamp("Failed to write characteristic");
+      Utils::print_with_timestamp("Failed to write characteristic" +
+                                  describe_error(error));
+    }
+  }
+
+  void handle_log_command(const std::vector<std::string>& args)
+  {
+    static const std::map<std::string, LogLevel> levels = {
+      {"debug", LogLevel::Debug},
+      {"info", LogLevel::Info},
+      {"warning", LogLevel::Warning},
+      {"error", LogLevel::Error},
+      {"off", LogLevel::None}};
+
+    auto it = args.size() > 1 ? levels.find(args[1]) : levels.end();
+    if (it == levels.end())
+    {
+      std::cout << "Usage: log <debug|info|warning|error|off>" << std::endl;
+      return;
+    }
+
+    Logger::instance().set_level(it->second);
+    Utils::print_with_timestamp("Log level set to " + args[1]);
+  }
+
+  void handle_metrics_command(const std::vector<std::string>& args)
+  {
+    auto& registry = Metrics::Registry::instance();
+
+    if (args.size() < 2)
+    {
+      std::cout << registry.render();
+    }
+    else if (args.size() == 3 && args[1] == "file")
+    {
+      Utils::print_with_timestamp(registry.write_to_file(args[2])
+                                    ? "Metrics written to " + args[2]
+                                    : "Failed to write metrics to " + args[2]);
+    }
+    else if (args.size() == 3 && args[1] == "socket")
+    {
+      Utils::print_with_timestamp(
+        registry.start_socket_exporter(args[2])
+          ? "Serving metrics on " + args[2]
+          : "Failed to open metrics socket " + args[2]);
+    }
+    else
+    {
+      std::cout << "Usage: metrics [file <path>|socket <path>]" << std::endl;
+    }
+  }
+
+  void handle_trace_command(const std::vector<std::string>& args)
+  {
+    if (args.size() == 2 && (args[1] == "on" || args[1] == "off"))
+    {
+      Tracing::set_enabled(args[1] == "on");
+      Utils::print_with_timestamp("Tracing " + args[1]);
+    }
+    else if (args.size() == 3 && args[1] == "dump")
+    {
+      Utils::print_with_timestamp(Tracing::write_chrome_trace(args[2])
+                                    ? "Trace written to " + args[2]
+                                    : "Failed to write trace to " + args[2]);
+    }
+    else
+    {
+      std::cout << "Usage: trace on|off|dump <file>" << std::endl;
+    }
+  }
+
+  void handle_duty_command(const std::vector<std::string>& args)
+  {
+    ScanSchedule schedule = manager_.get_scan_schedule();
+
+    if (args.size() < 2)
+    {
+      manager_.print_scan_stats();
+      return;
+    }
+
+    if (args.size() == 2 && args[1] == "off")
+    {
+      schedule.window   = std::chrono::milliseconds(0);
+      schedule.interval = std::chrono::milliseconds(0);
+    }
+    else if (args.size() == 3 || args.size() == 4)
+    {
+      try
+      {
+        schedule.window   = std::chrono::milliseconds(std::stoul(args[1]));
+        schedule.interval = std::chrono::milliseconds(std::stoul(args[2]));
+        schedule.max_notification_rate =
+          args.size() == 4 ? std::stoul(args[3]) : 0;
+      }
+      catch (const std::exception&)
+      {
+        std::cout << "Invalid number" << std::endl;
+        return;
+      }
+    }
+    else
+    {
+      std::cout << "Usage: duty [off|<window_ms> <interval_ms> [max_rate]]"
+                << std::endl;
+      return;
+    }
+
+    manager_.set_scan_schedule(schedule);
+    manager_.print_scan_stats();
+  }
+
+  void handle_gc_command(const std::vector<std::string>& args)
+  {
+    DeviceGcPolicy policy = manager_.get_device_gc_policy();
+
+    if (args.size() == 2 && args[1] == "now")
+    {
+      Utils::print_with_timestamp(
+        "Requested removal of " +
+        std::to_string(manager_.collect_stale_devices()) + " device(s)");
+      return;
+    }
+
+    if (args.size() == 2 && args[1] == "off")
+    {
+      policy.max_age = std::chrono::seconds(0);
+      manager_.set_device_gc_policy(policy);
+    }
+    else if (args.size() == 2 || args.size() == 3)
+    {
+      try
+      {
+        policy.max_age = std::chrono::seconds(std::stoul(args[1]));
+        if (args.size() == 3)
+        {
+          policy.interval = std::chrono::seconds(std::stoul(args[2]));
+        }
+      }
+      catch (const std::exception&)
+      {
+        std::cout << "Invalid number" << std::endl;
+        return;
+      }
+      manager_.set_device_gc_policy(policy);
+    }
+    else if (args.size() != 1)
+    {
+      std::cout << "Usage: gc [off|now|<max_age_s> [interval_s]]" << std::endl;
+      return;
+    }
+
+    DeviceGcStats stats = manager_.get_device_gc_stats();
+    if (policy.max_age.count() > 0)
+    {
+      Utils::print_with_timestamp(
+        "Device GC: unseen for " + std::to_string(policy.max_age.count()) +
+        " s, swept every " + std::to_string(policy.interval.count()) + " s");
+    }
+    else
+    {
+      Utils::print_with_timestamp("Device GC: off");
+    }
+    std::cout << "  tracked: " << stats.tracked << ", sweeps: " << stats.sweeps
+              << ", removed: " << stats.removed << ", failed: " << stats.failed
+              << std::endl;
+  }
+
+  void handle_autoconnect_command(const std::vector<std::string>& args)
+  {
+    if (args.size() == 2)
+    {
+      manager_.add_auto_connect(args[1]);
+      Utils::print_with_timestamp("Auto-connect enabled for " + args[1]);
+      return;
+    }
+
+    if (args.size() == 3 && args[1] == "remove")
+    {
+      Utils::print_with_timestamp(manager_.remove_auto_connect(args[2])
+                                    ? "Auto-connect disabled for " + args[2]
+                                    : "Not in the auto-connect list");
+      return;
+    }
+
+    if (args.size() != 1)
+    {
+      std::cout << "Usage: autoconnect [<address>|remove <address>]"
+                << std::endl;
+      return;
+    }
+
+    auto entries = manager_.get_auto_connect_stats();
+    if (entries.empty())
+    {
+      Utils::print_with_timestamp("Auto-connect list is empty");
+      return;
+    }
+
+    Utils::print_with_timestamp("Auto-connect list:");
+    for (const auto& entry : entries)
+    {
+      std::cout << "  " << entry.address << " - attempts: " << entry.attempts
+                << ", connected: " << entry.connected << ", last latency: "
+                << entry.last_latency.count() / 1000.0 << " ms" << std::endl;
+    }
+  }
+
+  void handle_monitor_command(const std::vector<std::string>& args)
+  {
+    if (args.size() == 3 && args[1] == "remove")
+    {
+      uint32_t id;
+      try
+      {
+        id = std::stoul(args[2]);
+      }
+      catch (const std::exception&)
+      {
+        std::cout << "Invalid number" << std::endl;
+        return;
+      }
+      Utils::print_with_timestamp(manager_.remove_advertisement_monitor(id)
+                                    ? "Monitor removed"
+                                    : "No such monitor");
+      return;
+    }
+
+    if (args.size() != 3 && args.size() != 5)
+    {
+      std::cout << "Usage: monitor <ad_type> <hex_pattern> [high_dbm low_dbm]"
+                << std::endl
+                << "       monitor remove <id>" << std::endl;
+      return;
+    }
+
+    MonitorPattern pattern;
+    MonitorConfig  config;
+    try
+    {
+      pattern.ad_type = static_cast<uint8_t>(std::stoul(args[1], nullptr, 0));
+      if (args.size() == 5)
+      {
+        config.rssi_high_threshold = static_cast<int16_t>(std::stoi(args[3]));
+        config.rssi_low_threshold  = static_cast<int16_t>(std::stoi(args[4]));
+      }
+    }
+    catch (const std::exception&)
+    {
+      std::cout << "Invalid number" << std::endl;
+      return;
+    }
+
+    if (!Utils::hex_string_to_bytes(args[2], pattern.content) ||
+        pattern.content.empty())
+    {
+      std::cout << "Invalid hex pattern" << std::endl;
+      return;
+    }
+    config.patterns.push_back(pattern);
+
+    uint32_t id = manager_.add_advertisement_monitor(
+      config,
+      [](const std::string& address, const std::string&)
+      { Utils::print_with_timestamp("Monitor: found " + address); },
+      [](const std::string& address, const std::string&)
+      { Utils::print_with_timestamp("Monitor: lost " + address); });
+
+    if (id)
+    {
+      Utils::print_with_timestamp("Monitor " + std::to_string(id) + " added");
+    }
+    else
+    {
+      Utils::print_with_timestamp("Failed to add monitor");
     }
   }
 
@@ -211,15 +703,24 @@ private:
 
     if (enable)
     {
+      if (notify_subscriptions_.count(args[2]))
+      {
+        Utils::print_with_timestamp("Notifications already enabled for " +
+                                    args[2]);
+        return;
+      }
+
       auto callback = [this, args](const std::string&          char_path,
                                    const std::vector<uint8_t>& data) {
         Utils::print_with_timestamp("NOTIFICATION [" + args[2] +
                                     "]: " + Utils::bytes_to_hex_string(data));
       };
 
-      if (current_device_->subscribe_to_notifications(
-            args[1], args[2], callback))
+      uint32_t id =
+        current_device_->subscribe_to_notifications(args[1], args[2], callback);
+      if (id)
       {
+        notify_subscriptions_[args[2]] = id;
         Utils::print_with_timestamp("Notifications enabled for " + args[2]);
       }
       else
@@ -229,8 +730,12 @@ private:
     }
     else
     {
-      if (current_device_->unsubscribe_from_notifications(args[1], args[2]))
+      // Leaves any other subscriber of the characteristic listening
+      auto     it = notify_subscriptions_.find(args[2]);
+      uint32_t id = it != notify_subscriptions_.end() ? it->second : 0;
+      if (current_device_->unsubscribe_from_notifications(args[1], args[2], id))
       {
+        notify_subscriptions_.erase(args[2]);
         Utils::print_with_timestamp("Notifications disabled for " + args[2]);
       }
       else
@@ -241,20 +746,14 @@ private:
   }
 
 public:
-  BluetoothCLI() : main_loop_(nullptr) {}
-
-  ~BluetoothCLI()
+  int run(size_t device_connections)
   {
-    if (main_loop_)
-    {
-      g_main_loop_unref(main_loop_);
-    }
-  }
+    // The library is silent by default; the CLI shows its log on stdout
+    Logger::instance().set_sink(Logger::stream_sink(stdout));
 
-  int run()
-  {
     Utils::print_with_timestamp("Bluetooth GATT Client starting...");
 
+    manager_.set_device_connection_count(device_connections);
     if (!manager_.initialize())
     {
       std::cerr << "Failed to initialize Bluetooth manager" << std::endl;
@@ -263,11 +762,14 @@ public:
 
     Utils::print_with_timestamp("Bluetooth manager initialized");
 
-    // Create main loop for GLib events
-    main_loop_ = g_main_loop_new(nullptr, FALSE);
-
-    // Start main loop in separate thread
-    std::thread loop_thread([this]() { g_main_loop_run(main_loop_); });
+    manager_.set_auto_connect_callback(
+      [](std::shared_ptr<BluetoothDevice> device,
+         std::chrono::microseconds        latency)
+      {
+        Utils::print_with_timestamp(
+          "Auto-connected to " + device->get_address() + " " +
+          std::to_string(latency.count() / 1000.0) + " ms after advertising");
+      });
 
     print_help();
 
@@ -355,10 +857,30 @@ public:
           Utils::print_with_timestamp("Failed to stop scanning");
         }
       }
+      else if (command == "duty")
+      {
+        handle_duty_command(args);
+      }
+      else if (command == "gc")
+      {
+        handle_gc_command(args);
+      }
+      else if (command == "autoconnect")
+      {
+        handle_autoconnect_command(args);
+      }
+      else if (command == "monitor")
+      {
+        handle_monitor_command(args);
+      }
       else if (command == "list")
       {
         manager_.print_discovered_devices();
       }
+      else if (command == "adapters")
+      {
+        manager_.print_adapter_stats();
+      }
       else if (command == "connect")
       {
         handle_connect_command(args);
@@ -369,6 +891,7 @@ public:
         {
           Utils::print_with_timestamp("Disconnected");
           current_device_.reset();
+          notify_subscriptions_.clear();
         }
         else
         {
@@ -391,6 +914,18 @@ public:
       {
         handle_read_command(args);
       }
+      else if (command == "readall")
+      {
+        handle_readall_command();
+      }
+      else if (command == "cache")
+      {
+        handle_cache_command(args);
+      }
+      else if (command == "retry")
+      {
+        handle_retry_command(args);
+      }
       else if (command == "write")
       {
         handle_write_command(args);
@@ -399,6 +934,18 @@ public:
       {
         handle_notify_command(args);
       }
+      else if (command == "metrics")
+      {
+        handle_metrics_command(args);
+      }
+      else if (command == "trace")
+      {
+        handle_trace_command(args);
+      }
+      else if (command == "log")
+      {
+        handle_log_command(args);
+      }
       else if (command == "device")
       {
         if (current_device_)
@@ -426,25 +973,32 @@ public:
     }
 
     manager_.stop_discovery();
-    manager_.cleanup();
+    manager_.cleanup();  // also stops the manager's I/O thread
+
+    Logger::instance().flush();
+    return 0;
+  }
+};
 
-    // Stop main loop
-    if (main_loop_)
+int main(int argc, char* argv[])
+{
+  // --connections <n>: spread devices over n dedicated bus connections
+  size_t device_connections = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "--connections" && i + 1 < argc)
     {
-      g_main_loop_quit(main_loop_);
+      device_connections = std::strtoul(argv[++i], nullptr, 10);
     }
-
-    if (loop_thread.joinable())
+    else
     {
-      loop_thread.join();
+      std::cerr << "Usage: " << argv[0] << " [--connections <n>]"
+                << std::endl;
+      return 2;
     }
-
-    return 0;
   }
-};
 
-int main()
-{
   BluetoothCLI cli;
-  return cli.run();
+  return cli.run(device_connections);
 }
\ No newline at end of file